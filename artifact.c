@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "compiler.h"
+#include "headers.h"
+
+#define MAX_ARTIFACT_PATH 4096
+#define INITIAL_STRING_SLOTS 1024
+
+static const char *stageNames[] = {"none", "lex", "parse", "optimize"};
+
+const char* stageName(Stage stage) {
+    return stageNames[stage];
+}
+
+// STAGE_NONE for a name -stop-after does not know
+Stage parseStage(const char *name) {
+    for (int stage = STAGE_LEX; stage <= STAGE_OPTIMIZE; stage++) {
+        if (strcmp(name, stageNames[stage]) == 0) return (Stage)stage;
+    }
+    return STAGE_NONE;
+}
+
+static void growStringSlots(ArtifactWriter *w) {
+    unsigned count = w->slotCount ? w->slotCount * 2 : INITIAL_STRING_SLOTS;
+    unsigned *slots = (unsigned*)xcalloc(count, sizeof(unsigned));
+    const char *strings = w->sections[SECTION_STRINGS].data;
+    for (unsigned i = 0; i < w->slotCount; i++) {
+        unsigned slot = w->stringSlots[i];
+        if (!slot) continue;
+        const char *s = strings + slot - 1;
+        unsigned j = (unsigned)hashBytes(HASH_SEED, s, strlen(s)) & (count - 1);
+        while (slots[j]) j = (j + 1) & (count - 1);
+        slots[j] = slot;
+    }
+    free(w->stringSlots);
+    w->stringSlots = slots;
+    w->slotCount = count;
+}
+
+// Offset of s in the string table, adding it the first time
+static unsigned intern(ArtifactWriter *w, const char *s) {
+    if (2 * (w->stringCount + 1) > w->slotCount) growStringSlots(w);
+    Output *strings = &w->sections[SECTION_STRINGS];
+    size_t length = strlen(s);
+    unsigned mask = w->slotCount - 1;
+    for (unsigned i = (unsigned)hashBytes(HASH_SEED, s, length) & mask;; i = (i + 1) & mask) {
+        unsigned slot = w->stringSlots[i];
+        if (!slot) {
+            unsigned offset = (unsigned)strings->length;
+            outWrite(strings, s, length + 1);
+            w->stringSlots[i] = offset + 1;
+            w->stringCount++;
+            return offset;
+        }
+        if (strcmp(strings->data + slot - 1, s) == 0) return slot - 1;
+    }
+}
+
+static void saveTokens(ArtifactWriter *w, Compiler *cc) {
+    for (int i = 0; i < cc->tokenCount; i++) {
+        TokenRecord record = {cc->tokenTable[i].type, intern(w, cc->tokenTable[i].lexeme), cc->tokenTable[i].line};
+        outWrite(&w->sections[SECTION_TOKENS], (const char*)&record, sizeof(record));
+    }
+    w->counts[SECTION_TOKENS] = cc->tokenCount;
+}
+
+static NodeRecord* nodeRecord(ArtifactWriter *w, int index) {
+    return (NodeRecord*)w->sections[SECTION_NODES].data + index;
+}
+
+// Saves a chain of nodes and everything under them, each node before its
+// children and its children before the rest of the chain; returns the
+// index of the first, or -1. Recursion follows the depth of the tree,
+// not the length of a chain.
+static int saveNodes(ArtifactWriter *w, ASTNode *node) {
+    int first = -1, previous = -1;
+    for (; node; node = node->next) {
+        int index = w->counts[SECTION_NODES]++;
+        NodeRecord record = {node->type, intern(w, node->name), -1, -1, -1, -1, node->dataType, node->arraySize};
+        outWrite(&w->sections[SECTION_NODES], (const char*)&record, sizeof(record));
+        if (previous >= 0) nodeRecord(w, previous)->next = index;
+        else first = index;
+
+        int condition = saveNodes(w, node->condition);
+        nodeRecord(w, index)->condition = condition;
+        int body = saveNodes(w, node->body);
+        nodeRecord(w, index)->body = body;
+        int elseBody = saveNodes(w, node->elseBody);
+        nodeRecord(w, index)->elseBody = elseBody;
+        previous = index;
+    }
+    return first;
+}
+
+static void saveUnits(ArtifactWriter *w, Compiler *cc) {
+    for (int u = 0; u < cc->unitCount; u++) {
+        Compiler *unit = &cc->units[u];
+        UnitRecord record = {w->counts[SECTION_QUADS], unit->codeIndex, unit->tempCount, unit->labelCount};
+        outWrite(&w->sections[SECTION_UNITS], (const char*)&record, sizeof(record));
+        for (int i = 0; i < unit->codeIndex; i++) {
+            Quadruple *q = &unit->code[i];
+            QuadRecord quad = {intern(w, q->result), intern(w, q->arg1), intern(w, q->op), intern(w, q->arg2)};
+            outWrite(&w->sections[SECTION_QUADS], (const char*)&quad, sizeof(quad));
+        }
+        w->counts[SECTION_QUADS] += unit->codeIndex;
+    }
+    w->counts[SECTION_UNITS] = cc->unitCount;
+}
+
+// Called as each stage is completed or loaded. With -save-artifact the
+// stage's output joins the artifact; returns 1 when -stop-after ends the
+// compilation here.
+int endStage(Compiler *cc, Stage stage) {
+    const CompileOptions *options = cc->options;
+    if (options->artifactPath) {
+        phaseBegin(&cc->stats, PHASE_SAVE);
+        if (!cc->artifact) cc->artifact = (ArtifactWriter*)xcalloc(1, sizeof(ArtifactWriter));
+        ArtifactWriter *w = cc->artifact;
+        if (stage == STAGE_LEX) saveTokens(w, cc);
+        else if (stage == STAGE_PARSE) saveNodes(w, cc->ast);
+        else if (stage == STAGE_OPTIMIZE) saveUnits(w, cc);
+        w->stage = stage;
+        phaseEnd(&cc->stats, PHASE_SAVE);
+    }
+    return options->stopAfter == (int)stage;
+}
+
+static size_t aligned(size_t length) {
+    return (length + ARTIFACT_ALIGN - 1) / ARTIFACT_ALIGN * ARTIFACT_ALIGN;
+}
+
+static int writeAligned(FILE *file, const void *data, size_t length) {
+    static const char padding[ARTIFACT_ALIGN];
+    size_t pad = aligned(length) - length;
+    if (length && fwrite(data, 1, length, file) != length) return 0;
+    return !pad || fwrite(padding, 1, pad, file) == pad;
+}
+
+// Written to a private name and renamed into place, so a job reading the
+// artifact never sees it half written
+void writeArtifact(Compiler *cc) {
+    ArtifactWriter *w = cc->artifact;
+    const char *path = cc->options->artifactPath;
+    char temp[MAX_ARTIFACT_PATH];
+    if (!w) return;
+    phaseBegin(&cc->stats, PHASE_SAVE);
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+
+    ArtifactHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ARTIFACT_MAGIC;
+    header.version = ARTIFACT_VERSION;
+    header.stage = w->stage;
+    w->counts[SECTION_STRINGS] = (int)w->sections[SECTION_STRINGS].length;
+    size_t offset = aligned(sizeof(header));
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        header.sections[s].offset = (long)offset;
+        header.sections[s].size = (long)w->sections[s].length;
+        header.sections[s].count = w->counts[s];
+        offset += aligned(w->sections[s].length);
+    }
+
+    FILE *file = fopen(temp, "wb");
+    int ok = file && writeAligned(file, &header, sizeof(header));
+    for (int s = 0; s < SECTION_COUNT && ok; s++) {
+        ok = writeAligned(file, w->sections[s].data, w->sections[s].length);
+    }
+    if (file) ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        compileError(cc, "Cannot write artifact %s", path);
+    }
+    phaseEnd(&cc->stats, PHASE_SAVE);
+}
+
+void freeArtifactWriter(Compiler *cc) {
+    ArtifactWriter *w = cc->artifact;
+    if (!w) return;
+    for (int s = 0; s < SECTION_COUNT; s++) closeOutput(&w->sections[s]);
+    free(w->stringSlots);
+    free(w);
+    cc->artifact = NULL;
+}
+
+// Once every string in the table is known to be short enough, any
+// offset inside it reads as a string that fits a lexeme or a quad field
+static int validStrings(const char *table, long size) {
+    if (size && table[size - 1] != '\0') return 0;
+    for (long start = 0; start < size; ) {
+        long length = (long)strlen(table + start);
+        if (length >= MAX_LEN) return 0;
+        start += length + 1;
+    }
+    return 1;
+}
+
+// Every offset, index and string in the file, checked before anything is
+// built from it; NULL when the artifact is sound
+static const char* checkArtifact(const char *data, size_t length) {
+    static const size_t recordSizes[SECTION_COUNT] = {
+        1, sizeof(TokenRecord), sizeof(NodeRecord), sizeof(UnitRecord), sizeof(QuadRecord)
+    };
+    ArtifactHeader header;
+    if (length < sizeof(header)) return "not an artifact";
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != ARTIFACT_MAGIC) return "not an artifact";
+    if (header.version != ARTIFACT_VERSION) return "written by a different compiler version";
+    if (header.stage < STAGE_LEX || header.stage > STAGE_OPTIMIZE) return "unknown stage";
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        const ArtifactSection *section = &header.sections[s];
+        if (section->offset < (long)sizeof(header) || section->offset % ARTIFACT_ALIGN || section->size < 0 ||
+            section->count < 0 || section->size > (long)length - section->offset ||
+            (size_t)section->size != section->count * recordSizes[s]) {
+            return "section out of bounds";
+        }
+    }
+
+    long strings = header.sections[SECTION_STRINGS].size;
+    if (!validStrings(data + header.sections[SECTION_STRINGS].offset, strings)) return "bad string table";
+
+    const TokenRecord *tokens = (const TokenRecord*)(data + header.sections[SECTION_TOKENS].offset);
+    for (int i = 0; i < header.sections[SECTION_TOKENS].count; i++) {
+        if (tokens[i].type < 0 || tokens[i].type > TOKEN_DIRECTIVE_END || tokens[i].lexeme >= strings) {
+            return "bad token";
+        }
+    }
+
+    int nodeCount = header.sections[SECTION_NODES].count;
+    const NodeRecord *nodes = (const NodeRecord*)(data + header.sections[SECTION_NODES].offset);
+    char *referenced = (char*)xcalloc(nodeCount ? nodeCount : 1, 1);
+    const char *error = NULL;
+    for (int i = 0; i < nodeCount && !error; i++) {
+        int links[4] = {nodes[i].body, nodes[i].elseBody, nodes[i].condition, nodes[i].next};
+        if (nodes[i].type < AST_FUNCTION || nodes[i].type > AST_DECLARE ||
+            (nodes[i].dataType != TYPE_INT && nodes[i].dataType != TYPE_FLOAT) ||
+            nodes[i].name >= strings) {
+            error = "bad AST node";
+        }
+        for (int k = 0; k < 4 && !error; k++) {
+            if (links[k] == -1) continue;
+            if (links[k] <= i || links[k] >= nodeCount || referenced[links[k]]++) error = "AST is not a tree";
+        }
+    }
+    free(referenced);
+    if (error) return error;
+
+    const UnitRecord *units = (const UnitRecord*)(data + header.sections[SECTION_UNITS].offset);
+    const QuadRecord *quads = (const QuadRecord*)(data + header.sections[SECTION_QUADS].offset);
+    int quadCount = header.sections[SECTION_QUADS].count;
+    for (int u = 0; u < header.sections[SECTION_UNITS].count; u++) {
+        if (units[u].firstQuad < 0 || units[u].quadCount < 0 || units[u].quadCount > quadCount - units[u].firstQuad ||
+            units[u].tempCount < 0 || units[u].labelCount < 0) {
+            return "bad function";
+        }
+    }
+    for (int i = 0; i < quadCount; i++) {
+        if (quads[i].result >= strings || quads[i].arg1 >= strings || quads[i].op >= strings || quads[i].arg2 >= strings) {
+            return "bad instruction";
+        }
+    }
+    return NULL;
+}
+
+// Strings were checked to fit, so only their own bytes are copied
+static void copyString(char *dest, const char *src) {
+    memcpy(dest, src, strlen(src) + 1);
+}
+
+static void loadTokens(Compiler *cc, const char *data, const ArtifactHeader *header, const char *table) {
+    const TokenRecord *tokens = (const TokenRecord*)(data + header->sections[SECTION_TOKENS].offset);
+    int count = header->sections[SECTION_TOKENS].count;
+    cc->tokenCapacity = count ? count : 1;
+    cc->tokenTable = (Token*)xmalloc(sizeof(Token) * cc->tokenCapacity);
+    for (int i = 0; i < count; i++) {
+        cc->tokenTable[i].type = tokens[i].type;
+        copyString(cc->tokenTable[i].lexeme, table + tokens[i].lexeme);
+        cc->tokenTable[i].line = tokens[i].line;
+    }
+    cc->tokenCount = count;
+}
+
+// Every node is allocated as the parser would, so later passes can free
+// or replace any of them
+static void loadNodes(Compiler *cc, const char *data, const ArtifactHeader *header, const char *table) {
+    const NodeRecord *records = (const NodeRecord*)(data + header->sections[SECTION_NODES].offset);
+    int count = header->sections[SECTION_NODES].count;
+    ASTNode **nodes = (ASTNode**)xmalloc(sizeof(ASTNode*) * (count ? count : 1));
+    for (int i = 0; i < count; i++) {
+        nodes[i] = createNode(cc, (ASTNodeType)records[i].type);
+        copyString(nodes[i]->name, table + records[i].name);
+        nodes[i]->dataType = (DataType)records[i].dataType;
+        nodes[i]->arraySize = records[i].arraySize;
+    }
+    for (int i = 0; i < count; i++) {
+        if (records[i].body >= 0) nodes[i]->body = nodes[records[i].body];
+        if (records[i].elseBody >= 0) nodes[i]->elseBody = nodes[records[i].elseBody];
+        if (records[i].condition >= 0) nodes[i]->condition = nodes[records[i].condition];
+        if (records[i].next >= 0) nodes[i]->next = nodes[records[i].next];
+    }
+    cc->ast = count ? nodes[0] : NULL;
+    free(nodes);
+}
+
+// One unit per saved function, holding its optimized TAC
+static void loadUnits(Compiler *cc, const char *data, const ArtifactHeader *header, const char *table) {
+    const UnitRecord *units = (const UnitRecord*)(data + header->sections[SECTION_UNITS].offset);
+    const QuadRecord *quads = (const QuadRecord*)(data + header->sections[SECTION_QUADS].offset);
+    int count = header->sections[SECTION_UNITS].count;
+    cc->units = (Compiler*)xcalloc(count ? count : 1, sizeof(Compiler));
+    for (int u = 0; u < count; u++) {
+        Compiler *unit = &cc->units[u];
+        initUnit(unit, cc, u, NULL);
+        unit->codeCapacity = units[u].quadCount ? units[u].quadCount : 1;
+        unit->code = (Quadruple*)xmalloc(sizeof(Quadruple) * unit->codeCapacity);
+        for (int i = 0; i < units[u].quadCount; i++) {
+            const QuadRecord *q = &quads[units[u].firstQuad + i];
+            copyString(unit->code[i].result, table + q->result);
+            copyString(unit->code[i].arg1, table + q->arg1);
+            copyString(unit->code[i].op, table + q->op);
+            copyString(unit->code[i].arg2, table + q->arg2);
+        }
+        unit->codeIndex = units[u].quadCount;
+        unit->tempCount = units[u].tempCount;
+        unit->labelCount = units[u].labelCount;
+    }
+    cc->unitCount = count;
+}
+
+// Maps the artifact named by -resume and builds what its last stage
+// produced: the token table, the AST or the units. Returns that stage.
+Stage loadArtifact(Compiler *cc) {
+    const char *path = cc->options->resumePath;
+    SourceText text;
+    if (!loadSource(path, &text)) compileError(cc, "Cannot open artifact");
+    const char *error = checkArtifact(text.data, text.length);
+    if (error) {
+        unloadSource(&text);
+        compileError(cc, "Cannot load artifact: %s", error);
+    }
+
+    ArtifactHeader header;
+    memcpy(&header, text.data, sizeof(header));
+    const char *table = text.data + header.sections[SECTION_STRINGS].offset;
+    Stage stage = (Stage)header.stage;
+    if (stage == STAGE_LEX) loadTokens(cc, text.data, &header, table);
+    else if (stage == STAGE_PARSE) loadNodes(cc, text.data, &header, table);
+    else loadUnits(cc, text.data, &header, table);
+    unloadSource(&text);
+    return stage;
+}
@@ -0,0 +1,101 @@
+#ifndef ARTIFACT_H
+#define ARTIFACT_H
+
+#include "lexer.h"
+#include "output.h"
+
+// Bump whenever a record changes shape or meaning
+#define ARTIFACT_VERSION 2
+#define ARTIFACT_MAGIC 0x54524154   // "TART"
+#define ARTIFACT_ALIGN 8
+
+// Where a compilation can stop, and resume later from the artifact it
+// saved there; -stop-after names them
+typedef enum {
+    STAGE_NONE,
+    STAGE_LEX,          // the token table
+    STAGE_PARSE,        // the AST as parsed, before semantic analysis
+    STAGE_OPTIMIZE      // the optimized TAC of every function
+} Stage;
+
+// An artifact holds the result of every stage a compilation ran, each in
+// a section of fixed-size records. Strings are offsets into one table
+// and nodes are indices, so the file can be mapped anywhere and read in
+// place: loading is a copy into the compiler's structures, with no
+// lexing or parsing.
+typedef enum {
+    SECTION_STRINGS,    // NUL-terminated, each stored once
+    SECTION_TOKENS,     // TokenRecord
+    SECTION_NODES,      // NodeRecord, in preorder
+    SECTION_UNITS,      // UnitRecord, one per function
+    SECTION_QUADS,      // QuadRecord, every unit's in unit order
+    SECTION_COUNT
+} ArtifactSectionKind;
+
+typedef struct {
+    long offset;        // from the start of the file
+    long size;          // bytes
+    int count;          // records; bytes for the string table
+    int reserved;
+} ArtifactSection;
+
+typedef struct {
+    unsigned magic;
+    unsigned version;
+    int stage;          // the last stage saved
+    int reserved;
+    ArtifactSection sections[SECTION_COUNT];
+} ArtifactHeader;
+
+typedef struct {
+    int type;
+    unsigned lexeme;
+    int line;
+} TokenRecord;
+
+// Children and next are node indices, -1 for none. Always later than the
+// node itself, which is how a loader knows the tree has no cycles.
+typedef struct {
+    int type;
+    unsigned name;
+    int body;
+    int elseBody;
+    int condition;
+    int next;
+    int dataType;
+    int arraySize;
+} NodeRecord;
+
+typedef struct {
+    int firstQuad;
+    int quadCount;
+    int tempCount;
+    int labelCount;
+} UnitRecord;
+
+typedef struct {
+    unsigned result;
+    unsigned arg1;
+    unsigned op;
+    unsigned arg2;
+} QuadRecord;
+
+// Sections being collected while the compilation runs
+typedef struct {
+    Output sections[SECTION_COUNT];
+    int counts[SECTION_COUNT];
+    unsigned *stringSlots;      // string offset + 1 by hash; 0 is empty
+    unsigned slotCount;
+    unsigned stringCount;
+    Stage stage;
+} ArtifactWriter;
+
+const char* stageName(Stage stage);
+Stage parseStage(const char *name);
+
+int endStage(Compiler *cc, Stage stage);
+void writeArtifact(Compiler *cc);
+void freeArtifactWriter(Compiler *cc);
+Stage loadArtifact(Compiler *cc);
+
+#endif
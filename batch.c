@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "batch.h"
+#include "pool.h"
+
+typedef struct {
+    Compiler cc;
+    int ok;
+} BatchUnit;
+
+typedef struct {
+    const CompileOptions *options;
+    const char **sources;
+    BatchUnit *units;
+} Batch;
+
+int batchAsmPath(char *path, size_t size, const char *asmDir, const char *source) {
+    const char *name = strrchr(source, '/');
+    name = name ? name + 1 : source;
+    const char *dot = strrchr(name, '.');
+    int length = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+    int n = asmDir ? snprintf(path, size, "%s/%.*s.s", asmDir, length, name)
+                   : snprintf(path, size, "%.*s.s", length, name);
+    return n >= 0 && (size_t)n < size;
+}
+
+// Units write into memory; the caller's thread copies them out in order
+static void openUnit(BatchUnit *u, const CompileOptions *options, const char *source) {
+    initCompiler(&u->cc, options, source);
+    openMemoryOutput(&u->cc.dumpOutput);
+    openMemoryOutput(&u->cc.diagnostics);
+    openMemoryOutput(&u->cc.asmFile);
+    u->cc.asmOutput = &u->cc.asmFile;
+}
+
+static void compileUnit(void *context, int index) {
+    Batch *b = (Batch*)context;
+    BatchUnit *u = &b->units[index];
+    openUnit(u, b->options, b->sources[index]);
+    u->ok = compile(&u->cc);
+}
+
+// A unit that failed writes no assembly, as a failed gcc -S leaves none
+static void writeUnit(BatchUnit *u, Output *dumpOut, const char *asmDir) {
+    Compiler *cc = &u->cc;
+    outWrite(dumpOut, cc->dumpOutput.data, cc->dumpOutput.length);
+    if (cc->diagnostics.length) {
+        flushOutput(dumpOut);
+        fwrite(cc->diagnostics.data, 1, cc->diagnostics.length, stderr);
+    }
+    if (!u->ok) return;
+
+    char path[PATH_MAX];
+    Output asmOut;
+    if (!batchAsmPath(path, sizeof(path), asmDir, cc->source) || !openOutput(&asmOut, path)) {
+        fprintf(stderr, "Cannot open output file %s\n", path);
+        u->ok = 0;
+        return;
+    }
+    outWrite(&asmOut, cc->asmOutput->data, cc->asmOutput->length);
+    if (!closeOutput(&asmOut)) {
+        fprintf(stderr, "Error: Could not write all of the output to %s\n", path);
+        u->ok = 0;
+    }
+}
+
+int compileBatch(const CompileOptions *options, const char **sources, int count, int jobs,
+                 Output *dumpOut, const char *asmDir, CompileStats *total) {
+    Batch batch;
+    batch.options = options;
+    batch.sources = sources;
+    batch.units = (BatchUnit*)xcalloc(count, sizeof(BatchUnit));
+
+    Pool pool;
+    startPool(&pool, count, jobs, compileUnit, &batch);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        BatchUnit *u = &batch.units[i];
+        waitPoolItem(&pool, i);
+        writeUnit(u, dumpOut, asmDir);
+        mergeStats(total, &u->cc.stats);
+        if (!u->ok) failed++;
+        freeCompiler(&u->cc);
+    }
+
+    finishPool(&pool);
+    free(batch.units);
+    return failed;
+}
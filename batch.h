@@ -0,0 +1,19 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "compiler.h"
+
+// Where a batch writes the assembly of source: <name>.s in asmDir, or in
+// the working directory when asmDir is NULL, as with gcc -S. Returns 0
+// if the path does not fit in size.
+int batchAsmPath(char *path, size_t size, const char *asmDir, const char *source);
+
+// Compiles every source on a pool of jobs worker threads. Each unit's
+// listings are written to dumpOut in source order and its assembly to
+// its own file at batchAsmPath, so every file keeps its own labels; its
+// diagnostics go to stderr and its statistics are merged into total.
+// Returns the number of units that failed, a failed write included.
+int compileBatch(const CompileOptions *options, const char **sources, int count, int jobs,
+                 Output *dumpOut, const char *asmDir, CompileStats *total);
+
+#endif
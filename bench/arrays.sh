@@ -0,0 +1,58 @@
+#!/bin/bash
+# Checks the loop vectorizer on generated array programs: each one is run
+# by the TAC interpreter at -O2 with and without the vectorize pass, and
+# at -O0; the return values must agree. Reports the instructions executed
+# either way.
+#
+# Usage: bench/arrays.sh
+#   SEEDS="1 2 3"   programs to generate (default 1 .. 20)
+#   LOOPS=12        array loops per program
+
+cd "$(dirname "$0")/.." || exit 1
+
+SEEDS=${SEEDS:-$(seq 1 20)}
+LOOPS=${LOOPS:-12}
+CORPUS=bench/corpus
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+mkdir -p "$CORPUS"
+
+# "main returned R after N instructions (V vector)" from a -run
+runProgram() {
+    ./main -run "$@" -o /dev/null 2>&1 | grep "main returned" | sed 's/.*main returned //'
+}
+
+printf "%-6s %-13s %-12s %-12s %-10s %s\n" "Seed" "Returned" "Scalar" "Vectorized" "Vector" "Speedup"
+echo "--------------------------------------------------------------------"
+
+failed=0
+scalarTotal=0
+vectorTotal=0
+for seed in $SEEDS; do
+    src=$CORPUS/arrays_$seed.c
+    [ -f "$src" ] || bench/gen -arrays "$LOOPS" -seed "$seed" > "$src"
+
+    vectorized=$(runProgram -O2 "$src")
+    scalar=$(runProgram -O2 -fno-pass=vectorize "$src")
+    unoptimized=$(runProgram -O0 "$src")
+    returned=${vectorized%% *}
+    if [ -z "$vectorized" ] || [ "$returned" != "${scalar%% *}" ] || [ "$returned" != "${unoptimized%% *}" ]; then
+        printf "%-6s MISMATCH: %s / %s / %s\n" "$seed" "$vectorized" "$scalar" "$unoptimized"
+        failed=1
+        continue
+    fi
+
+    read -r _ _ vectorCount _ vectorOps _ <<< "$vectorized"
+    read -r _ _ scalarCount _ <<< "$scalar"
+    vectorOps=${vectorOps#(}
+    scalarTotal=$((scalarTotal + scalarCount))
+    vectorTotal=$((vectorTotal + vectorCount))
+    printf "%-6s %-13s %-12s %-12s %-10s %s\n" "$seed" "$returned" "$scalarCount" "$vectorCount" "$vectorOps" \
+        "$(awk -v s="$scalarCount" -v v="$vectorCount" 'BEGIN { printf "%.2fx", s / v }')"
+done
+
+echo "--------------------------------------------------------------------"
+awk -v s="$scalarTotal" -v v="$vectorTotal" \
+    'BEGIN { if (v > 0) printf "%-6s %-13s %-12d %-12d %-10s %.2fx\n", "total", "", s, v, "", s / v }'
+exit $failed
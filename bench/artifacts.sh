@@ -0,0 +1,48 @@
+#!/bin/bash
+# Time to reach each stage from source against the time to load the
+# artifact saved there, over generated inputs. Resuming from every
+# artifact must give the same assembly as compiling the source.
+#
+# Usage: bench/artifacts.sh
+#   SIZES="10K 1M"    corpus sizes to run (default 100K 1M 10M)
+#   OPT=-O2           optimization level passed to the compiler
+
+cd "$(dirname "$0")/.." || exit 1
+
+SIZES=${SIZES:-"100K 1M 10M"}
+OPT=${OPT:--O2}
+CORPUS=bench/corpus
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+mkdir -p "$CORPUS"
+
+# Wall milliseconds of one -ftime-report row
+phaseMs() {
+    awk -v phase="$1" '$1 == phase { print $2 }'
+}
+
+printf "%-6s %-9s %12s %12s %10s %9s\n" "Size" "Stage" "Compile(ms)" "Load(ms)" "Artifact" "Speedup"
+echo "-------------------------------------------------------------"
+
+failed=0
+for size in $SIZES; do
+    src=$CORPUS/gen_$size.c
+    [ -f "$src" ] || bench/gen -size "$size" -seed 1 > "$src"
+    ./main $OPT "$src" -o "$CORPUS/artifact_ref.s" || exit 1
+
+    for stage in lex parse optimize; do
+        artifact=$CORPUS/gen_$size.$stage.art
+        report=$(./main $OPT -stop-after=$stage -save-artifact="$artifact" "$src" -ftime-report 2>&1 > /dev/null)
+        compileMs=$(awk '$1 == "total" { total = $2 } $1 == "save" { save = $2 } END { print total - save }' <<< "$report")
+        report=$(./main $OPT -resume="$artifact" -o "$CORPUS/artifact_out.s" -ftime-report 2>&1 > /dev/null)
+        loadMs=$(phaseMs load <<< "$report")
+        if ! cmp -s "$CORPUS/artifact_ref.s" "$CORPUS/artifact_out.s"; then
+            echo "$size $stage: resumed assembly differs"
+            failed=1
+        fi
+        printf "%-6s %-9s %12.1f %12.1f %9dK %8.1fx\n" "$size" "$stage" "$compileMs" "$loadMs" \
+            $(( $(stat -c %s "$artifact") / 1024 )) "$(awk -v c="$compileMs" -v l="$loadMs" 'BEGIN { print c / l }')"
+    done
+done
+exit $failed
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Checks the emitted assembly rather than the TAC: bench/asmrun executes
+# the listing each program compiles to, and main must return what the TAC
+# interpreter returns for the same program. Covers bench/calls.c, whose
+# calls pass arguments that do not commute, bench/frames.c, which declares
+# an array in a loop, test.c and the generated array programs, at each
+# optimization level.
+#
+# Usage: bench/asm.sh
+#   SEEDS="1 2 3"   array programs to generate (default 1 .. 5)
+#   LOOPS=12        array loops per program
+
+cd "$(dirname "$0")/.." || exit 1
+
+SEEDS=${SEEDS:-$(seq 1 5)}
+LOOPS=${LOOPS:-12}
+CORPUS=bench/corpus
+LISTING=$CORPUS/asm.s
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+gcc -O2 -Wall -Wextra bench/asmrun.c -o bench/asmrun || exit 1
+mkdir -p "$CORPUS"
+
+sources=(bench/calls.c bench/frames.c test.c)
+for seed in $SEEDS; do
+    src=$CORPUS/arrays_$seed.c
+    [ -f "$src" ] || bench/gen -arrays "$LOOPS" -seed "$seed" > "$src"
+    sources+=("$src")
+done
+
+printf "%-28s %-22s %-13s %-13s\n" "Program" "Options" "Interpreted" "Assembled"
+echo "--------------------------------------------------------------------------"
+
+failed=0
+for src in "${sources[@]}"; do
+    for options in -O0 -O1 -O2 "-O2 -fno-pass=inline"; do
+        # shellcheck disable=SC2086
+        interpreted=$(./main -run $options "$src" -o "$LISTING" 2>&1 | grep "main returned" | sed 's/.*main returned //')
+        assembled=$(bench/asmrun "$LISTING" 2>&1 | sed 's/main returned //')
+        interpreted=${interpreted%% *}
+        printf "%-28s %-22s %-13s %-13s\n" "$src" "$options" "$interpreted" "${assembled%% *}"
+        if [ -z "$interpreted" ] || [ "$interpreted" != "${assembled%% *}" ]; then
+            echo "MISMATCH: $assembled"
+            failed=1
+        fi
+    done
+done
+exit $failed
@@ -0,0 +1,295 @@
+// Runs the assembly the compiler writes with -o, on a machine with an
+// accumulator, a vector accumulator of VECTOR_WIDTH words, BP, SP and a
+// byte-addressed memory of words. Execution starts with a CALL main and
+// ends when main returns; the accumulator is its return value.
+//
+// A CALL to a label the listing does not define (printf) returns 0 without
+// doing anything, and a pushed string pushes 0: only the values the program
+// computes are checked, not what it prints.
+//
+// Usage: asmrun FILE.s
+//
+// Prints "main returned R after N instructions", as -run does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../codegen.h"
+
+#define MAX_LINES 200000
+#define MEMORY_BYTES (1 << 24)
+#define STEP_LIMIT 200000000L
+
+typedef union {
+    int i;
+    float f;
+} Word;
+
+static char *lines[MAX_LINES];
+static int lineCount = 0;
+static Word memory[MEMORY_BYTES / WORD_SIZE];
+static int bp, sp;
+static int pc;
+
+static void fail(const char *message, const char *text) {
+    fprintf(stderr, "asmrun: line %d: %s: %s\n", pc + 1, message, text);
+    exit(1);
+}
+
+static Word *word(int address) {
+    if (address < 0 || address % WORD_SIZE || address >= MEMORY_BYTES) {
+        char text[32];
+        sprintf(text, "%d", address);
+        fail("bad address", text);
+    }
+    return &memory[address / WORD_SIZE];
+}
+
+static int findLabel(const char *name) {
+    size_t length = strlen(name);
+    for (int i = 0; i < lineCount; i++) {
+        if (strncmp(lines[i], name, length) == 0 && lines[i][length] == ':' && !lines[i][length + 1]) return i;
+    }
+    return -1;
+}
+
+// address := term (('+'|'-') term)*, term := primary ('*' number)?,
+// primary := BP | SP | number | '[' address ']'
+static int parseSum(const char **s);
+
+static int parsePrimary(const char **s) {
+    if (**s == '[') {
+        (*s)++;
+        int address = parseSum(s);
+        if (**s != ']') fail("expected ]", *s);
+        (*s)++;
+        return word(address)->i;
+    }
+    if (strncmp(*s, "BP", 2) == 0) {
+        *s += 2;
+        return bp;
+    }
+    if (strncmp(*s, "SP", 2) == 0) {
+        *s += 2;
+        return sp;
+    }
+    if (!isdigit((unsigned char)**s)) fail("bad operand", *s);
+    return (int)strtol(*s, (char **)s, 10);
+}
+
+static int parseTerm(const char **s) {
+    int value = parsePrimary(s);
+    if (**s == '*') {
+        (*s)++;
+        value = (int)((unsigned)value * (unsigned)parsePrimary(s));
+    }
+    return value;
+}
+
+static int parseSum(const char **s) {
+    int value = parseTerm(s);
+    while (**s == '+' || **s == '-') {
+        char sign = *(*s)++;
+        unsigned term = (unsigned)parseTerm(s);
+        value = (int)(sign == '+' ? (unsigned)value + term : (unsigned)value - term);
+    }
+    return value;
+}
+
+// The byte address of a memory operand "[...]"
+static int address(const char *operand) {
+    if (operand[0] != '[') fail("expected a memory operand", operand);
+    const char *s = operand + 1;
+    int result = parseSum(&s);
+    if (strcmp(s, "]") != 0) fail("bad memory operand", operand);
+    return result;
+}
+
+static Word operandValue(const char *operand) {
+    Word w;
+    if (operand[0] == '[') return *word(address(operand));
+    if (operand[0] == '"') {
+        w.i = 0;
+    } else if (strcmp(operand, "BP") == 0) {
+        w.i = bp;
+    } else if (strcmp(operand, "SP") == 0) {
+        w.i = sp;
+    } else if (strchr(operand, '.')) {
+        w.f = strtof(operand, NULL);
+    } else {
+        char *end;
+        w.i = (int)strtol(operand, &end, 10);
+        if (*end) fail("bad operand", operand);
+    }
+    return w;
+}
+
+static void push(Word w) {
+    sp -= WORD_SIZE;
+    *word(sp) = w;
+}
+
+static Word pop(void) {
+    Word w = *word(sp);
+    sp += WORD_SIZE;
+    return w;
+}
+
+// Wraps like the machine: the interpreter's rules for /, << and >>
+static int intOp(const char *op, int a, int b) {
+    unsigned ua = (unsigned)a, ub = (unsigned)b;
+    if (strcmp(op, "ADD") == 0) return (int)(ua + ub);
+    if (strcmp(op, "SUB") == 0) return (int)(ua - ub);
+    if (strcmp(op, "MUL") == 0) return (int)(ua * ub);
+    if (strcmp(op, "DIV") == 0) {
+        if (b == 0) fail("division by zero", op);
+        return b == -1 ? (int)(0u - ua) : a / b;
+    }
+    if (strcmp(op, "SHL") == 0) return (int)(ua << (b & 31));
+    if (strcmp(op, "SAR") == 0) return a >> (b & 31);
+    if (strcmp(op, "AND") == 0) return a & b;
+    if (strcmp(op, "CMPEQ") == 0) return a == b;
+    if (strcmp(op, "CMPNE") == 0) return a != b;
+    if (strcmp(op, "CMPLT") == 0) return a < b;
+    if (strcmp(op, "CMPGT") == 0) return a > b;
+    if (strcmp(op, "CMPLE") == 0) return a <= b;
+    if (strcmp(op, "CMPGE") == 0) return a >= b;
+    fail("unknown instruction", op);
+    return 0;
+}
+
+static Word floatOp(const char *op, float a, float b) {
+    Word w;
+    if (strcmp(op, "FADD") == 0) w.f = a + b;
+    else if (strcmp(op, "FSUB") == 0) w.f = a - b;
+    else if (strcmp(op, "FMUL") == 0) w.f = a * b;
+    else if (strcmp(op, "FDIV") == 0) w.f = a / b;
+    else if (strcmp(op, "FCMPEQ") == 0) w.i = a == b;
+    else if (strcmp(op, "FCMPNE") == 0) w.i = a != b;
+    else if (strcmp(op, "FCMPLT") == 0) w.i = a < b;
+    else if (strcmp(op, "FCMPGT") == 0) w.i = a > b;
+    else if (strcmp(op, "FCMPLE") == 0) w.i = a <= b;
+    else if (strcmp(op, "FCMPGE") == 0) w.i = a >= b;
+    else fail("unknown instruction", op);
+    return w;
+}
+
+static void loadLines(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    char buffer[1024];
+    while (fgets(buffer, sizeof buffer, file)) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (!buffer[0]) continue;
+        if (lineCount == MAX_LINES) fail("listing too long", path);
+        lines[lineCount++] = strdup(buffer);
+    }
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s FILE.s\n", argv[0]);
+        return 1;
+    }
+    loadLines(argv[1]);
+
+    Word acc = {0};
+    Word vacc[VECTOR_WIDTH] = {{0}};
+    sp = bp = MEMORY_BYTES;
+    push((Word){.i = -1});  // main's return address
+    pc = findLabel("main");
+    if (pc < 0) fail("no main", argv[1]);
+
+    long steps = 0;
+    for (;;) {
+        if (pc < 0 || pc >= lineCount) fail("ran off the listing", argv[1]);
+        char line[1024], op[32] = "", first[512] = "", second[512] = "";
+        strcpy(line, lines[pc]);
+        if (!strchr(line, ' ') && line[strlen(line) - 1] == ':') {
+            pc++;
+            continue;
+        }
+        if (++steps > STEP_LIMIT) fail("step limit reached", line);
+
+        char *rest = line;
+        size_t length = strcspn(rest, " ");
+        memcpy(op, rest, length < sizeof op ? length : sizeof op - 1);
+        rest += length;
+        while (*rest == ' ') rest++;
+        char *comma = rest[0] == '"' ? NULL : strstr(rest, ", ");
+        if (comma) {
+            *comma = '\0';
+            strcpy(second, comma + 2);
+        }
+        strcpy(first, rest);
+        pc++;
+
+        if (strcmp(op, "PUSH") == 0) push(operandValue(first));
+        else if (strcmp(op, "POP") == 0) {
+            if (strcmp(first, "BP") != 0) fail("can only pop BP", line);
+            bp = pop().i;
+        }
+        else if (strcmp(op, "MOV") == 0) {
+            Word w = operandValue(second);
+            if (strcmp(first, "BP") == 0) bp = w.i;
+            else if (strcmp(first, "SP") == 0) sp = w.i;
+            else *word(address(first)) = w;
+        }
+        else if ((strcmp(op, "SUB") == 0 || strcmp(op, "ADD") == 0) && strcmp(first, "SP") == 0) {
+            int n = operandValue(second).i;
+            sp += strcmp(op, "SUB") == 0 ? -n : n;
+        }
+        else if (strcmp(op, "LOAD") == 0) acc = operandValue(first);
+        else if (strcmp(op, "STORE") == 0) *word(address(first)) = acc;
+        else if (strcmp(op, "JZ") == 0 || strcmp(op, "JMP") == 0) {
+            if (op[1] == 'M' || acc.i == 0) {
+                pc = findLabel(first);
+                if (pc < 0) fail("no such label", first);
+            }
+        }
+        else if (strcmp(op, "CALL") == 0) {
+            int target = findLabel(first);
+            if (target < 0) {
+                acc.i = 0;
+            } else {
+                push((Word){.i = pc});
+                pc = target;
+            }
+        }
+        else if (strcmp(op, "RET") == 0) {
+            pc = pop().i;
+            if (pc == -1) break;
+        }
+        else if (strcmp(op, "ITOF") == 0) acc.f = (float)acc.i;
+        else if (strcmp(op, "FTOI") == 0) acc.i = (int)acc.f;
+        else if (strcmp(op, "VLOAD") == 0 || strcmp(op, "VSTORE") == 0) {
+            Word *at = word(address(first));
+            word(address(first) + (VECTOR_WIDTH - 1) * WORD_SIZE);
+            if (op[1] == 'L') memcpy(vacc, at, sizeof vacc);
+            else memcpy(at, vacc, sizeof vacc);
+        }
+        else if (strcmp(op, "VSPLAT") == 0 || strcmp(op, "VSTEP") == 0) {
+            for (int k = 0; k < VECTOR_WIDTH; k++) {
+                vacc[k].i = strcmp(op, "VSPLAT") == 0 ? acc.i : (int)((unsigned)acc.i + k);
+            }
+        }
+        else if (op[0] == 'V') {
+            int at = address(first);
+            for (int k = 0; k < VECTOR_WIDTH; k++) {
+                Word b = *word(at + k * WORD_SIZE);
+                if (op[1] == 'F') vacc[k] = floatOp(op + 1, vacc[k].f, b.f);
+                else vacc[k].i = intOp(op + 1, vacc[k].i, b.i);
+            }
+        }
+        else if (op[0] == 'F') acc = floatOp(op, acc.f, operandValue(first).f);
+        else acc.i = intOp(op, acc.i, operandValue(first).i);
+    }
+
+    printf("main returned %d after %ld instructions\n", acc.i, steps);
+    return 0;
+}
@@ -0,0 +1,22 @@
+// Calls whose arguments do not commute, for bench/asm.sh: main returns
+// 43271 only when every callee sees its arguments in order.
+
+int weigh(int a, int b, int c, int d) {
+    return (a * 1000) + ((b * 100) + ((c * 10) + d));
+}
+
+int sub3(int a, int b, int c) {
+    return (a - b) - c;
+}
+
+int below(float a, float b) {
+    return a < b;
+}
+
+int main() {
+    int x = 7;
+    int r = weigh(4, 3, 2, 1) - weigh(1, 2, 3, 4);
+    r = r + weigh(sub3(x, 5, 1), x - 5, sub3(9, 4, 1), 0);
+    float q = 4.5;
+    return (r * 10) + ((below(q, 2.0) * 2) + below(2.0, q));
+}
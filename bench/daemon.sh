@@ -0,0 +1,56 @@
+#!/bin/bash
+# Per-request latency of the compile daemon against a cold ./main launch,
+# both compiling the same small generated file.
+#
+# Usage: bench/daemon.sh
+#   N=200      requests per mode
+#   SIZE=1K    corpus size passed to bench/gen
+
+cd "$(dirname "$0")/.." || exit 1
+
+N=${N:-200}
+SIZE=${SIZE:-1K}
+CORPUS=bench/corpus
+export COMPILER_SOCKET=${COMPILER_SOCKET:-/tmp/compiler-bench-$$.sock}
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+mkdir -p "$CORPUS"
+src=$CORPUS/gen_$SIZE.c
+[ -f "$src" ] || bench/gen -size "$SIZE" -seed 1 > "$src"
+
+./main -daemon 2> "$CORPUS/daemon.log" &
+daemon=$!
+trap 'kill $daemon 2> /dev/null' EXIT
+for i in $(seq 50); do [ -S "$COMPILER_SOCKET" ] && break; sleep 0.1; done
+
+if ! cmp -s <(./main "$src") <(./mainc "$src"); then
+    echo "Daemon output differs from ./main"
+    exit 1
+fi
+
+# A worker that crashes is replaced; the daemon keeps serving
+worker=$(pgrep -P $daemon)
+kill -SEGV $worker
+for i in $(seq 50); do [ -n "$(pgrep -P $daemon)" ] && break; sleep 0.1; done
+if ! cmp -s <(./main "$src") <(./mainc "$src"); then
+    echo "Daemon did not recover from a crashed worker"
+    exit 1
+fi
+
+# Mean wall time per run of the given command, in milliseconds
+perRun() {
+    local start end
+    start=$(date +%s%N)
+    for ((i = 0; i < N; i++)); do "$@" "$src" > /dev/null || exit 1; done
+    end=$(date +%s%N)
+    awk -v ns=$((end - start)) -v n="$N" 'BEGIN { printf "%.3f", ns / n / 1e6 }'
+}
+
+cold=$(perRun ./main)
+warm=$(perRun ./mainc)
+printf "%-22s %10s\n" "Mode" "ms/request"
+echo "---------------------------------"
+printf "%-22s %10s\n" "cold ./main" "$cold"
+printf "%-22s %10s\n" "daemon via ./mainc" "$warm"
+awk -v c="$cold" -v w="$warm" 'BEGIN { if (w > 0) printf "speedup                %9.2fx\n", c / w }'
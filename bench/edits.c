@@ -0,0 +1,181 @@
+// Replays keystrokes against an open Document, as an editor would send
+// them: a statement is typed one character at a time after a random ';'
+// and then erased again, the text in between rarely parsing. Reports the
+// mean and worst latency of an edit next to the cost of the full lex and
+// parse the document saves, then checks that the document still matches
+// a batch parse of the file.
+//
+// Usage: edits [-edits N] [-seed N] [-verify] FILE...
+//
+// -verify also compares the document with one opened from scratch on its
+// text after every edit, diagnostics included; slow on large files.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../document.h"
+
+#define STATEMENT " total = total + 1;"
+
+static int edits = 2000;
+static unsigned long seed = 1;
+static int verify = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* readFile(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    *length = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = (char*)xmalloc(*length + 1);
+    *length = fread(text, 1, *length, file);
+    text[*length] = '\0';
+    fclose(file);
+    return text;
+}
+
+// printAST of a chain, as text to compare
+static char* dumpAST(ASTNode *ast) {
+    Compiler cc;
+    CompileOptions options;
+    memset(&options, 0, sizeof(options));
+    initCompiler(&cc, &options, "");
+    printAST(&cc, ast, 0);
+    outWrite(&cc.dumpOutput, "", 1);
+    char *text = cc.dumpOutput.data;
+    cc.dumpOutput.data = NULL;
+    freeCompiler(&cc);
+    return text;
+}
+
+static char* dumpDiagnostics(Document *doc) {
+    Output out;
+    openMemoryOutput(&out);
+    documentDiagnostics(doc, &out);
+    outWrite(&out, "", 1);
+    return out.data;
+}
+
+// What the tooling did before: runLexer and parseProgram on the file
+static char* batchParse(const char *path, double *seconds) {
+    Compiler cc;
+    CompileOptions options;
+    memset(&options, 0, sizeof(options));
+    initCompiler(&cc, &options, path);
+    double start = now();
+    if (!setjmp(cc.onError)) {
+        runLexer(&cc);
+        parseProgram(&cc);
+        *seconds = now() - start;
+    }
+    char *dump = cc.failed ? NULL : dumpAST(cc.ast);
+    freeCompiler(&cc);
+    return dump;
+}
+
+// Same AST and diagnostics as a document opened on its text
+static int matchesFresh(Document *doc) {
+    char *text = documentText(doc);
+    Document *fresh = openDocument(doc->name, text, strlen(text));
+    char *a = dumpAST(documentAST(doc)), *b = dumpAST(documentAST(fresh));
+    char *da = dumpDiagnostics(doc), *db = dumpDiagnostics(fresh);
+    int same = strcmp(a, b) == 0 && strcmp(da, db) == 0;
+    free(a);
+    free(b);
+    free(da);
+    free(db);
+    free(text);
+    closeDocument(fresh);
+    return same;
+}
+
+static int replay(const char *path) {
+    size_t length;
+    char *text = readFile(path, &length);
+    if (!text) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 0;
+    }
+
+    double batchSeconds = 0;
+    char *batch = batchParse(path, &batchSeconds);
+    double start = now();
+    Document *doc = openDocument(path, text, length);
+    double openSeconds = now() - start;
+
+    double total = 0, worst = 0;
+    long tokens = 0, items = 0;
+    int done = 0, ok = 1;
+    size_t statement = strlen(STATEMENT);
+    srand((unsigned)seed);
+    while (done < edits && ok) {
+        // After a random ';', type the statement and erase it
+        char *at = strchr(text + (size_t)(((double)rand() / RAND_MAX) * (length - 1)), ';');
+        if (!at) continue;
+        size_t offset = (size_t)(at - text) + 1;
+        for (size_t i = 0; i < 2 * statement && done < edits && ok; i++, done++) {
+            start = now();
+            if (i < statement) editDocument(doc, offset + i, 0, STATEMENT + i, 1);
+            else editDocument(doc, offset + 2 * statement - i - 1, 1, "", 0);
+            double seconds = now() - start;
+            total += seconds;
+            if (seconds > worst) worst = seconds;
+            tokens += doc->lastEdit.tokensLexed;
+            items += doc->lastEdit.itemsParsed;
+            if (verify && !matchesFresh(doc)) {
+                fprintf(stderr, "%s: edit %d differs from a fresh parse\n", path, done);
+                ok = 0;
+            }
+        }
+        // Finish erasing after a stop in the middle
+        if (done == edits) {
+            char *current = documentText(doc);
+            size_t extra = strlen(current) - length;
+            editDocument(doc, offset, extra, "", 0);
+            free(current);
+        }
+    }
+
+    char *current = documentText(doc);
+    char *dump = dumpAST(documentAST(doc));
+    if (ok && (strcmp(current, text) != 0 || !batch || strcmp(dump, batch) != 0)) {
+        fprintf(stderr, "%s: document differs from a batch parse\n", path);
+        ok = 0;
+    }
+    printf("%-28s %10zu %10.2f %10.2f %10.1f %10.1f %8.1f %6.2f %s\n", path, length,
+           batchSeconds * 1e3, openSeconds * 1e3, total / done * 1e6, worst * 1e6,
+           (double)tokens / done, (double)items / done, ok ? "ok" : "FAILED");
+
+    free(current);
+    free(dump);
+    free(batch);
+    free(text);
+    closeDocument(doc);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int ok = 1, files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-edits") == 0 && i + 1 < argc) edits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-verify") == 0) verify = 1;
+        else argv[files++] = argv[i];
+    }
+    if (!files || edits <= 0) {
+        fprintf(stderr, "Usage: %s [-edits N] [-seed N] [-verify] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-28s %10s %10s %10s %10s %10s %8s %6s\n", "File", "Bytes", "Batch ms", "Open ms",
+           "Edit us", "Worst us", "Tokens", "Items");
+    for (int i = 0; i < files; i++) ok &= replay(argv[i]);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Per-keystroke latency of the incremental document API against a full
+# lex and parse, over generated files of growing size. The edit latency
+# should stay flat while the full parse grows with the file.
+#
+# Usage: bench/edits.sh
+#   SIZES="10K 1M"    corpus sizes to run (default 10K .. 10M)
+#   EDITS=2000        keystrokes per file
+#   VERIFY=1          compare with a fresh parse after every edit
+
+cd "$(dirname "$0")/.." || exit 1
+
+SIZES=${SIZES:-"10K 100K 1M 10M"}
+EDITS=${EDITS:-2000}
+CORPUS=bench/corpus
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+gcc -O2 -pthread bench/edits.c document.c lexer.c parser.c semantic.c codegen.c inline.c passes.c \
+    stats.c output.c compiler.c batch.c pool.c tokenring.c cache.c preprocess.c headers.c interp.c vectorize.c frame.c artifact.c \
+    -o bench/edits || exit 1
+mkdir -p "$CORPUS"
+
+files=()
+for size in $SIZES; do
+    src=$CORPUS/gen_$size.c
+    [ -f "$src" ] || bench/gen -size "$size" -seed 1 > "$src"
+    files+=("$src")
+done
+
+bench/edits -edits "$EDITS" ${VERIFY:+-verify} "${files[@]}"
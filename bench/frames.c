@@ -0,0 +1,24 @@
+// An array declared inside a loop, for bench/asm.sh: every pass must
+// reuse the same frame storage, or 5000 passes of 1024 words run out of
+// stack.
+
+int fill(int n, int seed) {
+    int sum = 0;
+    int i = 0;
+    while (i < n) {
+        int a[1024];
+        int j = 0;
+        while (j < 8) {
+            a[j * 128] = seed + (i * j);
+            j = j + 1;
+        }
+        sum = sum + (a[896] - a[128]);
+        i = i + 1;
+    }
+    return sum;
+}
+
+int main() {
+    int b[4] = {1, 2, 3, 4};
+    return fill(5000, b[3]) + b[0];
+}
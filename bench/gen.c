@@ -0,0 +1,304 @@
+// Generates C programs in the subset the compiler accepts, so phase
+// throughput can be measured on inputs of any size.
+//
+// Usage: gen [-size BYTES] [-functions N] [-statements N] [-depth N]
+//            [-nesting N] [-idents N] [-seed N] [-arrays N]
+//
+// With -size, functions are emitted until the output reaches BYTES;
+// otherwise exactly -functions are emitted. A main() calling the last
+// function closes the program.
+//
+// -arrays N emits N element-wise array loops instead, as kernels taking
+// arrays and as loops over main's own arrays, some with overlapping
+// operands. main() returns a checksum of every array, so a run with and
+// without the vectorizer can be compared.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MAX_PARAMS 4
+#define ARRAY_SIZE 1040
+#define ARRAY_COUNT 4
+#define MAX_OFFSET 6
+
+typedef struct {
+    long size;
+    int functions;
+    int statements;
+    int depth;
+    int nesting;
+    int idents;
+    unsigned long seed;
+    int arrays;
+} GenOptions;
+
+static GenOptions opt = {0, 10, 20, 3, 2, 8, 1, 0};
+static int *arity;
+static int arityCapacity = 0;
+static long written = 0;
+
+static const char *operators[] = {"+", "-", "*", "/", "<", ">", "==", "!=", "<=", ">="};
+static const char *elementOperators[] = {"+", "-", "*"};
+
+static unsigned long nextRandom() {
+    opt.seed ^= opt.seed << 13;
+    opt.seed ^= opt.seed >> 7;
+    opt.seed ^= opt.seed << 17;
+    return opt.seed;
+}
+
+static int randomBelow(int n) {
+    return (int)(nextRandom() % (unsigned long)n);
+}
+
+static void out(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    written += vprintf(fmt, args);
+    va_end(args);
+}
+
+static void indent(int level) {
+    for (int i = 0; i < level; i++) out("    ");
+}
+
+// Variables visible inside function f: its params then v0..v(idents-1)
+static void leaf(int params) {
+    int pick = randomBelow(3);
+    if (pick == 0) out("%d", 1 + randomBelow(99));
+    else if (pick == 1 && params) out("p%d", randomBelow(params));
+    else out("v%d", randomBelow(opt.idents));
+}
+
+static void expression(int depth, int params, int callee) {
+    if (depth <= 0) {
+        leaf(params);
+        return;
+    }
+    if (callee >= 0 && randomBelow(8) == 0) {
+        out("f%d(", callee);
+        for (int a = 0; a < arity[callee]; a++) {
+            if (a) out(", ");
+            expression(depth - 1, params, -1);
+        }
+        out(")");
+        return;
+    }
+    if (randomBelow(2)) {
+        out("(");
+        expression(depth - 1, params, callee);
+        out(")");
+    } else {
+        leaf(params);
+    }
+    out(" %s ", operators[randomBelow(4)]);
+    expression(depth - 1, params, callee);
+}
+
+static void statements(int count, int level, int nesting, int params, int callee);
+
+static void statement(int level, int nesting, int params, int callee) {
+    int kind = randomBelow(nesting > 0 ? 5 : 3);
+    indent(level);
+    if (kind <= 1) {
+        out("v%d = ", randomBelow(opt.idents));
+        expression(opt.depth, params, callee);
+        out(";\n");
+    } else if (kind == 2) {
+        if (callee >= 0) {
+            out("v%d = f%d(", randomBelow(opt.idents), callee);
+            for (int a = 0; a < arity[callee]; a++) {
+                if (a) out(", ");
+                expression(1, params, -1);
+            }
+            out(");\n");
+        } else {
+            out("v%d = v%d + 1;\n", randomBelow(opt.idents), randomBelow(opt.idents));
+        }
+    } else if (kind == 3) {
+        out("if (");
+        leaf(params);
+        out(" %s ", operators[4 + randomBelow(6)]);
+        expression(1, params, -1);
+        out(") {\n");
+        statements(2, level + 1, nesting - 1, params, callee);
+        indent(level);
+        out("} else {\n");
+        statements(2, level + 1, nesting - 1, params, callee);
+        indent(level);
+        out("}\n");
+    } else {
+        int counter = randomBelow(opt.idents);
+        out("while (v%d < %d) {\n", counter, 10 + randomBelow(90));
+        statements(2, level + 1, nesting - 1, params, callee);
+        indent(level + 1);
+        out("v%d = v%d + 1;\n", counter, counter);
+        indent(level);
+        out("}\n");
+    }
+}
+
+static void statements(int count, int level, int nesting, int params, int callee) {
+    for (int i = 0; i < count; i++) statement(level, nesting, params, callee);
+}
+
+static void function(int index) {
+    if (index >= arityCapacity) {
+        arityCapacity = arityCapacity ? arityCapacity * 2 : 64;
+        arity = realloc(arity, sizeof(int) * arityCapacity);
+        if (!arity) {
+            fprintf(stderr, "gen: out of memory\n");
+            exit(1);
+        }
+    }
+    int params = randomBelow(MAX_PARAMS + 1);
+    arity[index] = params;
+    int callee = index > 0 ? randomBelow(index) : -1;
+
+    out("int f%d(", index);
+    for (int p = 0; p < params; p++) out("%sint p%d", p ? ", " : "", p);
+    out(") {\n");
+    for (int v = 0; v < opt.idents; v++) {
+        out("    int v%d = ", v);
+        if (v == 0 || params == 0) out("%d", 1 + randomBelow(99));
+        else out("p%d + v%d", randomBelow(params), randomBelow(v));
+        out(";\n");
+    }
+    statements(opt.statements, 1, opt.nesting, params, callee);
+    out("    return v%d;\n}\n\n", randomBelow(opt.idents));
+}
+
+// ---------- array kernels ----------
+
+// An element of one of the arrays, at i plus a small offset
+static void element(const char *const *arrays, int count) {
+    int offset = randomBelow(MAX_OFFSET + 1);
+    out("%s[i", arrays[randomBelow(count)]);
+    if (offset && randomBelow(2)) out(" + %d", offset);
+    out("]");
+}
+
+static void elementExpression(int depth, const char *const *arrays, int count, const char *scale) {
+    int pick = randomBelow(depth > 0 ? 8 : 5);
+    if (pick <= 2) {
+        element(arrays, count);
+    } else if (pick == 3) {
+        out(randomBelow(2) ? "%s" : "i", scale);
+    } else if (pick == 4) {
+        out("%d", 1 + randomBelow(9));
+    } else if (pick == 5) {
+        out("(");
+        elementExpression(depth - 1, arrays, count, scale);
+        out(" * %d)", 2 << randomBelow(3));
+    } else {
+        out("(");
+        elementExpression(depth - 1, arrays, count, scale);
+        out(" %s ", elementOperators[randomBelow(3)]);
+        elementExpression(depth - 1, arrays, count, scale);
+        out(")");
+    }
+}
+
+// while (i < n) { a[i + k] = ...; ... i = i + 1; }
+static void elementLoop(int level, const char *const *arrays, int count, const char *bound, const char *scale) {
+    indent(level);
+    out("while (i < %s) {\n", bound);
+    for (int s = 1 + randomBelow(2); s > 0; s--) {
+        indent(level + 1);
+        element(arrays, count);
+        out(" = ");
+        elementExpression(2, arrays, count, scale);
+        out(";\n");
+    }
+    indent(level + 1);
+    out("i = i + 1;\n");
+    indent(level);
+    out("}\n");
+}
+
+static void kernel(int index) {
+    static const char *params[] = {"a", "b", "c"};
+    out("int k%d(int a[], int b[], int c[], int n, int s) {\n    int i = 0;\n", index);
+    elementLoop(1, params, 3, "n", "s");
+    out("    return 0;\n}\n\n");
+}
+
+static void arrayProgram() {
+    static const char *arrays[] = {"x0", "x1", "x2", "x3"};
+    char bound[32];
+    for (int k = 0; k < opt.arrays; k++) kernel(k);
+
+    out("int main() {\n    int i = 0;\n    int r = 0;\n");
+    for (int a = 0; a < ARRAY_COUNT; a++) out("    int x%d[%d];\n", a, ARRAY_SIZE);
+    out("    while (i < %d) {\n", ARRAY_SIZE);
+    for (int a = 0; a < ARRAY_COUNT; a++) out("        x%d[i] = (i * %d) + %d;\n", a, 3 + 2 * a, a);
+    out("        i = i + 1;\n    }\n");
+
+    // Kernels get arrays in any order, the same one more than once too;
+    // the other loops work on main's arrays directly
+    for (int k = 0; k < opt.arrays; k++) {
+        int n = ARRAY_SIZE - MAX_OFFSET - randomBelow(200);
+        if (randomBelow(2)) {
+            out("    r = r + k%d(x%d, x%d, x%d, %d, %d);\n", k, randomBelow(ARRAY_COUNT),
+                randomBelow(ARRAY_COUNT), randomBelow(ARRAY_COUNT), n, 1 + randomBelow(9));
+        } else {
+            sprintf(bound, "%d", n);
+            out("    i = 0;\n");
+            elementLoop(1, arrays, ARRAY_COUNT, bound, "r");
+        }
+    }
+
+    out("    i = 0;\n    while (i < %d) {\n        r = (r * 31)", ARRAY_SIZE);
+    for (int a = 0; a < ARRAY_COUNT; a++) out(" + x%d[i]", a);
+    out(";\n        i = i + 1;\n    }\n    return r;\n}\n");
+}
+
+static long parseSize(const char *s) {
+    char *end;
+    long value = strtol(s, &end, 10);
+    if (*end == 'K' || *end == 'k') value *= 1024;
+    else if (*end == 'M' || *end == 'm') value *= 1024 * 1024;
+    else if (*end == 'G' || *end == 'g') value *= 1024L * 1024 * 1024;
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-size") == 0) opt.size = parseSize(argv[i + 1]);
+        else if (strcmp(argv[i], "-functions") == 0) opt.functions = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-statements") == 0) opt.statements = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-depth") == 0) opt.depth = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-nesting") == 0) opt.nesting = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-idents") == 0) opt.idents = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-seed") == 0) opt.seed = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-arrays") == 0) opt.arrays = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, "Usage: %s [-size BYTES] [-functions N] [-statements N] [-depth N]\n"
+                            "       [-nesting N] [-idents N] [-seed N] [-arrays N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opt.idents < 1) opt.idents = 1;
+    if (opt.seed == 0) opt.seed = 1;
+    if (opt.arrays > 0) {
+        arrayProgram();
+        return 0;
+    }
+
+    int count = 0;
+    while (opt.size ? written < opt.size : count < opt.functions) {
+        function(count++);
+    }
+
+    out("int main() {\n    int r = 0;\n");
+    if (count > 0) {
+        out("    r = f%d(", count - 1);
+        for (int a = 0; a < arity[count - 1]; a++) out("%s%d", a ? ", " : "", a + 1);
+        out(");\n");
+    }
+    out("    return r;\n}\n");
+    free(arity);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#!/bin/bash
+# Small programs for bugs that were fixed once: each must either fail to
+# compile with a given message, or return the same value at -O0, -O1 and
+# -O2 under the TAC interpreter. A batch of two files is also checked by
+# running the assembly it writes.
+#
+# Usage: bench/regress.sh
+
+cd "$(dirname "$0")/.." || exit 1
+
+CORPUS=bench/corpus
+./build.sh || exit 1
+gcc -O2 -Wall -Wextra bench/asmrun.c -o bench/asmrun || exit 1
+mkdir -p "$CORPUS"
+
+failed=0
+
+# expectError NAME MESSAGE SOURCE: compiling must fail with MESSAGE
+expectError() {
+    local src=$CORPUS/regress_$1.c
+    printf "%s" "$3" > "$src"
+    local output
+    output=$(./main "$src" -o /dev/null 2>&1)
+    if [ $? -eq 0 ] || ! grep -qF "$2" <<< "$output"; then
+        echo "FAIL $1: expected \"$2\", got: $output"
+        failed=1
+    else
+        echo "ok   $1"
+    fi
+}
+
+# expectReturn NAME VALUE SOURCE: main returns VALUE at every -O level
+expectReturn() {
+    local src=$CORPUS/regress_$1.c
+    printf "%s" "$3" > "$src"
+    for level in -O0 -O1 -O2; do
+        local returned
+        returned=$(./main -run $level "$src" -o /dev/null 2>&1 | grep "main returned" | sed 's/.*main returned //')
+        if [ "${returned%% *}" != "$2" ]; then
+            echo "FAIL $1 $level: expected $2, got: ${returned:-$(./main -run $level "$src" -o /dev/null 2>&1)}"
+            failed=1
+            return
+        fi
+    done
+    echo "ok   $1"
+}
+
+# x * 0 and x - x must not hide an undeclared x
+expectError undeclared_mul_zero "undeclared variable 'zz'" '
+int main() {
+    return zz * 0;
+}
+'
+expectError undeclared_sub_self "undeclared variable 'qq'" '
+int main() {
+    return qq - qq;
+}
+'
+expectReturn identities 3 '
+int main() {
+    int x = 5;
+    int y = (x * 0) + ((x - x) + (0 * x));
+    return y + 3;
+}
+'
+
+# Folding is done in float, as the machine computes: 1/3*300 is 100, not
+# 99.9999999, and 2^24 + 1 rounds back to 2^24
+expectReturn float_fold_chain 100030 '
+int main() {
+    float g = 1.0;
+    g = g / 3.0;
+    float h = g * 300.0;
+    int k = h;
+    float s = 0.1;
+    s = s + 0.2;
+    s = s * 10.0;
+    int m = s;
+    float big = 16777216.0;
+    big = big + 1.0;
+    big = big - 16777216.0;
+    int n = big;
+    return (((k * 100) + m) * 10) + n;
+}
+'
+
+# Calls and declarations are AST node kinds, not node names: variables
+# named call or declare used to be taken for them and crash
+expectReturn variable_named_call 5 '
+int main() {
+    int call = 5;
+    return call;
+}
+'
+expectReturn variable_named_declare 6 '
+int twice(int declare) {
+    return declare * 2;
+}
+int main() {
+    int declare = 3;
+    return twice(declare);
+}
+'
+
+# A batch writes a .s per source, so two files that both define main and
+# use the same labels each assemble on their own
+batch=$CORPUS/regress_batch
+rm -rf "$batch"
+mkdir -p "$batch/one" "$batch/two" "$batch/out"
+printf 'int main() {\n    int i = 0;\n    while (i < 3) {\n        i = i + 1;\n    }\n    return i;\n}\n' > "$batch/one/main.c"
+printf 'int inc(int x) {\n    return x + 1;\n}\nint main() {\n    int i = 0;\n    while (i < 4) {\n        i = inc(i);\n    }\n    return i;\n}\n' > "$batch/two/prog.c"
+if ! ./main -O0 "$batch/one/main.c" "$batch/two/prog.c" -o "$batch/out" 2> "$batch/errors"; then
+    echo "FAIL batch_two_mains: $(cat "$batch/errors")"
+    failed=1
+elif [ "$(bench/asmrun "$batch/out/main.s" | cut -d' ' -f3)" != 3 ] ||
+     [ "$(bench/asmrun "$batch/out/prog.s" | cut -d' ' -f3)" != 4 ] ||
+     [ "$(grep -c '^main:' "$batch/out/main.s")" != 1 ] || [ "$(grep -c '^main:' "$batch/out/prog.s")" != 1 ]; then
+    echo "FAIL batch_two_mains: $(ls "$batch/out")"
+    failed=1
+else
+    echo "ok   batch_two_mains"
+fi
+
+exit $failed
@@ -0,0 +1,78 @@
+#!/bin/bash
+# Runs every compiler phase over generated inputs and reports tokens/s,
+# lines/s and peak memory per phase, flagging regressions against
+# bench/baseline.txt.
+#
+# Usage: bench/run.sh [--update-baseline]
+#   SIZES="1K 10K"    corpus sizes to run (default 1K .. 100M)
+#   OPT=-O2           optimization level passed to the compiler
+#   THRESHOLD=25      slowdown in percent reported as a regression
+#   MIN_MS=5          phases faster than this are too noisy to compare
+
+cd "$(dirname "$0")/.." || exit 1
+
+SIZES=${SIZES:-"1K 10K 100K 1M 10M 100M"}
+OPT=${OPT:--O2}
+THRESHOLD=${THRESHOLD:-25}
+MIN_MS=${MIN_MS:-5}
+BASELINE=bench/baseline.txt
+CORPUS=bench/corpus
+RESULTS=$CORPUS/results.txt
+
+./build.sh || exit 1
+gcc -O2 bench/gen.c -o bench/gen || exit 1
+mkdir -p "$CORPUS"
+: > "$RESULTS"
+
+printf "%-6s %-10s %-10s %-14s %-12s %-12s\n" "Size" "Phase" "Wall(ms)" "Tokens/s" "Lines/s" "PeakRSS(KB)"
+echo "--------------------------------------------------------------------"
+
+for size in $SIZES; do
+    src=$CORPUS/gen_$size.c
+    report=$CORPUS/report_$size.json
+    [ -f "$src" ] || bench/gen -size "$size" -seed 1 > "$src"
+    lines=$(wc -l < "$src")
+
+    if ! (cd "$CORPUS" && ../../main "$OPT" -ftime-report-json="report_$size.json" \
+            "gen_$size.c" > /dev/null 2>&1); then
+        printf "%-6s %s\n" "$size" "FAILED (exit $?)"
+        continue
+    fi
+
+    # The report keeps one phase object per line
+    tokens=$(sed -n 's/.*"tokens": \([0-9]*\).*/\1/p' "$report")
+    grep '"name"' "$report" | sed 's/[{}",:]/ /g' | \
+        awk -v size="$size" -v tokens="$tokens" -v lines="$lines" '{
+            for (i = 1; i < NF; i++) {
+                if ($i == "name") phase = $(i + 1);
+                if ($i == "wall_ms") wall = $(i + 1);
+                if ($i == "peak_rss_kb") rss = $(i + 1);
+            }
+            secs = wall > 0 ? wall / 1000 : 1e-9;
+            printf "%-6s %-10s %-10.3f %-14.0f %-12.0f %-12d\n", size, phase, wall,
+                   tokens / secs, lines / secs, rss;
+        }' | tee -a "$RESULTS"
+done
+
+if [ "$1" = "--update-baseline" ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "Baseline updated: $BASELINE"
+    exit 0
+fi
+
+[ -f "$BASELINE" ] || { echo "No baseline; run with --update-baseline"; exit 0; }
+
+# Compare tokens/s per (size, phase) against the stored baseline
+awk -v threshold="$THRESHOLD" -v minMs="$MIN_MS" '
+    FNR == NR { base[$1 " " $2] = $4; next }
+    {
+        key = $1 " " $2;
+        if (!(key in base) || $3 < minMs || base[key] <= 0) next;
+        drop = (base[key] - $4) * 100 / base[key];
+        if (drop > threshold) {
+            printf "REGRESSION %-6s %-10s %.0f tokens/s vs baseline %.0f (-%.0f%%)\n",
+                   $1, $2, $4, base[key], drop;
+            failed = 1;
+        }
+    }
+    END { exit failed }' "$BASELINE" "$RESULTS" && echo "No regressions against $BASELINE"
@@ -1,4 +1,6 @@
 # #!/bin/bash
 # gcc lexer.c -o main -Wall -Wextra
 #!/bin/bash
-gcc main.c lexer.c parser.c semantic.c codegen.c -o main -Wall -Wextra
+set -e
+gcc main.c lexer.c parser.c semantic.c codegen.c inline.c passes.c stats.c output.c compiler.c batch.c pool.c tokenring.c cache.c daemon.c preprocess.c headers.c interp.c vectorize.c frame.c document.c artifact.c -o main -Wall -Wextra -pthread
+gcc client.c -o mainc -Wall -Wextra
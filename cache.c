@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "compiler.h"
+
+#define HASH_PRIME 1099511628211ULL
+#define MAX_CACHE_PATH 4096
+
+typedef struct {
+    unsigned magic;
+    unsigned version;
+    unsigned long long key;
+    int unitIndex;          // labels in the entry are named L<unitIndex>_n
+    int tempCount;
+    int labelCount;
+    int initialCount;
+    int optimizedCount;
+    long asmLength;
+} CacheHeader;
+
+// FNV-1a
+unsigned long long hashBytes(unsigned long long hash, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+static unsigned long long hashInt(unsigned long long hash, long long value) {
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+static unsigned long long hashString(unsigned long long hash, const char *s) {
+    return hashBytes(hash, s, strlen(s) + 1);
+}
+
+// Line numbers are left out: moving a function does not change its code
+void hashToken(Compiler *cc, const Token *tok) {
+    cc->tokenHash = hashString(hashInt(cc->tokenHash, tok->type), tok->lexeme);
+}
+
+// Called after each function is parsed; the hashes line up with the
+// function table, which declares functions in the same order
+void recordFunctionHash(Compiler *cc) {
+    if (cc->functionHashCount == cc->functionHashCapacity) {
+        cc->functionHashCapacity = cc->functionHashCapacity ? cc->functionHashCapacity * 2 : 64;
+        cc->functionHashes = (unsigned long long*)xrealloc(cc->functionHashes,
+                                 sizeof(unsigned long long) * cc->functionHashCapacity);
+    }
+    cc->functionHashes[cc->functionHashCount++] = cc->tokenHash;
+}
+
+// Folds in every callee by name and, for functions of this file, by the
+// hash of its tokens; an unknown callee can never be inlined
+static unsigned long long hashCallees(Compiler *parent, ASTNode *node, unsigned long long hash) {
+    for (; node; node = node->next) {
+        if (node->type == AST_CALL) {
+            FunctionInfo *fn = findFunction(parent, node->condition->name);
+            hash = hashString(hash, node->condition->name);
+            hash = hashInt(hash, fn ? (long long)parent->functionHashes[fn - parent->functionTable] : 0);
+        }
+        hash = hashCallees(parent, node->condition, hash);
+        hash = hashCallees(parent, node->body, hash);
+        hash = hashCallees(parent, node->elseBody, hash);
+    }
+    return hash;
+}
+
+static unsigned long long unitKey(Compiler *unit) {
+    const CompileOptions *options = unit->options;
+    Compiler *parent = unit->parent;
+    unsigned long long hash = hashInt(HASH_SEED, CACHE_VERSION);
+    hash = hashInt(hash, options->optLevel);
+    hash = hashBytes(hash, options->passEnabled, sizeof(options->passEnabled));
+    hash = hashInt(hash, options->streaming);
+    hash = hashInt(hash, (long long)parent->functionHashes[unit->unitIndex]);
+    hash = hashCallees(parent, unit->function->condition, hash);
+    return hashCallees(parent, unit->function->body, hash);
+}
+
+static void entryPath(char *path, const Compiler *unit) {
+    snprintf(path, MAX_CACHE_PATH, "%s/%016llx", unit->options->cacheDir, unit->cacheKey);
+}
+
+// Quads are stored as four NUL-terminated fields
+static void writeQuads(Output *out, const Quadruple *code, int count) {
+    for (int i = 0; i < count; i++) {
+        outWrite(out, code[i].result, strlen(code[i].result) + 1);
+        outWrite(out, code[i].arg1, strlen(code[i].arg1) + 1);
+        outWrite(out, code[i].op, strlen(code[i].op) + 1);
+        outWrite(out, code[i].arg2, strlen(code[i].arg2) + 1);
+    }
+}
+
+static const char* readField(const char *p, const char *end, char *field) {
+    const char *nul = p ? memchr(p, '\0', end - p) : NULL;
+    if (!nul || nul - p >= MAX_LEN) return NULL;
+    memcpy(field, p, nul - p + 1);
+    return nul + 1;
+}
+
+static const char* readQuads(const char *p, const char *end, Quadruple *code, int count) {
+    for (int i = 0; i < count && p; i++) {
+        p = readField(p, end, code[i].result);
+        p = readField(p, end, code[i].arg1);
+        p = readField(p, end, code[i].op);
+        p = readField(p, end, code[i].arg2);
+    }
+    return p;
+}
+
+// Renames the entry's labels into this unit's namespace
+static void renameLabels(char *name, int from, int to) {
+    char prefix[32];
+    int length = snprintf(prefix, sizeof(prefix), "L%d_", from);
+    if (strncmp(name, prefix, length) != 0 || !is_number(name + length)) return;
+    sprintf(name, "L%d_%d", to, atoi(name + length));
+}
+
+static void moveLabels(Quadruple *code, int count, int from, int to) {
+    for (int i = 0; i < count; i++) {
+        renameLabels(code[i].result, from, to);
+        renameLabels(code[i].arg1, from, to);
+        renameLabels(code[i].arg2, from, to);
+    }
+}
+
+static char* readFile(const char *path, long *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (*length = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = (char*)xmalloc(*length);
+        if (fread(data, 1, *length, file) != (size_t)*length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+// On a hit the unit gets its initial TAC in code, as if generated, and
+// its optimized TAC in cachedCode. The stored assembly is kept in
+// cacheEntry unless the function moved and its labels had to be renamed,
+// in which case it is generated again from the renamed TAC.
+int loadCachedUnit(Compiler *unit) {
+    char path[MAX_CACHE_PATH];
+    long length;
+    unit->cacheKey = unitKey(unit);
+    entryPath(path, unit);
+    char *data = readFile(path, &length);
+    if (!data) return 0;
+
+    CacheHeader header;
+    const char *end = data + length;
+    const char *p = data + sizeof(header);
+    if (length < (long)sizeof(header)) goto miss;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.key != unit->cacheKey ||
+        header.initialCount < 0 || header.optimizedCount < 0 || header.asmLength < 0) {
+        goto miss;
+    }
+
+    unit->codeCapacity = header.initialCount ? header.initialCount : 1;
+    unit->code = (Quadruple*)xmalloc(sizeof(Quadruple) * unit->codeCapacity);
+    unit->cachedCode = (Quadruple*)xmalloc(sizeof(Quadruple) * (header.optimizedCount ? header.optimizedCount : 1));
+    p = readQuads(p, end, unit->code, header.initialCount);
+    p = readQuads(p, end, unit->cachedCode, header.optimizedCount);
+    if (!p || end - p != header.asmLength) {
+        free(unit->code);
+        free(unit->cachedCode);
+        unit->code = unit->cachedCode = NULL;
+        unit->codeCapacity = 0;
+        goto miss;
+    }
+
+    unit->codeIndex = header.initialCount;
+    unit->cachedCount = header.optimizedCount;
+    unit->tempCount = header.tempCount;
+    unit->labelCount = header.labelCount;
+    if (header.unitIndex == unit->unitIndex) {
+        outWrite(&unit->cacheEntry, p, header.asmLength);
+    } else {
+        moveLabels(unit->code, unit->codeIndex, header.unitIndex, unit->unitIndex);
+        moveLabels(unit->cachedCode, unit->cachedCount, header.unitIndex, unit->unitIndex);
+    }
+    unit->cacheHit = 1;
+    free(data);
+    return 1;
+
+miss:
+    free(data);
+    return 0;
+}
+
+// Stands in for optimize() on a hit. The initial buffer stays alive as
+// inlineOut, since other units may be inlining from it.
+void useCachedCode(Compiler *unit) {
+    unit->inlineOut = unit->code;
+    unit->inlineOutCapacity = unit->codeCapacity;
+    unit->code = unit->cachedCode;
+    unit->codeCapacity = unit->codeIndex = unit->cachedCount;
+    unit->cachedCode = NULL;
+}
+
+// A miss records its initial TAC before the passes rewrite it
+void saveInitialCode(Compiler *unit) {
+    unit->cacheInitialCount = unit->codeIndex;
+    writeQuads(&unit->cacheEntry, unit->code, unit->codeIndex);
+}
+
+// Written to a private name and renamed into place, so concurrent
+// compilations never see a partial entry
+void storeCachedUnit(Compiler *unit) {
+    char path[MAX_CACHE_PATH], temp[MAX_CACHE_PATH];
+    entryPath(path, unit);
+    snprintf(temp, sizeof(temp), "%s/.%016llx.%d.%p", unit->options->cacheDir,
+             unit->cacheKey, (int)getpid(), (void*)unit);
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = unit->cacheKey;
+    header.unitIndex = unit->unitIndex;
+    header.tempCount = unit->tempCount;
+    header.labelCount = unit->labelCount;
+    header.initialCount = unit->cacheInitialCount;
+    header.optimizedCount = unit->codeIndex;
+    header.asmLength = (long)unit->asmOutput->length;
+
+    writeQuads(&unit->cacheEntry, unit->code, unit->codeIndex);
+    FILE *file = fopen(temp, "wb");
+    if (!file) return;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (unit->cacheEntry.length) {
+        ok = ok && fwrite(unit->cacheEntry.data, 1, unit->cacheEntry.length, file) == unit->cacheEntry.length;
+    }
+    if (unit->asmOutput->length) {
+        ok = ok && fwrite(unit->asmOutput->data, 1, unit->asmOutput->length, file) == unit->asmOutput->length;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) remove(temp);
+}
+
+// Entries are named by a 16-digit hex key; temporaries add a leading dot
+// and a suffix. Nothing else in the directory is touched.
+static int isCacheFile(const char *name) {
+    if (name[0] == '.') name++;
+    for (int i = 0; i < 16; i++) {
+        if (!isxdigit((unsigned char)name[i])) return 0;
+    }
+    return name[16] == '\0' || name[16] == '.';
+}
+
+// Returns the number of entries removed, or -1 if dir cannot be read
+int clearCache(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    int removed = 0;
+    struct dirent *entry;
+    char path[MAX_CACHE_PATH];
+    while ((entry = readdir(d))) {
+        if (!isCacheFile(entry->d_name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (remove(path) == 0) removed++;
+    }
+    closedir(d);
+    return removed;
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "lexer.h"
+
+// Bump whenever code generation or a pass changes its output, so entries
+// written by an older compiler are never reused
+#define CACHE_VERSION 8
+#define CACHE_MAGIC 0x43415454      // "TTAC"
+#define DEFAULT_CACHE_DIR ".tac-cache"
+#define HASH_SEED 14695981039346656037ULL
+
+// Per-function cache. An entry holds a function's initial and optimized
+// TAC and its assembly, keyed by a hash of the function's tokens, the
+// tokens of every function it calls (whose code the inliner may copy in),
+// the cache version and the options that affect code. Entries are files
+// named by the key in the cache directory.
+
+unsigned long long hashBytes(unsigned long long hash, const void *data, size_t length);
+void hashToken(Compiler *cc, const Token *tok);
+void recordFunctionHash(Compiler *cc);
+
+int loadCachedUnit(Compiler *unit);
+void useCachedCode(Compiler *unit);
+void saveInitialCode(Compiler *unit);
+void storeCachedUnit(Compiler *unit);
+int clearCache(const char *dir);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+// Thin client for the compile daemon: takes the same arguments as ./main
+// and exits with the status the daemon's run returned
+
+static int writeFully(int fd, const void *data, size_t length) {
+    const char *p = (const char*)data;
+    while (length) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    char defaultPath[MAX_SOCKET_PATH];
+    const char *socketPath = getenv(SOCKET_ENV);
+    if (!socketPath) {
+        snprintf(defaultPath, sizeof(defaultPath), DEFAULT_SOCKET_FORMAT, (int)getuid());
+        socketPath = defaultPath;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Cannot reach the compile daemon at %s; start it with: main -daemon\n", socketPath);
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        return 1;
+    }
+    size_t length = strlen(cwd) + 1;
+    for (int i = 1; i < argc; i++) length += strlen(argv[i]) + 1;
+    if (length > MAX_REQUEST_SIZE) {
+        fprintf(stderr, "Command line too long\n");
+        return 1;
+    }
+    char *payload = (char*)malloc(length), *p = payload;
+    if (!payload) return 1;
+    strcpy(p, cwd);
+    p += strlen(cwd) + 1;
+    for (int i = 1; i < argc; i++) {
+        strcpy(p, argv[i]);
+        p += strlen(argv[i]) + 1;
+    }
+
+    DaemonRequest request = {DAEMON_MAGIC, argc, (int)length};
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // A daemon that refuses the request closes the socket under us
+    signal(SIGPIPE, SIG_IGN);
+    int status = 1;
+    if (sendmsg(conn, &msg, 0) != (ssize_t)sizeof(request) || !writeFully(conn, payload, length) ||
+        read(conn, &status, sizeof(status)) != (ssize_t)sizeof(status)) {
+        fprintf(stderr, "The compile daemon at %s did not answer\n", socketPath);
+        status = 1;
+    }
+    free(payload);
+    close(conn);
+    return status;
+}
@@ -2,232 +2,559 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include "parser.h"
-#include "codegen.h"
+#include <limits.h>
+#include "compiler.h"
 
-int tempCount = 0;
-int labelCount = 0;
-int codeIndex = 0;
-Quadruple code[MAX_CODE];
+#define NAME_SIZE 16
 
-char* newTemp() {
-    char* temp = (char*)malloc(10);
-    sprintf(temp, "t%d", tempCount++);
+// Carves fixed-size name slots out of blocks freed with the compilation
+static char* allocName(Compiler* cc) {
+    NameBlock* block = cc->names;
+    if (!block || block->used + NAME_SIZE > NAME_BLOCK_SIZE) {
+        block = (NameBlock*)xmalloc(sizeof(NameBlock));
+        block->next = cc->names;
+        block->used = 0;
+        cc->names = block;
+    }
+    char* name = block->data + block->used;
+    block->used += NAME_SIZE;
+    return name;
+}
+
+void freeNames(Compiler* cc) {
+    while (cc->names) {
+        NameBlock* next = cc->names->next;
+        free(cc->names);
+        cc->names = next;
+    }
+}
+
+char* newTemp(Compiler* cc) {
+    char* temp = allocName(cc);
+    sprintf(temp, "t%d", cc->tempCount++);
     return temp;
 }
 
-char* newLabel() {
-    char* label = (char*)malloc(10);
-    sprintf(label, "L%d", labelCount++);
+char* newLabel(Compiler* cc) {
+    char* label = allocName(cc);
+    sprintf(label, "L%d_%d", cc->unitIndex, cc->labelCount++);
     return label;
 }
 
-void emit(const char* result, const char* arg1, const char* op, const char* arg2) {
-    if (codeIndex >= MAX_CODE) {
-        fprintf(stderr, "Error: Code array overflow\n");
-        exit(1);
-    }
-    
-    strncpy(code[codeIndex].result, result, MAX_LEN-1);
-    strncpy(code[codeIndex].arg1, arg1, MAX_LEN-1);
-    if (op) {
-        strncpy(code[codeIndex].op, op, MAX_LEN-1);
+static void copyField(char* dest, const char* src) {
+    if (src) {
+        strncpy(dest, src, MAX_LEN-1);
+        dest[MAX_LEN-1] = '\0';
     } else {
-        code[codeIndex].op[0] = '\0';
+        dest[0] = '\0';
     }
-    if (arg2) {
-        strncpy(code[codeIndex].arg2, arg2, MAX_LEN-1);
-    } else {
-        code[codeIndex].arg2[0] = '\0';
+}
+
+void setQuad(Quadruple* q, const char* result, const char* arg1, const char* op, const char* arg2) {
+    copyField(q->result, result);
+    copyField(q->arg1, arg1);
+    copyField(q->op, op);
+    copyField(q->arg2, arg2);
+}
+
+void emit(Compiler* cc, const char* result, const char* arg1, const char* op, const char* arg2) {
+    if (cc->codeIndex == cc->codeCapacity) {
+        cc->codeCapacity = cc->codeCapacity ? cc->codeCapacity * 2 : INITIAL_CODE;
+        cc->code = (Quadruple*)xrealloc(cc->code, sizeof(Quadruple) * cc->codeCapacity);
     }
-    codeIndex++;
+    setQuad(&cc->code[cc->codeIndex++], result, arg1, op, arg2);
 }
 
 int is_number(char* str) {
-    if (!str) return 0;
+    if (!str || !str[0]) return 0;
+    if (str[0] == '-' && str[1]) str++;
     for (int i = 0; str[i]; i++) if (!isdigit(str[i])) return 0;
     return 1;
 }
 
+// A float literal: digits with exactly one '.'
+int is_float(char* str) {
+    int dots = 0, digits = 0;
+    if (!str || !str[0]) return 0;
+    if (str[0] == '-' && str[1]) str++;
+    for (int i = 0; str[i]; i++) {
+        if (str[i] == '.') dots++;
+        else if (isdigit((unsigned char)str[i])) digits++;
+        else return 0;
+    }
+    return dots == 1 && digits > 0;
+}
+
+// Writes a float constant so it reads back as one: always with a '.',
+// and with the 9 digits that make strtof return the same float
+void formatFloat(char* dest, float value) {
+    sprintf(dest, "%.9g", value);
+    if (!strchr(dest, '.')) {
+        if (strchr(dest, 'e') || strchr(dest, 'n') || strchr(dest, 'i')) sprintf(dest, "%.1f", value);
+        else strcat(dest, ".0");
+    }
+}
+
+// Whether (int)value is defined: it truncates into int's range
+int floatFitsInt(float value) {
+    return value > -2147483904.0f && value < 2147483648.0f;
+}
+
+// Whether a op b has a value to fold to: division by zero, and INT_MIN /
+// -1 which overflows, are left for run time
+int can_fold(int a, int b, const char* op) {
+    if (strcmp(op, "/") == 0) return b != 0 && !(a == INT_MIN && b == -1);
+    return 1;
+}
+
+// Wraps like the machine: arithmetic is done unsigned and shift counts
+// are taken mod 32. Callers check can_fold first.
 int eval_const(int a, int b, char* op) {
-    if (strcmp(op, "+") == 0) return a + b;
-    if (strcmp(op, "-") == 0) return a - b;
-    if (strcmp(op, "*") == 0) return a * b;
-    if (strcmp(op, "/") == 0 && b != 0) return a / b;
+    unsigned ua = (unsigned)a, ub = (unsigned)b;
+    if (strcmp(op, "+") == 0) return (int)(ua + ub);
+    if (strcmp(op, "-") == 0) return (int)(ua - ub);
+    if (strcmp(op, "*") == 0) return (int)(ua * ub);
+    if (strcmp(op, "/") == 0 && can_fold(a, b, op)) return a / b;
     if (strcmp(op, "==") == 0) return a == b;
     if (strcmp(op, "!=") == 0) return a != b;
     if (strcmp(op, "<") == 0) return a < b;
     if (strcmp(op, ">") == 0) return a > b;
     if (strcmp(op, "<=") == 0) return a <= b;
     if (strcmp(op, ">=") == 0) return a >= b;
+    if (strcmp(op, "<<") == 0) return (int)(ua << (b & 31));
+    if (strcmp(op, ">>") == 0) return a >> (b & 31);
+    if (strcmp(op, "&") == 0) return a & b;
     return 0;
 }
 
-void printIntermediateCode(const char* phase) {
-    printf("\n=== %s Intermediate Code ===\n", phase);
-    printf("%-5s %-10s %-10s %-5s %-10s\n", "Line", "Result", "Arg1", "Op", "Arg2");
-    printf("----------------------------------------\n");
-    for (int i = 0; i < codeIndex; i++) {
-        printf("%-5d %-10s %-10s %-5s %-10s\n", 
-               i, 
+static int printQuads(Compiler* cc, const Quadruple* code, int count, int line) {
+    for (int i = 0; i < count; i++) {
+        outPrintf(&cc->dumpOutput, "%-5d %-10s %-10s %-5s %-10s\n", 
+               line++, 
                code[i].result, 
                code[i].arg1, 
                code[i].op, 
                code[i].arg2);
     }
-    printf("========================================\n");
+    return line;
 }
 
-void optimize() {
-    printf("\nPerforming optimization...\n");
-    for (int i = 0; i < codeIndex; i++) {
-        if (is_number(code[i].arg1)) {
-            if (strlen(code[i].op)) { // Binary operation
-                if (is_number(code[i].arg2)) {
-                    int val = eval_const(atoi(code[i].arg1), atoi(code[i].arg2), code[i].op);
-                    sprintf(code[i].arg1, "%d", val);
-                    strcpy(code[i].op, "=");
-                    code[i].arg2[0] = '\0';
-                    printf("Optimized line %d: Constant folding applied\n", i);
-                }
-            }
+// A file split into function units lists them in order, numbered on
+void printIntermediateCode(Compiler* cc, const char* phase) {
+    outPrintf(&cc->dumpOutput, "\n=== %s Intermediate Code ===\n", phase);
+    outPrintf(&cc->dumpOutput, "%-5s %-10s %-10s %-5s %-10s\n", "Line", "Result", "Arg1", "Op", "Arg2");
+    outPrintf(&cc->dumpOutput, "----------------------------------------\n");
+    int line = printQuads(cc, cc->code, cc->codeIndex, 0);
+    for (int u = 0; u < cc->unitCount; u++) {
+        line = printQuads(cc, cc->units[u].code, cc->units[u].codeIndex, line);
+    }
+    outPrintf(&cc->dumpOutput, "========================================\n");
+}
+
+// Float operators ("f+", "f<", ...) on two float constants. Division by
+// zero is left for run time. Returns 0 when op does not fold.
+// In float, as the machine computes: double would round differently
+static int evalFloatConst(float a, float b, const char* op, char* result) {
+    if (strcmp(op, "f+") == 0) formatFloat(result, a + b);
+    else if (strcmp(op, "f-") == 0) formatFloat(result, a - b);
+    else if (strcmp(op, "f*") == 0) formatFloat(result, a * b);
+    else if (strcmp(op, "f/") == 0 && b != 0) formatFloat(result, a / b);
+    else if (strcmp(op, "f==") == 0) sprintf(result, "%d", a == b);
+    else if (strcmp(op, "f!=") == 0) sprintf(result, "%d", a != b);
+    else if (strcmp(op, "f<") == 0) sprintf(result, "%d", a < b);
+    else if (strcmp(op, "f>") == 0) sprintf(result, "%d", a > b);
+    else if (strcmp(op, "f<=") == 0) sprintf(result, "%d", a <= b);
+    else if (strcmp(op, "f>=") == 0) sprintf(result, "%d", a >= b);
+    else return 0;
+    return 1;
+}
+
+static int isIntOperator(const char* op) {
+    static const char* ops[] = {"+", "-", "*", "/", "==", "!=", "<", ">", "<=", ">=", "<<", ">>", "&"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(ops[i], op) == 0) return 1;
+    }
+    return 0;
+}
+
+// The constant q computes, if its operands are constants of its type.
+// A division that would trap stays in the code, to fail at run time.
+static int foldQuad(Quadruple* q, char* value) {
+    if (is_number(q->arg1) && is_number(q->arg2) && isIntOperator(q->op)) {
+        if (!can_fold(atoi(q->arg1), atoi(q->arg2), q->op)) return 0;
+        sprintf(value, "%d", eval_const(atoi(q->arg1), atoi(q->arg2), q->op));
+        return 1;
+    }
+    // Integer identities that discard a name, once semantic analysis has
+    // checked it; a call in the operand is its own quad and stays
+    if ((strcmp(q->op, "*") == 0 && (strcmp(q->arg1, "0") == 0 || strcmp(q->arg2, "0") == 0)) ||
+        (strcmp(q->op, "-") == 0 && q->arg1[0] && strcmp(q->arg1, q->arg2) == 0)) {
+        strcpy(value, "0");
+        return 1;
+    }
+    if (is_float(q->arg1) && is_float(q->arg2)) {
+        return evalFloatConst(strtof(q->arg1, NULL), strtof(q->arg2, NULL), q->op, value);
+    }
+    if (strcmp(q->op, "itof") == 0 && is_number(q->arg1)) {
+        formatFloat(value, (float)atoi(q->arg1));
+        return 1;
+    }
+    if (strcmp(q->op, "ftoi") == 0 && is_float(q->arg1) && floatFitsInt(strtof(q->arg1, NULL))) {
+        sprintf(value, "%d", (int)strtof(q->arg1, NULL));
+        return 1;
+    }
+    return 0;
+}
+
+int foldConstants(Compiler* cc) {
+    int folded = 0;
+    for (int i = 0; i < cc->codeIndex; i++) {
+        Quadruple* q = &cc->code[i];
+        char value[MAX_LEN];
+        if (!foldQuad(q, value)) continue;
+        strcpy(q->arg1, value);
+        strcpy(q->op, "=");
+        q->arg2[0] = '\0';
+        if (cc->options->dumpFlags & DUMP_PASSES) {
+            outPrintf(&cc->dumpOutput, "Optimized line %d: Constant folding applied\n", i);
         }
+        folded++;
+    }
+    return folded;
+}
+
+// The instruction for a TAC operator, by operand type
+static const char* machineOp(const char* op) {
+    static const char* table[][2] = {
+        {"+", "ADD"}, {"-", "SUB"}, {"*", "MUL"}, {"/", "DIV"},
+        {"<<", "SHL"}, {">>", "SAR"}, {"&", "AND"},
+        {"==", "CMPEQ"}, {"!=", "CMPNE"}, {"<", "CMPLT"}, {">", "CMPGT"}, {"<=", "CMPLE"}, {">=", "CMPGE"},
+        {"f+", "FADD"}, {"f-", "FSUB"}, {"f*", "FMUL"}, {"f/", "FDIV"},
+        {"f==", "FCMPEQ"}, {"f!=", "FCMPNE"}, {"f<", "FCMPLT"}, {"f>", "FCMPGT"}, {"f<=", "FCMPLE"}, {"f>=", "FCMPGE"},
+        {"itof", "ITOF"}, {"ftoi", "FTOI"},
+        {"V+", "VADD"}, {"V-", "VSUB"}, {"V*", "VMUL"}, {"V&", "VAND"}, {"V<<", "VSHL"}, {"V>>", "VSAR"},
+        {"Vf+", "VFADD"}, {"Vf-", "VFSUB"}, {"Vf*", "VFMUL"}, {"Vf/", "VFDIV"},
+    };
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (strcmp(table[i][0], op) == 0) return table[i][1];
     }
+    return op;
 }
 
-void generateFinalCode() {
-    printf("\n=== Final Assembly Code ===\n");
-    printf("PUSH BP\n");
-    printf("MOV BP, SP\n");
-    
-    for (int i = 0; i < codeIndex; i++) {
-        if (strcmp(code[i].op, "if") == 0) {
-            printf("LOAD %s\n", code[i].arg1);
-            printf("JNZ %s\n", code[i].arg2);
+// "[BP-n]" for each slot offset in use, formatted the first time it is
+// needed: a listing names the same few slots over and over
+typedef struct {
+    char (*text)[16];
+    int count;
+} SlotNames;
+
+static const char* slotName(SlotNames* names, int slot) {
+    int k = slot / WORD_SIZE;
+    if (k >= names->count) {
+        int count = names->count ? names->count : 64;
+        while (count <= k) count *= 2;
+        names->text = (char(*)[16])xrealloc(names->text, sizeof(names->text[0]) * count);
+        memset(names->text[names->count], 0, sizeof(names->text[0]) * (count - names->count));
+        names->count = count;
+    }
+    if (!names->text[k][0]) sprintf(names->text[k], "[BP-%d]", slot);
+    return names->text[k];
+}
+
+// The operands of code[i] as the machine addresses them: a name by its
+// frame slot, anything else as written
+static void addressOperands(Compiler* cc, int i, SlotNames* names, const char* operands[FRAME_FIELDS]) {
+    const char* fields[FRAME_FIELDS] = {cc->code[i].result, cc->code[i].arg1, cc->code[i].arg2};
+    for (int f = 0; f < FRAME_FIELDS; f++) {
+        int slot = frameSlot(cc, i, f);
+        operands[f] = slot ? slotName(names, slot) : fields[f];
+    }
+}
+
+// Names live in the frame layoutFrames gave them, below BP
+void generateFinalCode(Compiler* cc, Output* out) {
+    SlotNames names = {NULL, 0};
+    for (int i = 0; i < cc->codeIndex; i++) {
+        const char* operands[FRAME_FIELDS];
+        if (strcmp(cc->code[i].op, "FUNC") == 0) {
+            outPrintf(out, "%s:\n", cc->code[i].result);
+            outPrintf(out, "PUSH BP\n");
+            outPrintf(out, "MOV BP, SP\n");
+            int frame = frameSlot(cc, i, FRAME_RESULT);
+            if (frame) outPrintf(out, "SUB SP, %d\n", frame);
+            continue;
+        }
+        addressOperands(cc, i, &names, operands);
+        const char *result = operands[FRAME_RESULT], *arg1 = operands[FRAME_ARG1], *arg2 = operands[FRAME_ARG2];
+
+        if (strcmp(cc->code[i].op, "ENDFUNC") == 0) {
+            // A function ending in a return has just left already
+            if (i > 0 && strcmp(cc->code[i - 1].result, "RET") == 0) continue;
+            outPrintf(out, "MOV SP, BP\n");
+            outPrintf(out, "POP BP\n");
+            outPrintf(out, "RET\n");
+        }
+        else if (strcmp(cc->code[i].op, "LABEL") == 0) {
+            outPrintf(out, "%s:\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "ARG") == 0) {
+            // Arguments sit above the saved BP and the return address
+            outPrintf(out, "LOAD [BP+%d]\n", (atoi(arg1) + 2) * WORD_SIZE);
+            outPrintf(out, "STORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "PARAM") == 0) {
+            // The run is pushed last to first, leaving argument k at
+            // [BP+(k+2)*4] where the callee's ARG k reads it
+            int end = i;
+            while (end + 1 < cc->codeIndex && strcmp(cc->code[end + 1].op, "PARAM") == 0) end++;
+            for (int k = end; k >= i; k--) {
+                addressOperands(cc, k, &names, operands);
+                outPrintf(out, "PUSH %s\n", operands[FRAME_ARG1]);
+            }
+            i = end;
+        }
+        else if (strcmp(cc->code[i].op, "CALL") == 0) {
+            outPrintf(out, "CALL %s\n", arg1);
+            if (atoi(arg2) > 0) {
+                outPrintf(out, "ADD SP, %d\n", atoi(arg2) * WORD_SIZE);
+            }
+            outPrintf(out, "STORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "iffalse") == 0) {
+            outPrintf(out, "LOAD %s\n", arg1);
+            outPrintf(out, "JZ %s\n", arg2);
         } 
-        else if (strcmp(code[i].op, "goto") == 0) {
-            printf("JMP %s\n", code[i].arg2);
+        else if (strcmp(cc->code[i].op, "goto") == 0) {
+            outPrintf(out, "JMP %s\n", arg2);
         }
-        else if (strcmp(code[i].op, "=") == 0 && strlen(code[i].arg2) == 0) {
-            if (is_number(code[i].arg1)) {
-                printf("MOV %s, %s\n", code[i].result, code[i].arg1);
-            } else {
-                printf("LOAD %s\n", code[i].arg1);
-                printf("STORE %s\n", code[i].result);
+        else if (strcmp(cc->code[i].op, "ARRAY") == 0) {
+            // The elements are in the frame; the name holds their address
+            outPrintf(out, "LOAD BP\n");
+            outPrintf(out, "SUB %d\n", frameSlot(cc, i, FRAME_ARG1));
+            outPrintf(out, "STORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "[]") == 0) {
+            outPrintf(out, "LOAD [%s+%s*%d]\n", arg1, arg2, WORD_SIZE);
+            outPrintf(out, "STORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "[]=") == 0) {
+            outPrintf(out, "LOAD %s\n", arg2);
+            outPrintf(out, "STORE [%s+%s*%d]\n", result, arg1, WORD_SIZE);
+        }
+        else if (strcmp(cc->code[i].op, "V[]") == 0) {
+            outPrintf(out, "VLOAD [%s+%s*%d]\n", arg1, arg2, WORD_SIZE);
+            outPrintf(out, "VSTORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "V[]=") == 0) {
+            outPrintf(out, "VLOAD %s\n", arg2);
+            outPrintf(out, "VSTORE [%s+%s*%d]\n", result, arg1, WORD_SIZE);
+        }
+        else if (strcmp(cc->code[i].op, "VSPLAT") == 0 || strcmp(cc->code[i].op, "VSTEP") == 0) {
+            // The scalar in the accumulator, broadcast or counted up across the lanes
+            outPrintf(out, "LOAD %s\n", arg1);
+            outPrintf(out, "%s\n", cc->code[i].op);
+            outPrintf(out, "VSTORE %s\n", result);
+        }
+        else if (cc->code[i].op[0] == 'V') {
+            outPrintf(out, "VLOAD %s\n", arg1);
+            outPrintf(out, "%s %s\n", machineOp(cc->code[i].op), arg2);
+            outPrintf(out, "VSTORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "DIST") == 0) {
+            outPrintf(out, "LOAD %s\n", arg1);
+            outPrintf(out, "SUB %s\n", arg2);
+            outPrintf(out, "SAR 2\n");     // bytes to WORD_SIZE elements
+            outPrintf(out, "STORE %s\n", result);
+        }
+        else if (strcmp(cc->code[i].op, "=") == 0 && strlen(arg2) == 0) {
+            if (is_number(cc->code[i].arg1) || is_float(cc->code[i].arg1)) {
+                outPrintf(out, "MOV %s, %s\n", result, arg1);
+            } else if (!frameSlot(cc, i, FRAME_RESULT) || frameSlot(cc, i, FRAME_RESULT) != frameSlot(cc, i, FRAME_ARG1)) {
+                // A copy the frame layout put in its source's slot has nothing to move
+                outPrintf(out, "LOAD %s\n", arg1);
+                outPrintf(out, "STORE %s\n", result);
             }
         } 
-        else if (strcmp(code[i].result, "RET") == 0) {
-            printf("LOAD %s\n", code[i].arg1);
-            printf("RET\n");
+        else if (strcmp(result, "RET") == 0) {
+            if (strlen(arg1)) outPrintf(out, "LOAD %s\n", arg1);
+            outPrintf(out, "MOV SP, BP\n");
+            outPrintf(out, "POP BP\n");
+            outPrintf(out, "RET\n");
         }
         else {
-            printf("LOAD %s\n", code[i].arg1);
-            if (strlen(code[i].op) > 0) {
-                printf("%s %s\n", 
-                    strcmp(code[i].op, "+") == 0 ? "ADD" :
-                    strcmp(code[i].op, "-") == 0 ? "SUB" :
-                    strcmp(code[i].op, "*") == 0 ? "MUL" : "DIV",
-                    code[i].arg2);
+            outPrintf(out, "LOAD %s\n", arg1);
+            if (strlen(arg2) > 0) {
+                outPrintf(out, "%s %s\n", machineOp(cc->code[i].op), arg2);
+            } else if (strlen(cc->code[i].op) > 0) {
+                outPrintf(out, "%s\n", machineOp(cc->code[i].op));
             }
-            printf("STORE %s\n", code[i].result);
+            outPrintf(out, "STORE %s\n", result);
         }
     }
-    
-    printf("MOV SP, BP\n");
-    printf("POP BP\n");
-    printf("================================\n");
+    free(names.text);
+}
+
+// Emits one function, without following node->next
+void generateFunction(Compiler* cc, ASTNode* node) {
+    emit(cc, node->name, "", "FUNC", "");
+    int argIndex = 0;
+    for (ASTNode* p = node->condition; p; p = p->next) {
+        char index[12];
+        sprintf(index, "%d", argIndex++);
+        emit(cc, p->condition->name, index, "ARG", "");
+    }
+    generateCode(cc, node->body);
+    emit(cc, node->name, "", "ENDFUNC", "");
 }
 
-char* generateCode(ASTNode* node) {
+char* generateCode(Compiler* cc, ASTNode* node) {
     if (!node) return NULL;
 
     char* temp1, *temp2, *temp3, *label1, *label2;
+    int argIndex;
 
     switch (node->type) {
         case AST_FUNCTION:
-            emit(node->name, "", "FUNC", "");
-            generateCode(node->body);
+            generateFunction(cc, node);
             break;
 
         case AST_BLOCK:
-            generateCode(node->body);
+            generateCode(cc, node->body);
             break;
 
         case AST_IF:
-            label1 = newLabel();
-            label2 = newLabel();
-            temp1 = generateCode(node->condition);
-            emit("", temp1, "if", label1);
-            generateCode(node->body);
-            emit("", "", "goto", label2);
-            emit(label1, "", "LABEL", "");
+            label1 = newLabel(cc);
+            label2 = newLabel(cc);
+            temp1 = generateCode(cc, node->condition);
+            emit(cc, "", temp1, "iffalse", label1);
+            generateCode(cc, node->body);
+            emit(cc, "", "", "goto", label2);
+            emit(cc, label1, "", "LABEL", "");
             if (node->elseBody) {
-                generateCode(node->elseBody);
+                generateCode(cc, node->elseBody);
             }
-            emit(label2, "", "LABEL", "");
+            emit(cc, label2, "", "LABEL", "");
             break;
 
         case AST_WHILE:
-            label1 = newLabel();
-            label2 = newLabel();
-            emit(label1, "", "LABEL", "");
-            temp1 = generateCode(node->condition);
-            emit("", temp1, "if", label2);
-            generateCode(node->body);
-            emit("", "", "goto", label1);
-            emit(label2, "", "LABEL", "");
+            label1 = newLabel(cc);
+            label2 = newLabel(cc);
+            emit(cc, label1, "", "LABEL", "");
+            temp1 = generateCode(cc, node->condition);
+            emit(cc, "", temp1, "iffalse", label2);
+            generateCode(cc, node->body);
+            emit(cc, "", "", "goto", label1);
+            emit(cc, label2, "", "LABEL", "");
             break;
 
         case AST_EXPRESSION:
-            if (strcmp(node->name, "=") == 0) {
-                temp1 = generateCode(node->body);
-                emit(node->condition->name, temp1, "=", "");
-            } 
-            else if (strcmp(node->name, "declare") == 0) {
-                if (node->body) {
-                    temp1 = generateCode(node->body);
-                    emit(node->condition->name, temp1, "=", "");
-                }
+            if (strcmp(node->name, "=") == 0 && strcmp(node->condition->name, "[]") == 0) {
+                temp1 = generateCode(cc, node->condition->body);
+                temp2 = generateCode(cc, node->body);
+                emit(cc, node->condition->condition->name, temp1, "[]=", temp2);
             }
+            else if (strcmp(node->name, "=") == 0) {
+                temp1 = generateCode(cc, node->body);
+                emit(cc, node->condition->name, temp1, "=", "");
+            } 
             else if (strcmp(node->name, "return") == 0) {
-                temp1 = generateCode(node->body);
-                emit("RET", temp1, "RET", "");
+                temp1 = generateCode(cc, node->body);
+                emit(cc, "RET", temp1 ? temp1 : "", "RET", "");
+            }
+            else if (strcmp(node->name, "[]") == 0) {
+                temp1 = generateCode(cc, node->body);
+                temp2 = newTemp(cc);
+                emit(cc, temp2, node->condition->name, "[]", temp1);
+                return temp2;
             }
             else if (node->condition && node->body) {
-                // Binary operation
-                temp1 = generateCode(node->condition);
-                temp2 = generateCode(node->body);
-                temp3 = newTemp();
-                emit(temp3, temp1, node->name, temp2);
+                // Binary operation, typed by its operands
+                char op[MAX_LEN];
+                if (snprintf(op, sizeof op, "%s%s", node->condition->dataType == TYPE_FLOAT ? "f" : "",
+                             node->name) >= (int)sizeof op)
+                    compileError(cc, "Error: Operator %s is too long", node->name);
+                temp1 = generateCode(cc, node->condition);
+                temp2 = generateCode(cc, node->body);
+                temp3 = newTemp(cc);
+                emit(cc, temp3, temp1, op, temp2);
                 return temp3;
             }
+            else if (node->condition) {
+                // Conversion: itof or ftoi
+                temp1 = generateCode(cc, node->condition);
+                temp2 = newTemp(cc);
+                emit(cc, temp2, temp1, node->name, "");
+                return temp2;
+            }
             else {
                 // Variable or constant
                 return node->name;
             }
             break;
 
+        case AST_DECLARE:
+            if (node->condition->arraySize) {
+                char index[12];
+                sprintf(index, "%d", node->condition->arraySize);
+                emit(cc, node->condition->name, index, "ARRAY", "");
+                argIndex = 0;
+                for (ASTNode* value = node->body; value; value = value->next) {
+                    temp1 = generateCode(cc, value);
+                    sprintf(index, "%d", argIndex++);
+                    emit(cc, node->condition->name, index, "[]=", temp1);
+                }
+            }
+            else if (node->body) {
+                temp1 = generateCode(cc, node->body);
+                emit(cc, node->condition->name, temp1, "=", "");
+            }
+            break;
+
+        case AST_CALL: {
+            // Evaluate every argument before the PARAM run so nested
+            // calls never interleave with this call's parameters
+            char* args[MAX_ARGS];
+            argIndex = 0;
+            for (ASTNode* arg = node->body; arg; arg = arg->next) {
+                if (argIndex >= MAX_ARGS) {
+                    compileError(cc, "Error: Too many arguments in call to %s", node->condition->name);
+                }
+                args[argIndex++] = generateCode(cc, arg);
+            }
+            for (int i = 0; i < argIndex; i++) {
+                emit(cc, "", args[i], "PARAM", "");
+            }
+            char count[12];
+            sprintf(count, "%d", argIndex);
+            temp1 = newTemp(cc);
+            emit(cc, temp1, node->condition->name, "CALL", count);
+            return temp1;
+        }
+
+        case AST_STATEMENT:
+            generateCode(cc, node->body);
+            break;
+
         default:
-            if (node->next) generateCode(node->next);
             break;
     }
 
-    if (node->next) generateCode(node->next);
+    if (node->next) generateCode(cc, node->next);
     return NULL;
 }
-void printCode(const char* label) {
-    printf("\n--- %s ---\n", label);
-    for (int i = 0; i < codeIndex; i++) {
-        if (strlen(code[i].op)) {
-            if (strlen(code[i].arg2)) {
-                printf("%s = %s %s %s\n", code[i].result, code[i].arg1, code[i].op, code[i].arg2);
+void printCode(Compiler* cc, const char* label) {
+    outPrintf(&cc->dumpOutput, "\n--- %s ---\n", label);
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strlen(cc->code[i].op)) {
+            if (strlen(cc->code[i].arg2)) {
+                outPrintf(&cc->dumpOutput, "%s = %s %s %s\n", cc->code[i].result, cc->code[i].arg1, cc->code[i].op, cc->code[i].arg2);
             } else {
-                printf("%s = %s %s\n", code[i].result, code[i].arg1, code[i].op);
+                outPrintf(&cc->dumpOutput, "%s = %s %s\n", cc->code[i].result, cc->code[i].arg1, cc->code[i].op);
             }
         } else {
-            printf("%s = %s\n", code[i].result, code[i].arg1);
+            outPrintf(&cc->dumpOutput, "%s = %s\n", cc->code[i].result, cc->code[i].arg1);
         }
     }
-    printf("----------------------\n");
+    outPrintf(&cc->dumpOutput, "----------------------\n");
 }
 
@@ -3,9 +3,34 @@
 #define CODEGEN_H
 
 #include "parser.h"
+#include "output.h"
 
-#define MAX_CODE 1000
+#define INITIAL_CODE 1024
 #define MAX_LEN 100
+#define MAX_ARGS 16
+#define WORD_SIZE 4
+#define NAME_BLOCK_SIZE 4096
+#define VECTOR_WIDTH 4      // words per vector value: one 128-bit register
+
+// Call convention: callers emit one PARAM per argument (left to right)
+// followed by "t = CALL f, n"; callees bind them with "x = ARG i".
+// Each function body is bracketed by FUNC and ENDFUNC quads.
+// Operators on floats carry an "f" prefix ("f+", "f<"); "itof" and "ftoi"
+// convert arg1. Comparisons yield an int either way.
+//
+// Arrays are words in memory and an array variable holds the address of
+// its first element, so passing one passes its address:
+//   a = ARRAY n        reserve n words for a
+//   t = a [] i         load element i
+//   a = i []= v        store v into element i (reads a; defines nothing)
+//   t = a DIST b       elements from b's first element to a's
+//
+// The vectorizer's operators work on VECTOR_WIDTH consecutive elements:
+//   v = a V[] i        load elements i .. i+VECTOR_WIDTH-1
+//   a = i V[]= v       store them (reads a and v)
+//   v = x VSPLAT       every lane set to the scalar x
+//   v = x VSTEP        lanes x, x+1, x+2, ...
+//   v = x V+ y         lane-wise "+", likewise V- V* V& V<< V>> Vf+ Vf- Vf* Vf/
 
 typedef struct {
     char result[MAX_LEN];
@@ -14,19 +39,28 @@ typedef struct {
     char arg2[MAX_LEN];
 } Quadruple;
 
-extern Quadruple code[MAX_CODE];
-extern int codeIndex;
-extern int tempCount;
-extern int labelCount;
-
-void emit(const char* result, const char* arg1, const char* op, const char* arg2);
-char* newTemp();
-char* newLabel();
-char* generateCode(ASTNode* node);
-void optimize();
-void generateFinalCode();
-void printIntermediateCode(const char* phase);
+// Temp and label names live until the compilation is freed
+typedef struct NameBlock {
+    struct NameBlock *next;
+    size_t used;
+    char data[NAME_BLOCK_SIZE];
+} NameBlock;
+
+void setQuad(Quadruple* q, const char* result, const char* arg1, const char* op, const char* arg2);
+void emit(Compiler* cc, const char* result, const char* arg1, const char* op, const char* arg2);
+char* newTemp(Compiler* cc);
+char* newLabel(Compiler* cc);
+void freeNames(Compiler* cc);
+void generateFunction(Compiler* cc, ASTNode* node);
+char* generateCode(Compiler* cc, ASTNode* node);
+int foldConstants(Compiler* cc);
+void generateFinalCode(Compiler* cc, Output* out);
+void printIntermediateCode(Compiler* cc, const char* phase);
 int is_number(char* str);
+int is_float(char* str);
+void formatFloat(char* dest, float value);
+int floatFitsInt(float value);
+int can_fold(int a, int b, const char* op);
 int eval_const(int a, int b, char* op);
 
 #endif
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "compiler.h"
+#include "pool.h"
+#include "interp.h"
+
+void initCompiler(Compiler *cc, const CompileOptions *options, const char *source) {
+    memset(cc, 0, sizeof(*cc));
+    cc->options = options;
+    cc->source = source;
+    cc->asmOutput = &cc->dumpOutput;
+}
+
+// A unit shares its parent's options, source and AST; its outputs are in
+// memory and copied into the parent's in unit order
+void initUnit(Compiler *unit, Compiler *parent, int index, ASTNode *function) {
+    initCompiler(unit, parent->options, parent->source);
+    unit->parent = parent;
+    unit->unitIndex = index;
+    unit->function = function;
+    unit->asmOutput = &unit->asmFile;
+}
+
+// Releases every table; outputs are closed too, so the driver copies out
+// any in-memory text first
+void freeCompiler(Compiler *cc) {
+    stopLexer(cc);
+    closePreprocessor(cc);
+    free(cc->tokenTable);
+    freeAST(cc->ast);
+    free(cc->symbolTable);
+    free(cc->functionTable);
+    free(cc->functionBuckets);
+    free(cc->code);
+    freeNames(cc);
+    free(cc->inlineOut);
+    free(cc->renames);
+    free(cc->vectorOut);
+    free(cc->frameSlots);
+    freeArtifactWriter(cc);
+    freePassState(cc);
+    for (int u = 0; u < cc->unitCount; u++) freeCompiler(&cc->units[u]);
+    free(cc->units);
+    free(cc->callees);
+    free(cc->calleeCode);
+    free(cc->functionHashes);
+    free(cc->cachedCode);
+    closeOutput(&cc->cacheEntry);
+
+    if (cc->asmOutput != &cc->dumpOutput) closeOutput(cc->asmOutput);
+    closeOutput(&cc->dumpOutput);
+    closeOutput(&cc->diagnostics);
+
+    cc->tokenTable = NULL;
+    cc->ast = NULL;
+    cc->symbolTable = NULL;
+    cc->functionTable = NULL;
+    cc->functionBuckets = NULL;
+    cc->code = NULL;
+    cc->inlineOut = NULL;
+    cc->renames = NULL;
+    cc->vectorOut = NULL;
+    cc->frameSlots = NULL;
+    cc->units = NULL;
+    cc->unitCount = 0;
+    cc->callees = NULL;
+    cc->calleeCode = NULL;
+    cc->functionHashes = NULL;
+    cc->cachedCode = NULL;
+}
+
+static void diagnostic(Compiler *cc, const char *fmt, va_list args) {
+    outPrintf(&cc->diagnostics, "%s: ", cc->source);
+    outVprintf(&cc->diagnostics, fmt, args);
+    outPrintf(&cc->diagnostics, "\n");
+}
+
+void compileError(Compiler *cc, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    diagnostic(cc, fmt, args);
+    va_end(args);
+    cc->failed = 1;
+    longjmp(cc->onError, 1);
+}
+
+void compileWarning(Compiler *cc, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    diagnostic(cc, fmt, args);
+    va_end(args);
+}
+
+// One unit per top-level function, in source order
+static void splitUnits(Compiler *cc) {
+    int count = 0;
+    for (ASTNode *node = cc->ast; node; node = node->next) {
+        if (node->type == AST_FUNCTION) count++;
+    }
+    cc->units = (Compiler*)xcalloc(count ? count : 1, sizeof(Compiler));
+    for (ASTNode *node = cc->ast; node; node = node->next) {
+        if (node->type == AST_FUNCTION) {
+            initUnit(&cc->units[cc->unitCount], cc, cc->unitCount, node);
+            cc->unitCount++;
+        }
+    }
+}
+
+static void generateUnit(void *context, int index) {
+    Compiler *unit = &((Compiler*)context)->units[index];
+    if (setjmp(unit->onError)) return;
+    phaseBegin(&unit->stats, PHASE_CODEGEN);
+    if (!unit->options->cacheDir || !loadCachedUnit(unit)) {
+        generateFunction(unit, unit->function);
+        if (unit->options->cacheDir) saveInitialCode(unit);
+    }
+    phaseEnd(&unit->stats, PHASE_CODEGEN);
+}
+
+static void optimizeUnit(void *context, int index) {
+    Compiler *unit = &((Compiler*)context)->units[index];
+    if (setjmp(unit->onError)) return;
+    phaseBegin(&unit->stats, PHASE_OPTIMIZE);
+    if (unit->cacheHit) useCachedCode(unit);
+    else optimize(unit);
+    phaseEnd(&unit->stats, PHASE_OPTIMIZE);
+}
+
+static void layoutUnit(void *context, int index) {
+    Compiler *unit = &((Compiler*)context)->units[index];
+    if (setjmp(unit->onError)) return;
+    phaseBegin(&unit->stats, PHASE_FRAME);
+    layoutFrames(unit);
+    phaseEnd(&unit->stats, PHASE_FRAME);
+}
+
+static void emitUnit(void *context, int index) {
+    Compiler *unit = &((Compiler*)context)->units[index];
+    if (setjmp(unit->onError)) return;
+    phaseBegin(&unit->stats, PHASE_FINAL);
+    if (unit->cacheHit && unit->cacheEntry.length) {
+        outWrite(unit->asmOutput, unit->cacheEntry.data, unit->cacheEntry.length);
+    } else {
+        generateFinalCode(unit, unit->asmOutput);
+    }
+    if (unit->options->cacheDir && !unit->cacheHit) storeCachedUnit(unit);
+    phaseEnd(&unit->stats, PHASE_FINAL);
+}
+
+// Runs task over every unit on options->functionJobs threads, then copies
+// the units' listings and diagnostics out in unit order. A failed unit
+// fails the whole compilation once its earlier siblings have reported.
+static void runUnits(Compiler *cc, Phase phase, PoolTask task) {
+    Pool pool;
+    phaseBegin(&cc->stats, phase);
+    startPool(&pool, cc->unitCount, cc->options->functionJobs, task, cc);
+    finishPool(&pool);
+    phaseEnd(&cc->stats, phase);
+
+    int failed = 0;
+    for (int u = 0; u < cc->unitCount; u++) {
+        Compiler *unit = &cc->units[u];
+        outWrite(&cc->dumpOutput, unit->dumpOutput.data, unit->dumpOutput.length);
+        outWrite(&cc->diagnostics, unit->diagnostics.data, unit->diagnostics.length);
+        unit->dumpOutput.length = unit->diagnostics.length = 0;
+        if (pool.workerCount) addPhaseWork(&cc->stats, &unit->stats, phase);
+        failed |= unit->failed;
+    }
+    if (failed) {
+        cc->failed = 1;
+        longjmp(cc->onError, 1);
+    }
+}
+
+static void writeUnitAsm(Compiler *cc, Output *out) {
+    for (int u = 0; u < cc->unitCount; u++) {
+        outWrite(out, cc->units[u].asmOutput->data, cc->units[u].asmOutput->length);
+    }
+}
+
+// Pass statistics add up over units; iterations is the most any took
+static void addPassStats(Compiler *cc) {
+    for (int u = 0; u < cc->unitCount; u++) {
+        Compiler *unit = &cc->units[u];
+        for (int i = 0; i < MAX_PASSES; i++) {
+            cc->passStats[i].runs += unit->passStats[i].runs;
+            cc->passStats[i].seconds += unit->passStats[i].seconds;
+            cc->passStats[i].removed += unit->passStats[i].removed;
+            cc->passStats[i].changed += unit->passStats[i].changed;
+        }
+        if (unit->iterations > cc->iterations) cc->iterations = unit->iterations;
+    }
+}
+
+// Generates TAC for every unit and optimizes it, adding the quad counts
+// before and after optimization to quads and optimized
+static void compileUnits(Compiler *cc, long *quads, long *optimized) {
+    int dumpFlags = cc->options->dumpFlags;
+
+    runUnits(cc, PHASE_CODEGEN, generateUnit);
+    for (int u = 0; u < cc->unitCount; u++) {
+        *quads += cc->units[u].codeIndex;
+        if (cc->options->cacheDir) {
+            addCounter(&cc->stats, cc->units[u].cacheHit ? COUNTER_CACHE_HITS : COUNTER_CACHE_MISSES, 1);
+        }
+    }
+    if (dumpFlags & DUMP_TAC) printIntermediateCode(cc, "Initial");
+
+    // Run the selected pass pipeline over the TAC; the inliner reads
+    // callees from the unchanged initial code of the other units
+    if (cc->options->streaming) keepCallees(cc, &cc->units[0]);
+    else collectCallees(cc);
+    if (dumpFlags & DUMP_PASSES) outPrintf(&cc->dumpOutput, "\nPerforming optimization...\n");
+    runUnits(cc, PHASE_OPTIMIZE, optimizeUnit);
+    for (int u = 0; u < cc->unitCount; u++) *optimized += cc->units[u].codeIndex;
+    addPassStats(cc);
+    if (dumpFlags & DUMP_TAC) printIntermediateCode(cc, "Optimized");
+}
+
+// Lays out every unit's frames and generates final assembly
+static void emitUnits(Compiler *cc) {
+    runUnits(cc, PHASE_FRAME, layoutUnit);
+    for (int u = 0; u < cc->unitCount; u++) {
+        addCounter(&cc->stats, COUNTER_FRAME_BYTES, cc->units[u].frameBytes);
+        addCounter(&cc->stats, COUNTER_FRAME_UNSHARED, cc->units[u].unsharedFrameBytes);
+    }
+    runUnits(cc, PHASE_FINAL, emitUnit);
+    if (cc->options->dumpFlags & DUMP_ASM) {
+        outPrintf(&cc->dumpOutput, "\n=== Final Assembly Code ===\n");
+        writeUnitAsm(cc, &cc->dumpOutput);
+        outPrintf(&cc->dumpOutput, "================================\n");
+    }
+    writeUnitAsm(cc, cc->asmOutput);
+}
+
+static void countUnitNames(Compiler *cc, long *temps, long *labels) {
+    for (int u = 0; u < cc->unitCount; u++) {
+        *temps += cc->units[u].tempCount;
+        *labels += cc->units[u].labelCount;
+    }
+}
+
+// Runs the stages after reached, which lexing or an artifact completed,
+// up to -stop-after
+static void compileFile(Compiler *cc, Stage reached) {
+    int dumpFlags = cc->options->dumpFlags;
+    long quads = 0, optimized = 0, temps = 0, labels = 0;
+
+    if (reached < STAGE_PARSE) {
+        phaseBegin(&cc->stats, PHASE_PARSE);
+        cc->currentTokenIndex = 0;
+        cc->ast = parseProgram(cc);
+        phaseEnd(&cc->stats, PHASE_PARSE);
+        stopLexer(cc);
+        setCounter(&cc->stats, COUNTER_TOKENS, cc->tokenCount);
+    }
+
+    if (reached < STAGE_OPTIMIZE) {
+        if (dumpFlags & DUMP_AST) {
+            outPrintf(&cc->dumpOutput, "\n=== Parsed AST ===\n");
+            printAST(cc, cc->ast, 0);
+        }
+        if (endStage(cc, STAGE_PARSE)) return;
+
+        if (!cc->options->fusedFrontend) {
+            phaseBegin(&cc->stats, PHASE_SEMANTIC);
+            analyzeAST(cc, cc->ast);     // Run semantic checks
+            phaseEnd(&cc->stats, PHASE_SEMANTIC);
+        }
+        if (dumpFlags & DUMP_AST) outPrintf(&cc->dumpOutput, "Semantic analysis successful.\n");
+
+        // From here on each function is generated, optimized and emitted in a
+        // unit of its own
+        splitUnits(cc);
+        compileUnits(cc, &quads, &optimized);
+        if (dumpFlags & DUMP_PASSES) printPassReport(cc);
+    } else {
+        for (int u = 0; u < cc->unitCount; u++) optimized += cc->units[u].codeIndex;
+        if (dumpFlags & DUMP_TAC) printIntermediateCode(cc, "Optimized");
+    }
+    if (endStage(cc, STAGE_OPTIMIZE)) return;
+
+    emitUnits(cc);
+    if (cc->options->run) runProgram(cc);
+    countUnitNames(cc, &temps, &labels);
+
+    setCounter(&cc->stats, COUNTER_QUADS_INITIAL, quads);
+    setCounter(&cc->stats, COUNTER_QUADS, optimized);
+    setCounter(&cc->stats, COUNTER_TEMPS, temps);
+    setCounter(&cc->stats, COUNTER_LABELS, labels);
+}
+
+// Takes the file one top-level function at a time, parsing, analyzing,
+// generating, optimizing and emitting it and then freeing its AST and
+// code before reading on. With the token ring, memory follows the largest
+// function rather than the file. Only functions defined earlier in the
+// file can be inlined, and the listings come function by function.
+static void compileStreaming(Compiler *cc) {
+    int dumpFlags = cc->options->dumpFlags;
+    long quads = 0, optimized = 0, temps = 0, labels = 0;
+    int index = 0;
+
+    cc->units = (Compiler*)xcalloc(1, sizeof(Compiler));
+    cc->currentTokenIndex = 0;
+    while (1) {
+        phaseBegin(&cc->stats, PHASE_PARSE);
+        ASTNode *node = cc->ast = parseTopLevel(cc);
+        phaseEnd(&cc->stats, PHASE_PARSE);
+        if (!node) break;
+
+        if (dumpFlags & DUMP_AST) {
+            outPrintf(&cc->dumpOutput, "\n=== Parsed AST ===\n");
+            printAST(cc, node, 0);
+        }
+
+        if (!cc->options->fusedFrontend) {
+            phaseBegin(&cc->stats, PHASE_SEMANTIC);
+            analyzeAST(cc, node);
+            phaseEnd(&cc->stats, PHASE_SEMANTIC);
+        }
+
+        if (node->type == AST_FUNCTION) {
+            initUnit(&cc->units[0], cc, index++, node);
+            cc->unitCount = 1;
+            compileUnits(cc, &quads, &optimized);
+            emitUnits(cc);
+            countUnitNames(cc, &temps, &labels);
+            freeCompiler(&cc->units[0]);
+            cc->unitCount = 0;
+        }
+        freeAST(node);
+        cc->ast = NULL;
+    }
+    stopLexer(cc);
+    setCounter(&cc->stats, COUNTER_TOKENS, cc->tokenCount);
+
+    if (dumpFlags & DUMP_AST) outPrintf(&cc->dumpOutput, "Semantic analysis successful.\n");
+    if (dumpFlags & DUMP_PASSES) printPassReport(cc);
+
+    setCounter(&cc->stats, COUNTER_QUADS_INITIAL, quads);
+    setCounter(&cc->stats, COUNTER_QUADS, optimized);
+    setCounter(&cc->stats, COUNTER_TEMPS, temps);
+    setCounter(&cc->stats, COUNTER_LABELS, labels);
+}
+
+// Runs every phase over cc->source, or those after the stage an artifact
+// was saved at; returns 0 after a compile error
+int compile(Compiler *cc) {
+    const CompileOptions *options = cc->options;
+    int dumpFlags = options->dumpFlags;
+    // Both are assigned after setjmp, so they must not live in registers
+    volatile Stage reached = STAGE_NONE;
+    volatile int stop = 0;
+    if (setjmp(cc->onError)) {
+        stopLexer(cc);
+        return 0;
+    }
+
+    // Listing, exporting or saving the tokens needs the whole table, so
+    // those lex up front even when the lexer could be pipelined
+    int pipelined = (options->pipelineLexer || options->streaming) &&
+                    !(dumpFlags & DUMP_TOKENS) && !options->tokenExport && !options->artifactPath;
+    if (options->resumePath) {
+        phaseBegin(&cc->stats, PHASE_LOAD);
+        reached = loadArtifact(cc);
+        phaseEnd(&cc->stats, PHASE_LOAD);
+        if (options->stopAfter != STAGE_NONE && options->stopAfter <= (int)reached) {
+            compileError(cc, "Artifact was saved after %s; nothing to do with -stop-after=%s",
+                         stageName(reached), stageName((Stage)options->stopAfter));
+        }
+    } else if (pipelined) {
+        startLexer(cc);
+    } else {
+        phaseBegin(&cc->stats, PHASE_LEX);
+        runLexer(cc);  // Tokenize source file
+        phaseEnd(&cc->stats, PHASE_LEX);
+        reached = STAGE_LEX;
+    }
+    if (reached == STAGE_LEX) {
+        if (dumpFlags & DUMP_TOKENS) printTokenTable(cc);
+        if (options->tokenExport) exportTokenTable(cc, options->tokenExport);
+        stop = endStage(cc, STAGE_LEX);
+    }
+
+    if (stop) setCounter(&cc->stats, COUNTER_TOKENS, cc->tokenCount);
+    else if (options->streaming) compileStreaming(cc);
+    else compileFile(cc, reached);
+    if (options->artifactPath) writeArtifact(cc);
+    flushOutput(cc->asmOutput);
+    return 1;
+}
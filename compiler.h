@@ -0,0 +1,165 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <setjmp.h>
+#include "lexer.h"
+#include "parser.h"
+#include "semantic.h"
+#include "codegen.h"
+#include "inline.h"
+#include "vectorize.h"
+#include "frame.h"
+#include "passes.h"
+#include "stats.h"
+#include "output.h"
+#include "tokenring.h"
+#include "cache.h"
+#include "preprocess.h"
+#include "artifact.h"
+
+// Command-line settings, shared read-only by every compilation of a run
+struct CompileOptions {
+    int optLevel;
+    int passEnabled[MAX_PASSES];
+    int dumpFlags;
+    const char *tokenExport;        // token table file, or NULL
+    int functionJobs;               // threads per file for per-function work
+    int pipelineLexer;              // lex on a thread feeding the parser
+    int streaming;                  // compile and free one function at a time
+    int fusedFrontend;              // the parser runs the semantic checks
+    int run;                        // interpret main() after compiling
+    int stopAfter;                  // Stage to end the compilation at, or STAGE_NONE
+    const char *artifactPath;       // where to save every stage run, or NULL
+    const char *resumePath;         // artifact to start from instead of the source
+    const char *cacheDir;           // per-function cache, or NULL
+    const char **includeDirs;       // -I, searched in order
+    int includeDirCount;
+    const char **defines;           // -D name[=value]
+    int defineCount;
+};
+
+// Everything one compilation reads and writes. Each phase takes it as its
+// first argument, so any number of files can be compiled in one process,
+// one after another or concurrently.
+//
+// From code generation on, every top-level function is compiled in a unit
+// of its own: a child Compiler with a private IR buffer and private temp
+// and label numbering, so units can run on separate threads and still
+// produce the same output in any order.
+struct Compiler {
+    const CompileOptions *options;
+    const char *source;
+
+    // Function units; set on the file's Compiler
+    Compiler *units;
+    int unitCount;
+    FunctionRange *callees;         // initial TAC of every unit, by name
+    int calleeCount;
+    Quadruple *calleeCode;          // streaming: copies of inlinable callees
+    int calleeCodeCount;
+    int calleeCodeCapacity;
+
+    // Set on a unit
+    Compiler *parent;
+    int unitIndex;
+    ASTNode *function;
+
+    // Lexer; with a token ring the table stays empty
+    Preprocessor *preprocessor;     // while the source is being read
+    Token *tokenTable;
+    int tokenCount;
+    int tokenCapacity;
+    TokenRing *tokenRing;
+
+    // Parser
+    int currentTokenIndex;
+    ASTNode *ast;
+    unsigned long long tokenHash;           // tokens of the function being parsed
+    unsigned long long *functionHashes;     // one per function, in file order
+    int functionHashCount;
+    int functionHashCapacity;
+
+    // Semantic analysis
+    Symbol *symbolTable;
+    int symbolCount;
+    int symbolCapacity;
+    int currentScopeDepth;
+    FunctionInfo *functionTable;
+    int functionCount;
+    int functionCapacity;
+    int *functionBuckets;
+
+    // Intermediate code
+    Quadruple *code;
+    int codeIndex;
+    int codeCapacity;
+    int tempCount;
+    int labelCount;
+    NameBlock *names;
+
+    // Inliner
+    Quadruple *inlineOut;
+    int inlineOutIndex;
+    int inlineOutCapacity;
+    Rename *renames;
+    int renameCount;
+    int inlineCount;
+
+    // Vectorizer; the code it replaces stays here, as the initial buffer
+    // may be one other units inline from
+    Quadruple *vectorOut;
+    int vectorOutIndex;
+    int vectorOutCapacity;
+
+    // Pass manager
+    PassStats passStats[MAX_PASSES];
+    int iterations;
+    unsigned validAnalyses;
+    int *blockLeader;
+    int *functionOf;
+    char *dead;
+    int analysisCapacity;
+    unsigned nameBuckets;
+    NameEntry **useTable;
+    NameEntry **bindTable;
+    NameEntry **labelTable;
+
+    // Frame layout: FRAME_FIELDS slots per quad, read with frameSlot()
+    int *frameSlots;
+    long frameBytes;            // every function's frame, with shared slots
+    long unsharedFrameBytes;    // with a slot per name
+
+    // Function cache, on a unit
+    unsigned long long cacheKey;
+    int cacheHit;
+    Quadruple *cachedCode;      // optimized TAC of a hit
+    int cachedCount;
+    int cacheInitialCount;
+    Output cacheEntry;          // a hit's assembly, or a miss's entry so far
+
+    // -save-artifact: the stages completed so far
+    ArtifactWriter *artifact;
+
+    // Outputs, opened by the driver
+    Output dumpOutput;          // listings selected by -dump-*
+    Output asmFile;             // assembly, unless it shares dumpOutput
+    Output *asmOutput;
+    Output diagnostics;         // errors and warnings
+
+    CompileStats stats;
+
+    // Errors unwind to compile() instead of ending the process
+    jmp_buf onError;
+    int failed;
+};
+
+void initCompiler(Compiler *cc, const CompileOptions *options, const char *source);
+void initUnit(Compiler *unit, Compiler *parent, int index, ASTNode *function);
+void freeCompiler(Compiler *cc);
+int compile(Compiler *cc);
+
+void compileError(Compiler *cc, const char *fmt, ...)
+    __attribute__((noreturn, format(printf, 2, 3)));
+void compileWarning(Compiler *cc, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE     // struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "compiler.h"
+#include "daemon.h"
+
+#define MAX_DAEMON_ARGS 4096
+
+static int readFully(int fd, void *data, size_t length) {
+    char *p = (char*)data;
+    while (length) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static int writeFully(int fd, const void *data, size_t length) {
+    const char *p = (const char*)data;
+    while (length) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+// Reads the header with the client's three descriptors attached
+static int receiveHeader(int conn, DaemonRequest *request, int fds[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {request, sizeof(*request)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, 0)) < 0 && errno == EINTR) {}
+    if (n <= 0) return 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    if ((size_t)n < sizeof(*request) && !readFully(conn, (char*)request + n, sizeof(*request) - n)) {
+        for (int i = 0; i < 3; i++) close(fds[i]);
+        return 0;
+    }
+    return 1;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs one request with the client's descriptors standing in for ours
+// and its directory as ours; both are restored before replying
+static void serve(int conn, const int saved[3], int home, long number) {
+    // Only the daemon's own user may run commands as that user
+    struct ucred peer;
+    socklen_t peerLength = sizeof(peer);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0 || peer.uid != getuid()) {
+        fprintf(stderr, "request %ld: refused a client of another user\n", number);
+        return;
+    }
+
+    DaemonRequest request;
+    int fds[3];
+    if (!receiveHeader(conn, &request, fds)) return;
+
+    double start = now();
+    char *payload = NULL;
+    char *argv[MAX_DAEMON_ARGS + 1];
+    int status = 1;
+    if (request.magic != DAEMON_MAGIC || request.argc < 1 || request.argc > MAX_DAEMON_ARGS ||
+        request.length <= 0 || request.length > MAX_REQUEST_SIZE) {
+        goto reply;
+    }
+    payload = (char*)xmalloc(request.length + 1);
+    if (!readFully(conn, payload, request.length)) goto reply;
+    payload[request.length] = '\0';
+
+    // The working directory, then argv[1..]
+    char *p = payload, *end = payload + request.length;
+    const char *cwd = p;
+    p += strlen(p) + 1;
+    argv[0] = "main";
+    for (int i = 1; i < request.argc; i++) {
+        if (p >= end) goto reply;
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[request.argc] = NULL;
+
+    for (int i = 0; i < 3; i++) dup2(fds[i], i);
+    if (chdir(cwd) != 0) {
+        fprintf(stderr, "Cannot enter %s\n", cwd);
+    } else {
+        status = runCompiler(request.argc, argv);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);
+    clearerr(stderr);
+    for (int i = 0; i < 3; i++) dup2(saved[i], i);
+    if (fchdir(home) != 0) perror("fchdir");
+
+reply:
+    for (int i = 0; i < 3; i++) close(fds[i]);
+    free(payload);
+    writeFully(conn, &status, sizeof(status));
+    fprintf(stderr, "request %ld: %d arg%s, status %d, %.3f ms\n", number, request.argc - 1,
+            request.argc == 2 ? "" : "s", status, (now() - start) * 1000);
+}
+
+// The default socket lives in a directory only its user can enter.
+// Refuses a directory somebody else made or left open.
+static int makeSocketDirectory(void) {
+    char directory[MAX_SOCKET_PATH];
+    snprintf(directory, sizeof(directory), DEFAULT_SOCKET_DIR_FORMAT, (int)getuid());
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST) {
+        perror(directory);
+        return 0;
+    }
+    struct stat info;
+    if (lstat(directory, &info) != 0) {
+        perror(directory);
+        return 0;
+    }
+    if (!S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077)) {
+        fprintf(stderr, "Refusing to use %s: it must be a directory of yours with mode 0700\n", directory);
+        return 0;
+    }
+    return 1;
+}
+
+// A socket left behind by a daemon that died is removed; a live daemon or
+// a file that is not a socket is left alone.
+static int clearSocketPath(const char *socketPath, const struct sockaddr_un *address) {
+    struct stat info;
+    if (lstat(socketPath, &info) != 0) return errno == ENOENT;
+    if (!S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "Refusing to replace %s: it is not a socket\n", socketPath);
+        return 0;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    int live = probe >= 0 && connect(probe, (const struct sockaddr*)address, sizeof(*address)) == 0;
+    if (probe >= 0) close(probe);
+    if (live) {
+        fprintf(stderr, "A compile daemon is already listening on %s\n", socketPath);
+        return 0;
+    }
+    if (unlink(socketPath) != 0) {
+        perror(socketPath);
+        return 0;
+    }
+    return 1;
+}
+
+// Serves requests one at a time until accept fails. Runs in the worker.
+static void acceptRequests(int listener) {
+    int saved[3], home = open(".", O_RDONLY | O_DIRECTORY);
+    for (int i = 0; i < 3; i++) saved[i] = dup(i);
+    for (long number = 1;; number++) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            return;
+        }
+        serve(conn, saved, home, number);
+        close(conn);
+    }
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopDaemon(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+int runDaemon(const char *socketPath) {
+    char defaultPath[MAX_SOCKET_PATH];
+    if (!socketPath) socketPath = getenv(SOCKET_ENV);
+    if (!socketPath) {
+        if (!makeSocketDirectory()) return 1;
+        snprintf(defaultPath, sizeof(defaultPath), DEFAULT_SOCKET_FORMAT, (int)getuid());
+        socketPath = defaultPath;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+    if (!clearSocketPath(socketPath, &address)) return 1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        chmod(socketPath, 0600) != 0 || listen(listener, 64) != 0) {
+        perror(socketPath);
+        return 1;
+    }
+
+    // A client that goes away mid-reply must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+    initPasses();
+    fprintf(stderr, "Compile daemon listening on %s\n", socketPath);
+
+    // Requests run in a worker process so that one which crashes costs
+    // only the worker (its client sees no reply); the daemon starts a new
+    // one with the same warm state. The worker keeps the header cache
+    // between requests, which a process per request would throw away.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopDaemon;     // no SA_RESTART: waitpid must return
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pid_t daemon = getpid();
+    int status = 1;
+    while (!stopping) {
+        pid_t worker = fork();
+        if (worker < 0) {
+            perror("fork");
+            break;
+        }
+        if (worker == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            // Nor may a worker outlive its daemon and keep the socket
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (getppid() != daemon) _exit(1);
+            acceptRequests(listener);
+            _exit(1);
+        }
+
+        int workerStatus;
+        while (waitpid(worker, &workerStatus, 0) < 0) {
+            if (errno != EINTR) break;
+            if (stopping) kill(worker, SIGTERM);
+        }
+        if (stopping) {
+            status = 0;
+            break;
+        }
+        if (!WIFSIGNALED(workerStatus)) break;     // accept failed
+        fprintf(stderr, "Worker %d died of signal %d; starting another\n", (int)worker,
+                WTERMSIG(workerStatus));
+    }
+
+    close(listener);
+    unlink(socketPath);
+    return status;
+}
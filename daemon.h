@@ -0,0 +1,34 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Compile server. "main -daemon[=<socket>]" stays resident and runs one
+// command line per request, with the pass registry, keyword table, heap
+// and page cache already warm. The client (client.c) forwards its
+// arguments, working directory and standard descriptors, so it is a
+// drop-in for ./main: output goes straight to the caller's stdout and
+// stderr, and the reply is the exit status. Requests run in a worker
+// process that is replaced if one crashes, and only clients of the
+// daemon's own user are served.
+
+#define DAEMON_MAGIC 0x54414344     // "DCAT"
+#define SOCKET_ENV "COMPILER_SOCKET"
+#define DEFAULT_SOCKET_DIR_FORMAT "/tmp/compiler-%d"             // by uid, mode 0700
+#define DEFAULT_SOCKET_FORMAT "/tmp/compiler-%d/daemon.sock"
+#define MAX_SOCKET_PATH 108         // sizeof(sockaddr_un.sun_path)
+#define MAX_REQUEST_SIZE (1 << 20)
+
+// Sent with the client's stdin, stdout and stderr attached, then
+// followed by the working directory and the arguments after argv[0],
+// each NUL-terminated. The reply is one int, the exit status.
+typedef struct {
+    unsigned magic;
+    int argc;
+    int length;             // bytes that follow the header
+} DaemonRequest;
+
+// Defined by the driver in main.c
+int runCompiler(int argc, char *argv[]);
+
+int runDaemon(const char *socketPath);
+
+#endif
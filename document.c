@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "document.h"
+
+// A token of the document as it was before the edit
+typedef struct {
+    int item;
+    int token;
+} OldToken;
+
+size_t documentLength(Document *doc) {
+    return doc->capacity - (doc->gapEnd - doc->gapStart);
+}
+
+// Costs the distance the gap moves, which for an edit is its own size
+static void moveGap(Document *doc, size_t offset) {
+    if (offset < doc->gapStart) {
+        size_t n = doc->gapStart - offset;
+        memmove(doc->text + doc->gapEnd - n, doc->text + offset, n);
+        doc->gapStart -= n;
+        doc->gapEnd -= n;
+    } else if (offset > doc->gapStart) {
+        size_t n = offset - doc->gapStart;
+        memmove(doc->text + doc->gapStart, doc->text + doc->gapEnd, n);
+        doc->gapStart += n;
+        doc->gapEnd += n;
+    }
+}
+
+static void reserveGap(Document *doc, size_t length) {
+    if (doc->gapEnd - doc->gapStart >= length) return;
+    size_t tail = doc->capacity - doc->gapEnd;
+    size_t capacity = doc->capacity * 2 + length;
+    doc->text = (char*)xrealloc(doc->text, capacity);
+    memmove(doc->text + capacity - tail, doc->text + doc->gapEnd, tail);
+    doc->gapEnd = capacity - tail;
+    doc->capacity = capacity;
+}
+
+static size_t oldOffset(Document *doc, OldToken at) {
+    DocumentItem *item = &doc->items[at.item];
+    return item->start + item->offsets[at.token];
+}
+
+static void nextOldToken(Document *doc, OldToken *at) {
+    if (++at->token == doc->items[at->item].count) {
+        at->item++;
+        at->token = 0;
+    }
+}
+
+// The last token that starts before offset; 0 if there is none
+static int findToken(Document *doc, size_t offset, OldToken *at) {
+    int lo = 0, hi = doc->itemCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (doc->items[mid].start < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return 0;
+
+    DocumentItem *item = &doc->items[lo - 1];
+    size_t relative = offset - item->start;
+    int first = 0, last = item->count;
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if ((size_t)item->offsets[mid] < relative) first = mid + 1;
+        else last = mid;
+    }
+    at->item = lo - 1;
+    at->token = first - 1;
+    return 1;
+}
+
+static void pushToken(TokenRun *run, const Token *tok, size_t offset, int line, int oldItem) {
+    if (run->count == run->capacity) {
+        run->capacity = run->capacity ? run->capacity * 2 : INITIAL_TOKENS;
+        run->tokens = (Token*)xrealloc(run->tokens, run->capacity * sizeof(Token));
+        run->offsets = (size_t*)xrealloc(run->offsets, run->capacity * sizeof(size_t));
+        run->oldItem = (int*)xrealloc(run->oldItem, run->capacity * sizeof(int));
+    }
+    run->tokens[run->count] = *tok;
+    run->tokens[run->count].line = line;
+    run->offsets[run->count] = offset;
+    run->oldItem[run->count] = oldItem;
+    run->count++;
+}
+
+// Makes the run at least index + 1 tokens long with the old tokens that
+// follow the re-lexed ones, moved to where the edit put them; 0 at the
+// end of the document
+static int pullTokens(Document *doc, OldToken *old, long delta, int lineDelta, int index) {
+    TokenRun *run = &doc->run;
+    while (run->count <= index) {
+        if (old->item >= doc->itemCount) return 0;
+        DocumentItem *item = &doc->items[old->item];
+        Token *tok = &item->tokens[old->token];
+        pushToken(run, tok, item->start + item->offsets[old->token] + delta, item->line + tok->line + lineDelta,
+                  old->token == 0 ? old->item : -1);
+        nextOldToken(doc, old);
+    }
+    return 1;
+}
+
+// "int name (" begins a function wherever it is, as no statement can
+static int startsFunction(Document *doc, OldToken *old, long delta, int lineDelta, int index) {
+    if (!pullTokens(doc, old, delta, lineDelta, index + 2)) return 0;
+    Token *tok = &doc->run.tokens[index];
+    return tok[0].type == TOKEN_KEYWORD && strcmp(tok[0].lexeme, "int") == 0 &&
+           tok[1].type == TOKEN_IDENTIFIER && strcmp(tok[2].lexeme, "(") == 0;
+}
+
+// Parses an item on its own, with its tokens at their real lines while
+// it runs; a syntax error is kept as the message the compiler printed
+static void parseItem(Document *doc, DocumentItem *item) {
+    Compiler *cc = &doc->cc;
+    for (int t = 0; t < item->count; t++) item->tokens[t].line += item->line;
+    cc->tokenTable = item->tokens;
+    cc->tokenCount = item->count;
+    cc->currentTokenIndex = 0;
+    cc->ast = NULL;
+    cc->diagnostics.length = 0;
+    free(item->error);
+    item->error = NULL;
+    item->ast = item->last = NULL;
+
+    if (setjmp(cc->onError)) {
+        freeAST(cc->ast);
+        size_t length = cc->diagnostics.length;
+        if (length && cc->diagnostics.data[length - 1] == '\n') length--;
+        item->error = (char*)xmalloc(length + 1);
+        memcpy(item->error, cc->diagnostics.data, length);
+        item->error[length] = '\0';
+        item->errorLine = item->line;
+        item->ast = item->last = NULL;
+        cc->failed = 0;
+    } else {
+        ASTNode *node;
+        while ((node = parseTopLevel(cc))) {
+            if (!item->ast) item->ast = cc->ast = node;
+            else item->last->next = node;
+            item->last = node;
+        }
+    }
+
+    cc->ast = NULL;
+    cc->tokenTable = NULL;
+    cc->tokenCount = 0;
+    for (int t = 0; t < item->count; t++) item->tokens[t].line -= item->line;
+}
+
+// Run tokens start .. end - 1 as the next new item
+static void addFreshItem(Document *doc, int index, int start, int end, int closed) {
+    TokenRun *run = &doc->run;
+    if (index == doc->freshCapacity) {
+        doc->freshCapacity = doc->freshCapacity ? doc->freshCapacity * 2 : 16;
+        doc->fresh = (DocumentItem*)xrealloc(doc->fresh, doc->freshCapacity * sizeof(DocumentItem));
+    }
+    DocumentItem *item = &doc->fresh[index];
+    memset(item, 0, sizeof(*item));
+    item->start = run->offsets[start];
+    item->line = run->tokens[start].line;
+    item->count = end - start;
+    item->closed = closed;
+    item->tokens = (Token*)xmalloc(item->count * sizeof(Token));
+    item->offsets = (int*)xmalloc(item->count * sizeof(int));
+    for (int t = 0; t < item->count; t++) {
+        item->tokens[t] = run->tokens[start + t];
+        item->tokens[t].line -= item->line;
+        item->offsets[t] = (int)(run->offsets[start + t] - item->start);
+    }
+    parseItem(doc, item);
+}
+
+static void freeItem(DocumentItem *item) {
+    if (item->last) item->last->next = NULL;
+    freeAST(item->ast);
+    free(item->tokens);
+    free(item->offsets);
+    free(item->error);
+}
+
+// Chains the nodes of items first .. last - 1 in between those of the
+// nearest parsed items around them
+static void linkItems(Document *doc, int first, int last) {
+    int k = first - 1;
+    while (k >= 0 && !doc->items[k].ast) k--;
+    ASTNode *tail = k >= 0 ? doc->items[k].last : NULL;
+    for (k = first; k < doc->itemCount; k++) {
+        DocumentItem *item = &doc->items[k];
+        if (!item->ast) continue;
+        if (tail) tail->next = item->ast;
+        if (k >= last) return;
+        tail = item->last;
+    }
+    if (tail) tail->next = NULL;
+}
+
+// Replaces deleted bytes at offset with inserted ones; 0 if the range is
+// not in the document
+int editDocument(Document *doc, size_t offset, size_t deleted, const char *inserted, size_t insertedLength) {
+    size_t length = documentLength(doc);
+    if (offset > length || deleted > length - offset) return 0;
+
+    TokenRun *run = &doc->run;
+    long delta = (long)insertedLength - (long)deleted;
+    OldToken old = {0, 0};
+    size_t scanStart = 0;
+    int line = 1, first = 0;
+    memset(&doc->lastEdit, 0, sizeof(doc->lastEdit));
+    run->count = 0;
+
+    // Lexing resumes at the last token that starts before the edit, which
+    // is the first one it can change. Items are split again from the start
+    // of that token's item, or of the one before when it ended only
+    // because this one began.
+    if (findToken(doc, offset, &old)) {
+        DocumentItem *item = &doc->items[old.item];
+        scanStart = oldOffset(doc, old);
+        line = item->line + item->tokens[old.token].line;
+        first = old.item;
+        if (first > 0 && !doc->items[first - 1].closed) first--;
+        for (int k = first; k <= old.item; k++) {
+            item = &doc->items[k];
+            int count = k == old.item ? old.token : item->count;
+            for (int t = 0; t < count; t++) {
+                pushToken(run, &item->tokens[t], item->start + item->offsets[t], item->line + item->tokens[t].line, -1);
+            }
+        }
+    }
+
+    moveGap(doc, offset);
+    doc->gapEnd += deleted;
+    reserveGap(doc, insertedLength);
+    memcpy(doc->text + doc->gapStart, inserted, insertedLength);
+    doc->gapStart += insertedLength;
+    moveGap(doc, scanStart);
+
+    // Past the edit, a new token that starts where an old one now does
+    // scans the same text in the same state, so every token from there on
+    // is the old one moved
+    const char *base = doc->text + doc->gapEnd;
+    Scanner s;
+    Token tok;
+    int lineDelta = 0, synced = 0;
+    initScanner(&s, base, doc->capacity - doc->gapEnd);
+    s.line = line;
+    while (scanToken(&s, &tok)) {
+        if (tok.type == TOKEN_DIRECTIVE_END || (s.directiveEnd && tok.type != TOKEN_PREPROCESSOR)) continue;
+        size_t at = scanStart + (size_t)(s.tokenStart - base);
+        while (old.item < doc->itemCount &&
+               (oldOffset(doc, old) < offset + deleted || (long)oldOffset(doc, old) + delta < (long)at)) {
+            nextOldToken(doc, &old);
+        }
+        if (old.item < doc->itemCount && (long)oldOffset(doc, old) + delta == (long)at) {
+            DocumentItem *item = &doc->items[old.item];
+            lineDelta = tok.line - (item->line + item->tokens[old.token].line);
+            synced = 1;
+            break;
+        }
+        pushToken(run, &tok, at, tok.line, -1);
+        doc->lastEdit.tokensLexed++;
+    }
+    if (!synced) old.item = doc->itemCount;
+
+    // Split the run into items until one would start where an old item
+    // does: that item and all after it are unchanged
+    int end = doc->itemCount, freshCount = 0, i = 0;
+    while (pullTokens(doc, &old, delta, lineDelta, i)) {
+        if (run->oldItem[i] >= 0) {
+            end = run->oldItem[i];
+            break;
+        }
+        int start = i, depth = 0, closed = 0;
+        if (run->tokens[i].type == TOKEN_PREPROCESSOR) {
+            i++;
+            closed = 1;
+        } else {
+            do {
+                const char *lexeme = run->tokens[i++].lexeme;
+                if (strcmp(lexeme, "{") == 0) {
+                    depth++;
+                } else if (strcmp(lexeme, "}") == 0 && --depth <= 0) {
+                    closed = 1;
+                    break;
+                }
+            } while (pullTokens(doc, &old, delta, lineDelta, i) &&
+                     !(run->tokens[i].type == TOKEN_PREPROCESSOR && depth <= 0) &&
+                     !startsFunction(doc, &old, delta, lineDelta, i));
+        }
+        addFreshItem(doc, freshCount++, start, i, closed);
+    }
+
+    for (int k = first; k < end; k++) freeItem(&doc->items[k]);
+    int count = doc->itemCount - (end - first) + freshCount;
+    if (count > doc->itemCapacity) {
+        doc->itemCapacity = count * 2;
+        doc->items = (DocumentItem*)xrealloc(doc->items, doc->itemCapacity * sizeof(DocumentItem));
+    }
+    memmove(doc->items + first + freshCount, doc->items + end, (doc->itemCount - end) * sizeof(DocumentItem));
+    memcpy(doc->items + first, doc->fresh, freshCount * sizeof(DocumentItem));
+    doc->itemCount = count;
+    for (int k = first + freshCount; k < count; k++) {
+        doc->items[k].start += delta;
+        doc->items[k].line += lineDelta;
+    }
+    linkItems(doc, first, first + freshCount);
+
+    doc->lastEdit.itemsParsed = freshCount;
+    doc->lastEdit.itemsMoved = count - first - freshCount;
+    return 1;
+}
+
+Document* openDocument(const char *name, const char *text, size_t length) {
+    Document *doc = (Document*)xcalloc(1, sizeof(Document));
+    doc->name = (char*)xmalloc(strlen(name) + 1);
+    strcpy(doc->name, name);
+    initCompiler(&doc->cc, &doc->options, doc->name);
+    doc->capacity = length + DOCUMENT_INITIAL_GAP;
+    doc->text = (char*)xmalloc(doc->capacity);
+    doc->gapEnd = doc->capacity;
+    editDocument(doc, 0, 0, text, length);
+    return doc;
+}
+
+// The whole text, NUL-terminated; the caller frees it
+char* documentText(Document *doc) {
+    size_t tail = doc->capacity - doc->gapEnd;
+    char *text = (char*)xmalloc(documentLength(doc) + 1);
+    memcpy(text, doc->text, doc->gapStart);
+    memcpy(text + doc->gapStart, doc->text + doc->gapEnd, tail);
+    text[doc->gapStart + tail] = '\0';
+    return text;
+}
+
+// Top-level nodes of the items that parse, chained through next
+ASTNode* documentAST(Document *doc) {
+    for (int k = 0; k < doc->itemCount; k++) {
+        if (doc->items[k].ast) return doc->items[k].ast;
+    }
+    return NULL;
+}
+
+// Writes the syntax errors of every item; returns how many there are. An
+// error moved to another line since is parsed again for its message.
+int documentDiagnostics(Document *doc, Output *out) {
+    int errors = 0;
+    for (int k = 0; k < doc->itemCount; k++) {
+        DocumentItem *item = &doc->items[k];
+        if (!item->error) continue;
+        if (item->errorLine != item->line) parseItem(doc, item);
+        outPrintf(out, "%s\n", item->error);
+        errors++;
+    }
+    return errors;
+}
+
+void closeDocument(Document *doc) {
+    for (int k = 0; k < doc->itemCount; k++) freeItem(&doc->items[k]);
+    free(doc->items);
+    free(doc->fresh);
+    free(doc->run.tokens);
+    free(doc->run.offsets);
+    free(doc->run.oldItem);
+    free(doc->text);
+    freeCompiler(&doc->cc);
+    free(doc->name);
+    free(doc);
+}
@@ -0,0 +1,81 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stddef.h>
+#include "compiler.h"
+
+// A source file held open for editing. Each edit re-lexes from the token
+// before it until the token stream lines up with the old one again, then
+// re-parses only the top-level items those tokens fall in; every other
+// item keeps its tokens and its AST and is just moved. An item is one
+// directive or one function: from its first token to the '}' that closes
+// its body, or up to the next "int name (" or directive at brace depth
+// 0, so an unbalanced brace spoils a single function.
+//
+// Directives are kept as written, one token each, and macros are not
+// expanded: the AST is what the parser sees of a file without macros.
+// Each item is parsed on its own, so a file with several broken
+// functions reports them all. The nodes a failed parse had built are
+// lost, as in a batch compilation.
+#define DOCUMENT_INITIAL_GAP 4096
+
+// Token offsets and lines are relative to the item's first token, so
+// moving an item is two additions
+typedef struct {
+    size_t start;       // offset of the first token
+    int line;           // line of the first token
+    Token *tokens;
+    int *offsets;
+    int count;
+    int closed;         // ended by its own '}', or a directive
+    ASTNode *ast;       // parsed nodes, chained on to the next item's;
+    ASTNode *last;      // NULL after a syntax error
+    char *error;
+    int errorLine;      // item line the error was reported at
+} DocumentItem;
+
+// Work done by the last edit
+typedef struct {
+    int tokensLexed;
+    int itemsParsed;
+    int itemsMoved;
+} EditStats;
+
+// Tokens being split into items during an edit
+typedef struct {
+    Token *tokens;
+    size_t *offsets;
+    int *oldItem;       // the unchanged item this token starts, or -1
+    int count;
+    int capacity;
+} TokenRun;
+
+typedef struct {
+    CompileOptions options;     // all off: the parser alone
+    Compiler cc;
+    char *name;
+
+    // Text, with a gap at the last edit
+    char *text;
+    size_t capacity;
+    size_t gapStart, gapEnd;
+
+    DocumentItem *items;
+    int itemCount;
+    int itemCapacity;
+
+    TokenRun run;
+    DocumentItem *fresh;        // items of the edit, before they replace the old ones
+    int freshCapacity;
+    EditStats lastEdit;
+} Document;
+
+Document* openDocument(const char *name, const char *text, size_t length);
+int editDocument(Document *doc, size_t offset, size_t deleted, const char *inserted, size_t insertedLength);
+size_t documentLength(Document *doc);
+char* documentText(Document *doc);
+ASTNode* documentAST(Document *doc);
+int documentDiagnostics(Document *doc, Output *out);
+void closeDocument(Document *doc);
+
+#endif
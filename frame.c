@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+
+// Strings of one function by open addressing, pointing into the quads
+typedef struct {
+    const char **keys;
+    int *values;
+    unsigned mask;
+} NameMap;
+
+// One FUNC ... ENDFUNC range being laid out
+typedef struct {
+    Compiler *cc;
+    int start;              // the FUNC quad
+    int end;                // the ENDFUNC quad, or the last one
+    int *operands;          // cc->frameSlots of the range: name + 1, or 0
+    char *defines;          // the quad's result is a name it defines
+
+    // Names, numbered in order of appearance
+    NameMap names;
+    int nameCount;
+    const char **text;
+    int *words;             // 1, or VECTOR_WIDTH for a vector
+    int *global;            // index in the block bitsets, or -1
+    int *globalName;
+    int globalCount;
+
+    // Blocks; liveness is kept for the global names only
+    NameMap labels;
+    int *blockStart;        // first quad, and blockStart[blockCount] = end + 1
+    int blockCount;
+    int setWords;           // unsigned longs per bitset
+    unsigned long *use, *def, *liveIn, *liveOut;
+
+    // Interference, as pairs and then as adjacency lists
+    int *edges;
+    long edgeCount, edgeCapacity;
+    int *adjacencyStart;
+    int *adjacency;
+
+    int *offset;            // in words from the bottom of the frame
+    int frameWords;         // slots and then arrays
+    int unsharedWords;
+} Frame;
+
+static unsigned hashText(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static void initMap(NameMap *map, int count) {
+    unsigned buckets = 16;
+    while (buckets < (unsigned)count * 2 + 8) buckets *= 2;
+    map->keys = (const char**)xcalloc(buckets, sizeof(char*));
+    map->values = (int*)xmalloc(sizeof(int) * buckets);
+    map->mask = buckets - 1;
+}
+
+static void freeMap(NameMap *map) {
+    free(map->keys);
+    free(map->values);
+}
+
+// The value of key, -1 when it was not there before
+static int *mapFind(NameMap *map, const char *key) {
+    unsigned h = hashText(key) & map->mask;
+    while (map->keys[h] && strcmp(map->keys[h], key) != 0) h = (h + 1) & map->mask;
+    if (!map->keys[h]) {
+        map->keys[h] = key;
+        map->values[h] = -1;
+    }
+    return &map->values[h];
+}
+
+// ---------- operands ----------
+
+// Which fields read or define a name is decided by the passes (passes.h),
+// so liveness here and DCE there cannot disagree
+
+static int isVectorResult(const Quadruple *q) {
+    return q->op[0] == 'V' && strcmp(q->op, "V[]=") != 0;
+}
+
+// Name number + 1 for a field that reads or defines a name, else 0
+static int operandName(Frame *f, const char *text, int words) {
+    if (!isNameOperand(text)) return 0;
+    int *index = mapFind(&f->names, text);
+    if (*index < 0) {
+        *index = f->nameCount++;
+        f->text[*index] = text;
+        f->words[*index] = 1;
+    }
+    if (words > f->words[*index]) f->words[*index] = words;
+    return *index + 1;
+}
+
+static void numberNames(Frame *f) {
+    Quadruple *code = f->cc->code;
+    for (int i = f->start + 1; i <= f->end; i++) {
+        Quadruple *q = &code[i];
+        int *fields = &f->operands[(i - f->start) * FRAME_FIELDS];
+        f->defines[i - f->start] = (char)definesResult(q);
+        if (f->defines[i - f->start]) {
+            fields[FRAME_RESULT] = operandName(f, q->result, isVectorResult(q) ? VECTOR_WIDTH : 1);
+        } else if (readsResult(q)) {
+            fields[FRAME_RESULT] = operandName(f, q->result, 1);
+        }
+        if (readsArg1(q)) fields[FRAME_ARG1] = operandName(f, q->arg1, 1);
+        if (readsArg2(q)) fields[FRAME_ARG2] = operandName(f, q->arg2, 1);
+    }
+}
+
+// ---------- liveness ----------
+
+static int isLeader(const Quadruple *code, int i, int start) {
+    if (i == start || strcmp(code[i].op, "LABEL") == 0) return 1;
+    const Quadruple *prev = &code[i - 1];
+    return strcmp(prev->op, "goto") == 0 || strcmp(prev->op, "iffalse") == 0 ||
+           strcmp(prev->result, "RET") == 0;
+}
+
+static void splitBlocks(Frame *f) {
+    Quadruple *code = f->cc->code;
+    for (int i = f->start; i <= f->end; i++) {
+        if (!isLeader(code, i, f->start)) continue;
+        if (strcmp(code[i].op, "LABEL") == 0) *mapFind(&f->labels, code[i].result) = f->blockCount;
+        f->blockStart[f->blockCount++] = i;
+    }
+    f->blockStart[f->blockCount] = f->end + 1;
+}
+
+// A name is global when some block reads it before defining it: only
+// those can be live across a block boundary
+static void findGlobals(Frame *f) {
+    int *definedIn = (int*)xmalloc(sizeof(int) * (f->nameCount ? f->nameCount : 1));
+    for (int n = 0; n < f->nameCount; n++) {
+        definedIn[n] = -1;
+        f->global[n] = -1;
+    }
+    for (int b = 0; b < f->blockCount; b++) {
+        for (int i = f->blockStart[b]; i < f->blockStart[b + 1]; i++) {
+            int *fields = &f->operands[(i - f->start) * FRAME_FIELDS];
+            int defines = f->defines[i - f->start];
+            for (int k = 0; k < FRAME_FIELDS; k++) {
+                int n = fields[k] - 1;
+                if (n < 0 || (k == FRAME_RESULT && defines)) continue;
+                if (definedIn[n] != b && f->global[n] < 0) {
+                    f->global[n] = f->globalCount;
+                    f->globalName[f->globalCount++] = n;
+                }
+            }
+            if (defines && fields[FRAME_RESULT]) definedIn[fields[FRAME_RESULT] - 1] = b;
+        }
+    }
+    free(definedIn);
+}
+
+static unsigned long *blockSet(Frame *f, unsigned long *sets, int block) {
+    return sets + (size_t)block * f->setWords;
+}
+
+static void setBit(unsigned long *set, int bit) {
+    set[bit / 64] |= 1UL << (bit % 64);
+}
+
+// Upward-exposed reads and definitions of the global names, per block
+static void computeUseDef(Frame *f) {
+    for (int b = 0; b < f->blockCount; b++) {
+        unsigned long *use = blockSet(f, f->use, b), *def = blockSet(f, f->def, b);
+        for (int i = f->blockStart[b]; i < f->blockStart[b + 1]; i++) {
+            int *fields = &f->operands[(i - f->start) * FRAME_FIELDS];
+            int defines = f->defines[i - f->start];
+            for (int k = 0; k < FRAME_FIELDS; k++) {
+                int n = fields[k] - 1;
+                if (n < 0 || (k == FRAME_RESULT && defines) || f->global[n] < 0) continue;
+                int g = f->global[n];
+                if (!(def[g / 64] & (1UL << (g % 64)))) setBit(use, g);
+            }
+            int d = fields[FRAME_RESULT] - 1;
+            if (defines && d >= 0 && f->global[d] >= 0) setBit(def, f->global[d]);
+        }
+    }
+}
+
+// Blocks a block can fall or jump into; a jump to an undefined label
+// leads nowhere, as the interpreter reports it when it loads
+static int successors(Frame *f, int block, int next[2]) {
+    Quadruple *last = &f->cc->code[f->blockStart[block + 1] - 1];
+    int count = 0;
+    if (strcmp(last->op, "goto") == 0 || strcmp(last->op, "iffalse") == 0) {
+        int target = *mapFind(&f->labels, last->arg2);
+        if (target >= 0) next[count++] = target;
+        if (strcmp(last->op, "goto") == 0) return count;
+    } else if (strcmp(last->result, "RET") == 0) {
+        return count;
+    }
+    if (block + 1 < f->blockCount) next[count++] = block + 1;
+    return count;
+}
+
+// liveOut = union of the successors' liveIn, liveIn = use | (liveOut & ~def),
+// backwards over the blocks until nothing changes
+static void solveLiveness(Frame *f) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = f->blockCount - 1; b >= 0; b--) {
+            unsigned long *out = blockSet(f, f->liveOut, b), *in = blockSet(f, f->liveIn, b);
+            unsigned long *use = blockSet(f, f->use, b), *def = blockSet(f, f->def, b);
+            int next[2];
+            int count = successors(f, b, next);
+            for (int w = 0; w < f->setWords; w++) {
+                unsigned long live = 0;
+                for (int s = 0; s < count; s++) live |= blockSet(f, f->liveIn, next[s])[w];
+                unsigned long entry = use[w] | (live & ~def[w]);
+                if (live != out[w] || entry != in[w]) changed = 1;
+                out[w] = live;
+                in[w] = entry;
+            }
+        }
+    }
+}
+
+// ---------- interference ----------
+
+static void addEdge(Frame *f, int a, int b) {
+    if (f->edgeCount == f->edgeCapacity) {
+        f->edgeCapacity = f->edgeCapacity ? f->edgeCapacity * 2 : 256;
+        f->edges = (int*)xrealloc(f->edges, sizeof(int) * 2 * f->edgeCapacity);
+    }
+    f->edges[2 * f->edgeCount] = a;
+    f->edges[2 * f->edgeCount + 1] = b;
+    f->edgeCount++;
+}
+
+// Walks each block backwards from its live-out set. A definition
+// interferes with every name live after it, even when the definition
+// itself is dead; a scalar copy does not interfere with its source, so
+// the two may share a slot.
+static void buildInterference(Frame *f) {
+    int *live = (int*)xmalloc(sizeof(int) * (f->nameCount ? f->nameCount : 1));
+    int *livePos = (int*)xmalloc(sizeof(int) * (f->nameCount ? f->nameCount : 1));
+    for (int n = 0; n < f->nameCount; n++) livePos[n] = -1;
+
+    for (int b = 0; b < f->blockCount; b++) {
+        int liveCount = 0;
+        unsigned long *out = blockSet(f, f->liveOut, b);
+        for (int g = 0; g < f->globalCount; g++) {
+            if (out[g / 64] & (1UL << (g % 64))) {
+                int n = f->globalName[g];
+                livePos[n] = liveCount;
+                live[liveCount++] = n;
+            }
+        }
+
+        for (int i = f->blockStart[b + 1] - 1; i >= f->blockStart[b]; i--) {
+            Quadruple *q = &f->cc->code[i];
+            int *fields = &f->operands[(i - f->start) * FRAME_FIELDS];
+            int d = f->defines[i - f->start] ? fields[FRAME_RESULT] - 1 : -1;
+            if (d >= 0) {
+                int source = strcmp(q->op, "=") == 0 && !q->arg2[0] && f->words[d] == 1 ? fields[FRAME_ARG1] - 1 : -1;
+                for (int k = 0; k < liveCount; k++) {
+                    if (live[k] != d && live[k] != source) addEdge(f, d, live[k]);
+                }
+                if (livePos[d] >= 0) {
+                    int moved = live[--liveCount];
+                    live[livePos[d]] = moved;
+                    livePos[moved] = livePos[d];
+                    livePos[d] = -1;
+                }
+            }
+            for (int k = 0; k < FRAME_FIELDS; k++) {
+                int n = fields[k] - 1;
+                if (n < 0 || (k == FRAME_RESULT && d >= 0) || livePos[n] >= 0) continue;
+                livePos[n] = liveCount;
+                live[liveCount++] = n;
+            }
+        }
+        for (int k = 0; k < liveCount; k++) livePos[live[k]] = -1;
+    }
+    free(live);
+    free(livePos);
+
+    // Pairs to adjacency lists
+    f->adjacencyStart = (int*)xcalloc(f->nameCount + 1, sizeof(int));
+    for (long e = 0; e < 2 * f->edgeCount; e++) f->adjacencyStart[f->edges[e] + 1]++;
+    for (int n = 0; n < f->nameCount; n++) f->adjacencyStart[n + 1] += f->adjacencyStart[n];
+    f->adjacency = (int*)xmalloc(sizeof(int) * (2 * f->edgeCount + 1));
+    int *fill = (int*)xmalloc(sizeof(int) * (f->nameCount + 1));
+    memcpy(fill, f->adjacencyStart, sizeof(int) * (f->nameCount + 1));
+    for (long e = 0; e < f->edgeCount; e++) {
+        int a = f->edges[2 * e], b = f->edges[2 * e + 1];
+        f->adjacency[fill[a]++] = b;
+        f->adjacency[fill[b]++] = a;
+    }
+    free(fill);
+}
+
+// ---------- coloring ----------
+
+// Vectors first, so they pack at their alignment, then words into the
+// gaps; each name at the lowest aligned offset its placed neighbours
+// leave free. taken[] marks a word with the name being placed, + 1.
+static void assignSlots(Frame *f) {
+    for (int n = 0; n < f->nameCount; n++) {
+        f->offset[n] = -1;
+        f->unsharedWords += f->words[n];
+    }
+    int *taken = (int*)xcalloc(f->unsharedWords + 1, sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = 0; n < f->nameCount; n++) {
+            int size = f->words[n];
+            if ((size > 1) != (pass == 0)) continue;
+            for (int e = f->adjacencyStart[n]; e < f->adjacencyStart[n + 1]; e++) {
+                int m = f->adjacency[e];
+                for (int w = 0; f->offset[m] >= 0 && w < f->words[m]; w++) taken[f->offset[m] + w] = n + 1;
+            }
+            int at = 0;
+            for (int w = 0; w < size; w++) {
+                if (taken[at + w] == n + 1) {
+                    at += size;
+                    w = -1;
+                }
+            }
+            f->offset[n] = at;
+            if (at + size > f->frameWords) f->frameWords = at + size;
+        }
+    }
+    free(taken);
+}
+
+// Each ARRAY quad gets its elements below the slots, for the whole call:
+// storage made where the array is declared would grow with every pass of
+// a loop around the declaration. Arrays are never shared. The quad's arg1
+// field becomes the bytes below BP of element 0.
+static void placeArrays(Frame *f) {
+    for (int i = f->start + 1; i <= f->end; i++) {
+        if (strcmp(f->cc->code[i].op, "ARRAY") != 0) continue;
+        int words = atoi(f->cc->code[i].arg1);
+        f->frameWords += words;
+        f->unsharedWords += words;
+        f->operands[(i - f->start) * FRAME_FIELDS + FRAME_ARG1] = f->frameWords * WORD_SIZE;
+    }
+}
+
+// ---------- layout ----------
+
+static void printFrame(Frame *f) {
+    Output *out = &f->cc->dumpOutput;
+    outPrintf(out, "\n=== Frame of %s: %d bytes, %d with a slot per name ===\n", f->cc->code[f->start].result,
+              f->frameWords * WORD_SIZE, f->unsharedWords * WORD_SIZE);
+    // One line per slot, by its bytes below BP
+    for (int top = 1; top <= f->frameWords; top++) {
+        int shown = 0;
+        for (int n = 0; n < f->nameCount; n++) {
+            if (f->offset[n] + f->words[n] != top) continue;
+            if (!shown++) outPrintf(out, "[BP-%d]", top * WORD_SIZE);
+            outPrintf(out, " %s", f->text[n]);
+        }
+        if (shown) outPrintf(out, "\n");
+    }
+    for (int i = f->start + 1; i <= f->end; i++) {
+        Quadruple *q = &f->cc->code[i];
+        if (strcmp(q->op, "ARRAY") != 0) continue;
+        outPrintf(out, "[BP-%d] %s[%s]\n", f->operands[(i - f->start) * FRAME_FIELDS + FRAME_ARG1], q->result, q->arg1);
+    }
+}
+
+static void layoutFunction(Compiler *cc, int start, int end) {
+    Frame f;
+    memset(&f, 0, sizeof(f));
+    f.cc = cc;
+    f.start = start;
+    f.end = end;
+    f.operands = &cc->frameSlots[start * FRAME_FIELDS];
+
+    int quads = end - start + 1, maxNames = quads * FRAME_FIELDS;
+    initMap(&f.names, maxNames);
+    initMap(&f.labels, quads);
+    f.text = (const char**)xmalloc(sizeof(char*) * maxNames);
+    f.words = (int*)xmalloc(sizeof(int) * maxNames);
+    f.global = (int*)xmalloc(sizeof(int) * maxNames);
+    f.globalName = (int*)xmalloc(sizeof(int) * maxNames);
+    f.blockStart = (int*)xmalloc(sizeof(int) * (quads + 1));
+    f.defines = (char*)xcalloc(quads, 1);
+
+    numberNames(&f);
+    splitBlocks(&f);
+    findGlobals(&f);
+    f.setWords = (f.globalCount + 63) / 64;
+    size_t setBytes = sizeof(unsigned long) * f.setWords * f.blockCount + 1;
+    f.use = (unsigned long*)xcalloc(1, setBytes);
+    f.def = (unsigned long*)xcalloc(1, setBytes);
+    f.liveIn = (unsigned long*)xcalloc(1, setBytes);
+    f.liveOut = (unsigned long*)xcalloc(1, setBytes);
+    computeUseDef(&f);
+    solveLiveness(&f);
+    buildInterference(&f);
+    f.offset = (int*)xmalloc(sizeof(int) * (f.nameCount ? f.nameCount : 1));
+    assignSlots(&f);
+
+    // Name numbers become bytes below BP
+    for (int k = FRAME_FIELDS; k < quads * FRAME_FIELDS; k++) {
+        int n = f.operands[k] - 1;
+        f.operands[k] = n < 0 ? 0 : (f.offset[n] + f.words[n]) * WORD_SIZE;
+    }
+    placeArrays(&f);
+    f.operands[FRAME_RESULT] = f.frameWords * WORD_SIZE;
+    cc->frameBytes += f.frameWords * WORD_SIZE;
+    cc->unsharedFrameBytes += f.unsharedWords * WORD_SIZE;
+    if (cc->options->dumpFlags & DUMP_FRAME) printFrame(&f);
+
+    freeMap(&f.names);
+    freeMap(&f.labels);
+    free(f.text);
+    free(f.words);
+    free(f.global);
+    free(f.globalName);
+    free(f.blockStart);
+    free(f.defines);
+    free(f.use);
+    free(f.def);
+    free(f.liveIn);
+    free(f.liveOut);
+    free(f.edges);
+    free(f.adjacencyStart);
+    free(f.adjacency);
+    free(f.offset);
+}
+
+// Lays out the frame of every FUNC ... ENDFUNC range in cc->code
+void layoutFrames(Compiler *cc) {
+    cc->frameSlots = (int*)xrealloc(cc->frameSlots, sizeof(int) * FRAME_FIELDS * (cc->codeIndex + 1));
+    memset(cc->frameSlots, 0, sizeof(int) * FRAME_FIELDS * (cc->codeIndex + 1));
+    cc->frameBytes = cc->unsharedFrameBytes = 0;
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "FUNC") != 0) continue;
+        int end = i + 1;
+        while (end < cc->codeIndex - 1 && strcmp(cc->code[end].op, "ENDFUNC") != 0) end++;
+        if (end >= cc->codeIndex) end = cc->codeIndex - 1;
+        layoutFunction(cc, i, end);
+        i = end;
+    }
+}
+
+int frameSlot(Compiler *cc, int index, int field) {
+    return cc->frameSlots[index * FRAME_FIELDS + field];
+}
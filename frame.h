@@ -0,0 +1,32 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "codegen.h"
+
+// Stack frame layout. Every name a function's TAC reads or writes gets a
+// slot below BP: a word, or VECTOR_WIDTH words aligned to their size for
+// a vector. Two names share bytes unless one is live where the other is
+// defined, so a frame holds what is live at once rather than every temp
+// the function ever made.
+//
+// Liveness is solved over basic blocks for the names that are live into
+// some block; a temp used only in the block that defines it never enters
+// the bitsets. The interference graph is colored greedily, vectors first
+// and then words, each name at the lowest aligned offset none of its
+// neighbours overlaps.
+//
+// Arrays sit below the slots, each ARRAY quad's elements for the length
+// of the call.
+#define FRAME_RESULT 0
+#define FRAME_ARG1   1
+#define FRAME_ARG2   2
+#define FRAME_FIELDS 3
+
+void layoutFrames(Compiler *cc);
+
+// Bytes below BP of the slot holding code[index]'s field, or 0 when the
+// field is not a name; a FUNC quad's result gives its frame size instead,
+// and an ARRAY quad's arg1 where its element 0 is
+int frameSlot(Compiler *cc, int index, int field);
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "headers.h"
+#include "stats.h"
+
+#define READ_CHUNK 65536
+
+static HeaderEntry *headerBuckets[HEADER_BUCKETS];
+static pthread_mutex_t headerLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int readAll(int fd, SourceText *text) {
+    size_t capacity = 0;
+    ssize_t n;
+    text->data = NULL;
+    text->length = 0;
+    text->mapped = 0;
+    do {
+        if (text->length + READ_CHUNK > capacity) {
+            capacity = capacity ? capacity * 2 : READ_CHUNK;
+            text->data = (char*)xrealloc(text->data, capacity);
+        }
+        n = read(fd, text->data + text->length, capacity - text->length);
+        if (n > 0) text->length += n;
+    } while (n > 0);
+    if (n < 0) {
+        free(text->data);
+        text->data = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// "-" is standard input, read through without closing it so the next
+// compilation in the process can use it too
+int loadSource(const char *path, SourceText *text) {
+    if (strcmp(path, "-") == 0) return readAll(STDIN_FILENO, text);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    int ok = 1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        text->length = st.st_size;
+        text->mapped = st.st_size > 0;
+        text->data = NULL;
+        if (text->mapped) {
+            void *data = mmap(NULL, text->length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                text->mapped = 0;
+                ok = 0;
+            } else {
+                madvise(data, text->length, MADV_SEQUENTIAL);
+                text->data = (char*)data;
+            }
+        }
+    } else {
+        ok = readAll(fd, text);
+    }
+    close(fd);
+    return ok;
+}
+
+void unloadSource(SourceText *text) {
+    if (text->mapped) munmap(text->data, text->length);
+    else free(text->data);
+    text->data = NULL;
+    text->length = 0;
+}
+
+static unsigned pathBucket(const char *path) {
+    unsigned hash = 0;
+    for (; *path; path++) hash = hash * 31 + (unsigned char)*path;
+    return hash & (HEADER_BUCKETS - 1);
+}
+
+static int isDirective(const Token *tokens, int count, int i, const char *name) {
+    return tokens[i].type == TOKEN_PREPROCESSOR && i + 1 < count && strcmp(tokens[i + 1].lexeme, name) == 0;
+}
+
+// A header of the form #ifndef X / #define X ... #endif, with nothing but
+// comments outside, is a no-op once X is defined; X is its guard
+static void detectGuard(HeaderEntry *header) {
+    const Token *t = header->tokens;
+    int n = header->count;
+    if (n < 8 || !isDirective(t, n, 0, "ifndef") || t[2].type != TOKEN_IDENTIFIER ||
+        t[3].type != TOKEN_DIRECTIVE_END || !isDirective(t, n, 4, "define") ||
+        strcmp(t[6].lexeme, t[2].lexeme) != 0) {
+        return;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < n; i++) {
+        if (t[i].type != TOKEN_PREPROCESSOR) continue;
+        if (isDirective(t, n, i, "if") || isDirective(t, n, i, "ifdef") || isDirective(t, n, i, "ifndef")) {
+            depth++;
+        } else if (depth == 1 && (isDirective(t, n, i, "else") || isDirective(t, n, i, "elif"))) {
+            return;
+        } else if (isDirective(t, n, i, "endif") && --depth == 0) {
+            while (t[i].type != TOKEN_DIRECTIVE_END) i++;
+            if (i == n - 1) strcpy(header->guard, t[2].lexeme);
+            return;
+        }
+    }
+}
+
+static HeaderEntry* lexHeader(const char *path, const struct stat *st) {
+    SourceText text;
+    if (!loadSource(path, &text)) return NULL;
+
+    HeaderEntry *header = (HeaderEntry*)xcalloc(1, sizeof(HeaderEntry));
+    header->path = (char*)xmalloc(strlen(path) + 1);
+    strcpy(header->path, path);
+    header->device = st->st_dev;
+    header->inode = st->st_ino;
+    header->size = st->st_size;
+    header->modified = st->st_mtim;
+
+    Scanner scanner;
+    int capacity = 0;
+    initScanner(&scanner, text.data, text.length);
+    for (;;) {
+        if (header->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            header->tokens = (Token*)xrealloc(header->tokens, sizeof(Token) * capacity);
+        }
+        if (!scanToken(&scanner, &header->tokens[header->count])) break;
+        header->count++;
+    }
+    unloadSource(&text);
+    detectGuard(header);
+    return header;
+}
+
+static void freeHeader(HeaderEntry *header) {
+    free(header->path);
+    free(header->tokens);
+    free(header);
+}
+
+static int isUnchanged(const HeaderEntry *header, const struct stat *st) {
+    return header->device == st->st_dev && header->inode == st->st_ino && header->size == st->st_size &&
+           header->modified.tv_sec == st->st_mtim.tv_sec && header->modified.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// The tokens of the header at path, whose stat the caller has just taken.
+// lexed is set when it had to be read, because it was new or had changed.
+// Lexing happens outside the lock; if two compilations race to lex the
+// same header, the last one's entry is kept.
+HeaderEntry* acquireHeader(const char *path, const struct stat *st, int *lexed) {
+    unsigned bucket = pathBucket(path);
+    pthread_mutex_lock(&headerLock);
+    for (HeaderEntry *header = headerBuckets[bucket]; header; header = header->next) {
+        if (strcmp(header->path, path) == 0 && isUnchanged(header, st)) {
+            header->refs++;
+            pthread_mutex_unlock(&headerLock);
+            *lexed = 0;
+            return header;
+        }
+    }
+    pthread_mutex_unlock(&headerLock);
+
+    HeaderEntry *header = lexHeader(path, st);
+    if (!header) return NULL;
+    *lexed = 1;
+    header->refs = 2;
+
+    pthread_mutex_lock(&headerLock);
+    for (HeaderEntry **link = &headerBuckets[bucket]; *link; link = &(*link)->next) {
+        HeaderEntry *old = *link;
+        if (strcmp(old->path, path) == 0) {
+            *link = old->next;
+            if (--old->refs == 0) freeHeader(old);
+            break;
+        }
+    }
+    header->next = headerBuckets[bucket];
+    headerBuckets[bucket] = header;
+    pthread_mutex_unlock(&headerLock);
+    return header;
+}
+
+void releaseHeader(HeaderEntry *header) {
+    pthread_mutex_lock(&headerLock);
+    int unused = --header->refs == 0;
+    pthread_mutex_unlock(&headerLock);
+    if (unused) freeHeader(header);
+}
@@ -0,0 +1,40 @@
+#ifndef HEADERS_H
+#define HEADERS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "lexer.h"
+
+#define HEADER_BUCKETS 256
+
+// The text of a source file: mapped when it is a regular file, read into
+// memory otherwise (standard input, a pipe)
+typedef struct {
+    char *data;
+    size_t length;
+    int mapped;
+} SourceText;
+
+int loadSource(const char *path, SourceText *text);
+void unloadSource(SourceText *text);
+
+// Header cache, shared by every compilation in the process. Each header
+// is mapped and lexed once; later includes, from this compilation or any
+// after it, reuse its tokens for as long as the file is unchanged.
+typedef struct HeaderEntry {
+    char *path;                 // as the include resolved it
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    Token *tokens;              // raw: directives are not run yet
+    int count;
+    char guard[MAX_LEXEME_LEN]; // include guard macro, or ""
+    int refs;                   // users, plus one while it is cached
+    struct HeaderEntry *next;
+} HeaderEntry;
+
+HeaderEntry* acquireHeader(const char *path, const struct stat *st, int *lexed);
+void releaseHeader(HeaderEntry *header);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "compiler.h"
+
+static void put(Compiler* cc, const char* result, const char* arg1, const char* op, const char* arg2) {
+    if (cc->inlineOutIndex == cc->inlineOutCapacity) {
+        cc->inlineOutCapacity = cc->inlineOutCapacity ? cc->inlineOutCapacity * 2 : INITIAL_CODE;
+        cc->inlineOut = (Quadruple*)xrealloc(cc->inlineOut, sizeof(Quadruple) * cc->inlineOutCapacity);
+    }
+    setQuad(&cc->inlineOut[cc->inlineOutIndex++], result, arg1, op, arg2);
+}
+
+static int isTemp(const char* name) {
+    if (name[0] != 't' || !name[1]) return 0;
+    for (int i = 1; name[i]; i++) if (!isdigit(name[i])) return 0;
+    return 1;
+}
+
+static const char* lookup(Compiler* cc, const char* name) {
+    for (int i = 0; i < cc->renameCount; i++) {
+        if (strcmp(cc->renames[i].from, name) == 0) return cc->renames[i].to;
+    }
+    return name;
+}
+
+static int addRename(Compiler* cc, const char* from, const char* to) {
+    if (lookup(cc, from) != from) return 1;
+    if (cc->renameCount >= MAX_RENAMES) return 0;
+    strncpy(cc->renames[cc->renameCount].from, from, MAX_LEN-1);
+    strncpy(cc->renames[cc->renameCount].to, to, MAX_LEN-1);
+    cc->renameCount++;
+    return 1;
+}
+
+static int compareRanges(const void *a, const void *b) {
+    return strcmp(((const FunctionRange*)a)->name, ((const FunctionRange*)b)->name);
+}
+
+static int appendFunctions(Compiler *cc, FunctionRange **funcs, int count, int *capacity) {
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "FUNC") != 0) continue;
+
+        if (count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *funcs = (FunctionRange*)xrealloc(*funcs, sizeof(FunctionRange) * *capacity);
+        }
+        FunctionRange *f = &(*funcs)[count];
+        memset(f, 0, sizeof(*f));
+        snprintf(f->name, sizeof(f->name), "%s", cc->code[i].result);
+        f->code = cc->code;
+        f->start = i;
+        f->isLeaf = 1;
+
+        int j = i + 1;
+        while (j < cc->codeIndex && strcmp(cc->code[j].op, "ARG") == 0) {
+            f->params++;
+            j++;
+        }
+        for (; j < cc->codeIndex && strcmp(cc->code[j].op, "ENDFUNC") != 0; j++) {
+            if (strcmp(cc->code[j].op, "CALL") == 0) f->isLeaf = 0;
+        }
+        if (j >= cc->codeIndex) break;
+
+        f->end = j;
+        f->size = f->end - f->start - 1 - f->params;
+        count++;
+        i = j;
+    }
+    return count;
+}
+
+// Returns the functions sorted by name in a buffer the caller frees
+int collectFunctions(Compiler *cc, FunctionRange **funcs) {
+    int capacity = 0;
+    *funcs = NULL;
+    int count = appendFunctions(cc, funcs, 0, &capacity);
+    if (count) qsort(*funcs, count, sizeof(FunctionRange), compareRanges);
+    return count;
+}
+
+// Indexes the freshly generated code of every unit in cc->callees. The
+// ranges point into the units' initial buffers, which stay unchanged while
+// the units are optimized: their inline pass writes a new buffer first.
+void collectCallees(Compiler *cc) {
+    int count = 0, capacity = 0;
+    free(cc->callees);
+    cc->callees = NULL;
+    for (int u = 0; u < cc->unitCount; u++) {
+        count = appendFunctions(&cc->units[u], &cc->callees, count, &capacity);
+    }
+    if (count) qsort(cc->callees, count, sizeof(FunctionRange), compareRanges);
+    cc->calleeCount = count;
+}
+
+// Whether some call site could pass the budget test in inlineFunctions
+static int mayInline(const FunctionRange *f) {
+    int bestBenefit = INLINE_CALL_COST + (2 + INLINE_CONST_ARG_BONUS) * f->params;
+    return f->isLeaf && f->size - bestBenefit <= INLINE_BUDGET;
+}
+
+// Streaming keeps the initial code of just the functions that could be
+// inlined, copied into cc->calleeCode since each unit is freed once it
+// is emitted. Later units can then inline them as usual.
+void keepCallees(Compiler *cc, Compiler *unit) {
+    FunctionRange *funcs = NULL;
+    int capacity = 0;
+    int count = appendFunctions(unit, &funcs, 0, &capacity);
+
+    for (int i = 0; i < count; i++) {
+        FunctionRange *f = &funcs[i];
+        if (!mayInline(f)) continue;
+
+        int length = f->end - f->start + 1;
+        if (cc->calleeCodeCount + length > cc->calleeCodeCapacity) {
+            while (cc->calleeCodeCount + length > cc->calleeCodeCapacity) {
+                cc->calleeCodeCapacity = cc->calleeCodeCapacity ? cc->calleeCodeCapacity * 2 : INITIAL_CODE;
+            }
+            cc->calleeCode = (Quadruple*)xrealloc(cc->calleeCode, sizeof(Quadruple) * cc->calleeCodeCapacity);
+        }
+        memcpy(&cc->calleeCode[cc->calleeCodeCount], &f->code[f->start], sizeof(Quadruple) * length);
+        f->end = cc->calleeCodeCount + (f->end - f->start);
+        f->start = cc->calleeCodeCount;
+        cc->calleeCodeCount += length;
+
+        // Kept in name order for findRange
+        int at = cc->calleeCount;
+        while (at > 0 && strcmp(cc->callees[at - 1].name, f->name) > 0) at--;
+        cc->callees = (FunctionRange*)xrealloc(cc->callees, sizeof(FunctionRange) * (cc->calleeCount + 1));
+        memmove(&cc->callees[at + 1], &cc->callees[at], sizeof(FunctionRange) * (cc->calleeCount - at));
+        cc->callees[at] = *f;
+        cc->calleeCount++;
+    }
+
+    // The buffer may have moved
+    for (int i = 0; i < cc->calleeCount; i++) cc->callees[i].code = cc->calleeCode;
+    free(funcs);
+}
+
+// With no functions funcs may be NULL, which bsearch must not be given
+static FunctionRange* findRange(FunctionRange *funcs, int count, const char* name) {
+    if (count == 0) return NULL;
+    FunctionRange key;
+    snprintf(key.name, sizeof(key.name), "%s", name);
+    return (FunctionRange*)bsearch(&key, funcs, count, sizeof(FunctionRange), compareRanges);
+}
+
+// Saved work per call site: the CALL/RET pair plus a PARAM and ARG per
+// argument, with extra credit for constant arguments that will fold.
+static int inlineBenefit(FunctionRange *f, Quadruple *params, int argc) {
+    int benefit = INLINE_CALL_COST + 2 * f->params;
+    for (int i = 0; i < argc; i++) {
+        if (is_number(params[i].arg1)) benefit += INLINE_CONST_ARG_BONUS;
+    }
+    return benefit;
+}
+
+static int expandCall(Compiler* cc, FunctionRange *f, Quadruple *params, const char* result) {
+    int instance = cc->inlineCount++;
+    char name[MAX_LEN + 16];
+    cc->renameCount = 0;
+
+    // Give every name defined by the callee a fresh caller-side name
+    for (int j = f->start + 1; j < f->end; j++) {
+        const Quadruple *q = &f->code[j];
+        if (!strlen(q->result) || strcmp(q->result, "RET") == 0) continue;
+        if (strcmp(q->op, "LABEL") == 0) {
+            if (!addRename(cc, q->result, newLabel(cc))) return 0;
+        } else if (isTemp(q->result)) {
+            if (lookup(cc, q->result) == q->result && !addRename(cc, q->result, newTemp(cc))) return 0;
+        } else {
+            snprintf(name, sizeof(name), "%s.%d", q->result, instance);
+            if (!addRename(cc, q->result, name)) return 0;
+        }
+    }
+
+    char* end = newLabel(cc);
+    for (int j = f->start + 1; j <= f->start + f->params; j++) {
+        put(cc, lookup(cc, f->code[j].result), params[atoi(f->code[j].arg1)].arg1, "=", "");
+    }
+    for (int j = f->start + 1 + f->params; j < f->end; j++) {
+        const Quadruple *q = &f->code[j];
+        if (strcmp(q->result, "RET") == 0) {
+            if (strlen(q->arg1)) put(cc, result, lookup(cc, q->arg1), "=", "");
+            if (j != f->end - 1) put(cc, "", "", "goto", end);
+            continue;
+        }
+        put(cc, lookup(cc, q->result), lookup(cc, q->arg1), q->op, lookup(cc, q->arg2));
+    }
+    put(cc, end, "", "LABEL", "");
+    return 1;
+}
+
+int inlineFunctions(Compiler *cc) {
+    FunctionRange *funcs;
+    int funcCount;
+    if (cc->parent) {
+        funcs = cc->parent->callees;
+        funcCount = cc->parent->calleeCount;
+    } else {
+        funcCount = collectFunctions(cc, &funcs);
+    }
+
+    int inlined = 0;
+    cc->inlineOutIndex = 0;
+    if (!cc->renames) cc->renames = (Rename*)xcalloc(MAX_RENAMES, sizeof(Rename));
+
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "PARAM") == 0) {
+            // Held back until we know whether the CALL gets expanded
+            continue;
+        }
+
+        if (strcmp(cc->code[i].op, "CALL") == 0) {
+            int argc = atoi(cc->code[i].arg2);
+            Quadruple *params = &cc->code[i - argc];
+            FunctionRange *f = findRange(funcs, funcCount, cc->code[i].arg1);
+
+            if (f && f->isLeaf && f->params == argc) {
+                int benefit = inlineBenefit(f, params, argc);
+                if (f->size - benefit <= INLINE_BUDGET && expandCall(cc, f, params, cc->code[i].result)) {
+                    if (cc->options->dumpFlags & DUMP_PASSES) {
+                        outPrintf(&cc->dumpOutput, "Inlined call to %s at line %d (size %d, benefit %d)\n",
+                                  f->name, i, f->size, benefit);
+                    }
+                    inlined++;
+                    continue;
+                }
+            }
+        }
+
+        // Flush the PARAM run that precedes an unexpanded CALL
+        if (strcmp(cc->code[i].op, "CALL") == 0) {
+            for (int j = i - atoi(cc->code[i].arg2); j < i; j++) {
+                put(cc, cc->code[j].result, cc->code[j].arg1, cc->code[j].op, cc->code[j].arg2);
+            }
+        }
+        put(cc, cc->code[i].result, cc->code[i].arg1, cc->code[i].op, cc->code[i].arg2);
+    }
+
+    if (!cc->parent) free(funcs);
+
+    // The rewritten stream becomes the code array; the old one is reused
+    // as the next output buffer
+    Quadruple *old = cc->code;
+    int oldCapacity = cc->codeCapacity;
+    cc->code = cc->inlineOut;
+    cc->codeCapacity = cc->inlineOutCapacity;
+    cc->codeIndex = cc->inlineOutIndex;
+    cc->inlineOut = old;
+    cc->inlineOutCapacity = oldCapacity;
+    return inlined;
+}
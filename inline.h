@@ -0,0 +1,33 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "codegen.h"
+
+// Size/benefit heuristic: a leaf callee is inlined when its body, minus
+// the call overhead it saves, fits in INLINE_BUDGET quads.
+#define INLINE_BUDGET 8
+#define INLINE_CALL_COST 2
+#define INLINE_CONST_ARG_BONUS 2
+#define MAX_RENAMES 256
+
+typedef struct {
+    char from[MAX_LEN];
+    char to[MAX_LEN];
+} Rename;
+
+typedef struct {
+    char name[MAX_LEN];
+    const Quadruple *code;
+    int start;      // index of the FUNC quad
+    int end;        // index of the ENDFUNC quad
+    int params;
+    int size;       // quads between the ARG bindings and ENDFUNC
+    int isLeaf;
+} FunctionRange;
+
+int collectFunctions(Compiler *cc, FunctionRange **funcs);
+void collectCallees(Compiler *cc);
+void keepCallees(Compiler *cc, Compiler *unit);
+int inlineFunctions(Compiler *cc);
+
+#endif
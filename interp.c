@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include "compiler.h"
+#include "interp.h"
+
+typedef enum {
+    RUN_NOP, RUN_COPY, RUN_ADD, RUN_SUB, RUN_MUL, RUN_DIV, RUN_SHL, RUN_SAR, RUN_AND,
+    RUN_EQ, RUN_NE, RUN_LT, RUN_GT, RUN_LE, RUN_GE,
+    RUN_FADD, RUN_FSUB, RUN_FMUL, RUN_FDIV,
+    RUN_FEQ, RUN_FNE, RUN_FLT, RUN_FGT, RUN_FLE, RUN_FGE,
+    RUN_ITOF, RUN_FTOI, RUN_ARRAY, RUN_LOAD, RUN_STORE, RUN_DIST,
+    RUN_VLOAD, RUN_VSTORE, RUN_VSPLAT, RUN_VSTEP, RUN_VADD, RUN_VSUB, RUN_VMUL, RUN_VAND, RUN_VSHL, RUN_VSAR,
+    RUN_VFADD, RUN_VFSUB, RUN_VFMUL, RUN_VFDIV,
+    RUN_ARG, RUN_PARAM, RUN_CALL, RUN_RET, RUN_GOTO, RUN_IFFALSE
+} RunOp;
+
+static const struct {
+    const char *name;
+    RunOp op;
+} runOps[] = {
+    {"=", RUN_COPY}, {"+", RUN_ADD}, {"-", RUN_SUB}, {"*", RUN_MUL}, {"/", RUN_DIV},
+    {"<<", RUN_SHL}, {">>", RUN_SAR}, {"&", RUN_AND},
+    {"==", RUN_EQ}, {"!=", RUN_NE}, {"<", RUN_LT}, {">", RUN_GT}, {"<=", RUN_LE}, {">=", RUN_GE},
+    {"f+", RUN_FADD}, {"f-", RUN_FSUB}, {"f*", RUN_FMUL}, {"f/", RUN_FDIV},
+    {"f==", RUN_FEQ}, {"f!=", RUN_FNE}, {"f<", RUN_FLT}, {"f>", RUN_FGT}, {"f<=", RUN_FLE}, {"f>=", RUN_FGE},
+    {"itof", RUN_ITOF}, {"ftoi", RUN_FTOI}, {"ARRAY", RUN_ARRAY}, {"[]", RUN_LOAD}, {"[]=", RUN_STORE}, {"DIST", RUN_DIST},
+    {"V[]", RUN_VLOAD}, {"V[]=", RUN_VSTORE}, {"VSPLAT", RUN_VSPLAT}, {"VSTEP", RUN_VSTEP},
+    {"V+", RUN_VADD}, {"V-", RUN_VSUB}, {"V*", RUN_VMUL}, {"V&", RUN_VAND}, {"V<<", RUN_VSHL}, {"V>>", RUN_VSAR},
+    {"Vf+", RUN_VFADD}, {"Vf-", RUN_VFSUB}, {"Vf*", RUN_VFMUL}, {"Vf/", RUN_VFDIV},
+    {"ARG", RUN_ARG}, {"PARAM", RUN_PARAM}, {"CALL", RUN_CALL}, {"goto", RUN_GOTO}, {"iffalse", RUN_IFFALSE},
+    {"LABEL", RUN_NOP},
+};
+
+typedef struct {
+    Compiler *cc;
+    RunFunction *functions;
+    int functionCount;
+    Word *memory;
+    int top;                        // first free word
+    Word args[MAX_ARGS];            // PARAMs of the call being set up
+    const char *argText[MAX_ARGS];  // their string literals
+    int argCount;
+    int depth;
+    long executed;
+    long vectorExecuted;
+
+    jmp_buf onError;
+    char error[MAX_LEN * 2];
+} Machine;
+
+static void runError(Machine *m, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(m->error, sizeof(m->error), fmt, args);
+    va_end(args);
+    longjmp(m->onError, 1);
+}
+
+static RunOp lookupOp(Machine *m, const Quadruple *q) {
+    if (strcmp(q->result, "RET") == 0) return RUN_RET;
+    for (size_t i = 0; i < sizeof(runOps) / sizeof(runOps[0]); i++) {
+        if (strcmp(runOps[i].name, q->op) == 0) return runOps[i].op;
+    }
+    runError(m, "Cannot run '%s'", q->op);
+    return RUN_NOP;
+}
+
+// ---------- loading ----------
+
+// Labels of one function, by open addressing over the quads' own strings
+typedef struct {
+    const char **names;
+    int *slots;
+    unsigned mask;
+} SlotTable;
+
+static unsigned hashText(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static int *findSlot(SlotTable *t, const char *name) {
+    unsigned h = hashText(name) & t->mask;
+    while (t->names[h] && strcmp(t->names[h], name) != 0) h = (h + 1) & t->mask;
+    if (!t->names[h]) {
+        t->names[h] = name;
+        t->slots[h] = -1;
+    }
+    return &t->slots[h];
+}
+
+// A name's slot is where layoutFrames put it: slotWords is the frame,
+// and a name frameSlot() bytes below BP starts that far below its top
+static int nameSlot(RunFunction *f, int frameBytes) {
+    return f->slotWords - frameBytes / WORD_SIZE;
+}
+
+static Operand operand(RunFunction *f, char *text, int frameBytes) {
+    Operand o;
+    memset(&o, 0, sizeof(o));
+    o.text = text;
+    if (!text[0]) {
+        o.kind = OPERAND_NONE;
+    } else if (is_number(text)) {
+        o.kind = OPERAND_CONSTANT;
+        o.value.i = atoi(text);
+    } else if (is_float(text)) {
+        o.kind = OPERAND_CONSTANT;
+        o.value.f = strtof(text, NULL);
+    } else if (text[0] == '"') {
+        o.kind = OPERAND_STRING;
+    } else if (text[0] == '\'') {
+        o.kind = OPERAND_CONSTANT;
+        o.value.i = text[1] == '\\' ? (text[2] == 'n' ? '\n' : text[2] == 't' ? '\t' : text[2] == '0' ? 0 : text[2])
+                                    : (unsigned char)text[1];
+    } else {
+        o.kind = OPERAND_SLOT;
+        o.slot = nameSlot(f, frameBytes);
+    }
+    return o;
+}
+
+static Operand operandAt(RunFunction *f, Compiler *unit, int index, int field) {
+    Quadruple *q = &unit->code[index];
+    char *text = field == FRAME_RESULT ? q->result : field == FRAME_ARG1 ? q->arg1 : q->arg2;
+    return operand(f, text, frameSlot(unit, index, field));
+}
+
+// Translates code[start] (a FUNC) up to its ENDFUNC into instructions
+// with names resolved to the unit's frame layout and labels to
+// instruction indices. Running the program therefore checks the layout:
+// two names wrongly sharing a slot change what it computes.
+static int loadFunction(Machine *m, RunFunction *f, Compiler *unit, int start, int end) {
+    Quadruple *code = unit->code;
+    int count = end - start - 1;
+    SlotTable labels;
+    unsigned buckets = 16;
+    while (buckets < (unsigned)count * 2 + 8) buckets *= 2;
+    labels.names = (const char**)xcalloc(buckets, sizeof(char*));
+    labels.slots = (int*)xmalloc(sizeof(int) * buckets);
+    labels.mask = buckets - 1;
+
+    f->name = code[start].result;
+    f->code = (Instr*)xcalloc(count ? count : 1, sizeof(Instr));
+    f->count = count;
+    f->slotWords = frameSlot(unit, start, FRAME_RESULT) / WORD_SIZE;
+
+    // Labels are numbered first so jumps forward resolve
+    for (int i = 0; i < count; i++) {
+        Quadruple *q = &code[start + 1 + i];
+        if (strcmp(q->op, "LABEL") == 0) *findSlot(&labels, q->result) = i;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int index = start + 1 + i;
+        Quadruple *q = &code[index];
+        Instr *in = &f->code[i];
+        in->op = lookupOp(m, q);
+        in->result = -1;
+        switch (in->op) {
+            case RUN_NOP:
+                break;
+            case RUN_GOTO:
+            case RUN_IFFALSE:
+                in->a = operandAt(f, unit, index, FRAME_ARG1);
+                in->target = *findSlot(&labels, q->arg2);
+                if (in->target < 0) runError(m, "Jump to undefined label %s in %s", q->arg2, f->name);
+                break;
+            case RUN_ARRAY:
+                in->result = operandAt(f, unit, index, FRAME_RESULT).slot;
+                in->target = nameSlot(f, frameSlot(unit, index, FRAME_ARG1));
+                break;
+            case RUN_ARG:
+                in->result = operandAt(f, unit, index, FRAME_RESULT).slot;
+                in->count = atoi(q->arg1);
+                break;
+            case RUN_CALL:
+                in->result = operandAt(f, unit, index, FRAME_RESULT).slot;
+                in->name = q->arg1;
+                in->count = atoi(q->arg2);
+                in->target = -1;
+                for (int k = 0; k < m->functionCount; k++) {
+                    if (strcmp(m->functions[k].name, q->arg1) == 0) in->target = k;
+                }
+                break;
+            case RUN_STORE:
+            case RUN_VSTORE:
+                // The array is in result, which is read
+                in->result = operandAt(f, unit, index, FRAME_RESULT).slot;
+                in->a = operandAt(f, unit, index, FRAME_ARG1);
+                in->b = operandAt(f, unit, index, FRAME_ARG2);
+                break;
+            case RUN_RET:
+            case RUN_PARAM:
+                in->a = operandAt(f, unit, index, FRAME_ARG1);
+                break;
+            default:
+                in->result = operandAt(f, unit, index, FRAME_RESULT).slot;
+                in->a = operandAt(f, unit, index, FRAME_ARG1);
+                in->b = operandAt(f, unit, index, FRAME_ARG2);
+                break;
+        }
+    }
+    free(labels.names);
+    free(labels.slots);
+    return count;
+}
+
+// Every FUNC ... ENDFUNC range of every unit; names first, so calls can
+// be resolved while loading
+static void loadProgram(Machine *m, Compiler *cc) {
+    int capacity = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        int index = 0;
+        for (int u = 0; u < cc->unitCount; u++) {
+            Compiler *unit = &cc->units[u];
+            for (int i = 0; i < unit->codeIndex; i++) {
+                if (strcmp(unit->code[i].op, "FUNC") != 0) continue;
+                int end = i + 1;
+                while (end < unit->codeIndex && strcmp(unit->code[end].op, "ENDFUNC") != 0) end++;
+                if (pass == 0) {
+                    if (m->functionCount == capacity) {
+                        capacity = capacity ? capacity * 2 : 16;
+                        m->functions = (RunFunction*)xrealloc(m->functions, sizeof(RunFunction) * capacity);
+                    }
+                    memset(&m->functions[m->functionCount], 0, sizeof(RunFunction));
+                    m->functions[m->functionCount++].name = unit->code[i].result;
+                } else {
+                    loadFunction(m, &m->functions[index++], unit, i, end);
+                }
+                i = end;
+            }
+        }
+    }
+}
+
+// ---------- running ----------
+
+static Word value(const Word *frame, const Operand *o) {
+    return o->kind == OPERAND_SLOT ? frame[o->slot] : o->value;
+}
+
+static void checkAddress(Machine *m, const RunFunction *f, int address, int words) {
+    if (address < 0 || address + words > m->top) runError(m, "Array access out of bounds in %s", f->name);
+}
+
+// The lexer doubles each backslash in a string literal, so "\n" in the
+// source is \\n in the TAC; *p is at the first backslash
+static char unescape(const char **p) {
+    const char *s = *p + 1;
+    if (*s == '\\') s++;
+    *p = s;
+    switch (*s) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case '0': return '\0';
+        default: return *s;
+    }
+}
+
+// printf for the conversions C programs here use: d i u x c f g e s %
+static int runPrintf(Machine *m, const char *format, const Word *args, const char **texts, int count) {
+    char out[RUN_MAX_OUTPUT];
+    int length = 0, next = 1;
+    if (!format || format[0] != '"') runError(m, "printf needs a string literal format");
+
+    for (const char *p = format + 1; *p && *p != '"' && length < RUN_MAX_OUTPUT - 64; p++) {
+        if (*p == '\\' && p[1]) {
+            out[length++] = unescape(&p);
+        } else if (*p == '%' && p[1] == '%') {
+            out[length++] = '%';
+            p++;
+        } else if (*p == '%') {
+            char spec[32];
+            int n = 0;
+            while (p[n] && !strchr("diuxcfgesp", p[n]) && n < 24) n++;
+            memcpy(spec, p, n + 1);
+            spec[n + 1] = '\0';
+            char conversion = p[n];
+            p += n;
+            if (next >= count) runError(m, "printf has too few arguments");
+            Word arg = args[next];
+            const char *text = texts[next++];
+            int room = RUN_MAX_OUTPUT - 64 - length;
+            if (conversion == 's') {
+                char buffer[MAX_LEN];
+                int k = 0;
+                for (const char *s = text ? text + 1 : ""; *s && *s != '"' && k < MAX_LEN - 1; s++) {
+                    buffer[k++] = *s == '\\' && s[1] ? unescape(&s) : *s;
+                }
+                buffer[k] = '\0';
+                length += snprintf(out + length, room, spec, buffer);
+            } else if (strchr("fge", conversion)) {
+                length += snprintf(out + length, room, spec, (double)arg.f);
+            } else {
+                length += snprintf(out + length, room, spec, arg.i);
+            }
+            if (length > RUN_MAX_OUTPUT - 64) length = RUN_MAX_OUTPUT - 64;
+        } else {
+            out[length++] = *p;
+        }
+    }
+    outWrite(&m->cc->dumpOutput, out, length);
+    return length;
+}
+
+static int intOp(Machine *m, RunOp op, int a, int b) {
+    unsigned ua = (unsigned)a, ub = (unsigned)b;
+    switch (op) {
+        case RUN_ADD: case RUN_VADD: return (int)(ua + ub);
+        case RUN_SUB: case RUN_VSUB: return (int)(ua - ub);
+        case RUN_MUL: case RUN_VMUL: return (int)(ua * ub);
+        case RUN_DIV:
+            if (b == 0) runError(m, "Division by zero");
+            return b == -1 ? (int)(0u - ua) : a / b;
+        case RUN_SHL: case RUN_VSHL: return (int)(ua << (b & 31));
+        case RUN_SAR: case RUN_VSAR: return a >> (b & 31);
+        case RUN_AND: case RUN_VAND: return a & b;
+        case RUN_EQ: return a == b;
+        case RUN_NE: return a != b;
+        case RUN_LT: return a < b;
+        case RUN_GT: return a > b;
+        case RUN_LE: return a <= b;
+        case RUN_GE: return a >= b;
+        default: return 0;
+    }
+}
+
+static Word floatOp(RunOp op, float a, float b) {
+    Word w;
+    switch (op) {
+        case RUN_FADD: case RUN_VFADD: w.f = a + b; break;
+        case RUN_FSUB: case RUN_VFSUB: w.f = a - b; break;
+        case RUN_FMUL: case RUN_VFMUL: w.f = a * b; break;
+        case RUN_FDIV: case RUN_VFDIV: w.f = a / b; break;
+        case RUN_FEQ: w.i = a == b; break;
+        case RUN_FNE: w.i = a != b; break;
+        case RUN_FLT: w.i = a < b; break;
+        case RUN_FGT: w.i = a > b; break;
+        case RUN_FLE: w.i = a <= b; break;
+        default: w.i = a >= b; break;
+    }
+    return w;
+}
+
+static Word callFunction(Machine *m, int index, const Word *args, int argc) {
+    RunFunction *f = &m->functions[index];
+    Word result = {0};
+    if (++m->depth > RUN_MAX_DEPTH) runError(m, "Call depth exceeds %d", RUN_MAX_DEPTH);
+
+    int base = m->top;
+    int words = f->slotWords;
+    if (words > RUN_MEMORY_WORDS - base) runError(m, "Out of memory in %s", f->name);
+    Word *frame = m->memory + base;
+    memset(frame, 0, sizeof(Word) * words);
+    m->top += words;
+
+    for (int pc = 0; pc < f->count; pc++) {
+        Instr *in = &f->code[pc];
+        Word a = value(frame, &in->a), b = value(frame, &in->b);
+        if (in->op != RUN_NOP) m->executed++;
+
+        switch (in->op) {
+            case RUN_NOP:
+                break;
+            case RUN_COPY:
+                frame[in->result] = a;
+                break;
+            case RUN_ADD: case RUN_SUB: case RUN_MUL: case RUN_DIV: case RUN_SHL: case RUN_SAR: case RUN_AND:
+            case RUN_EQ: case RUN_NE: case RUN_LT: case RUN_GT: case RUN_LE: case RUN_GE:
+                frame[in->result].i = intOp(m, in->op, a.i, b.i);
+                break;
+            case RUN_FADD: case RUN_FSUB: case RUN_FMUL: case RUN_FDIV:
+            case RUN_FEQ: case RUN_FNE: case RUN_FLT: case RUN_FGT: case RUN_FLE: case RUN_FGE:
+                frame[in->result] = floatOp(in->op, a.f, b.f);
+                break;
+            case RUN_ITOF:
+                frame[in->result].f = (float)a.i;
+                break;
+            case RUN_FTOI:
+                frame[in->result].i = (int)a.f;
+                break;
+            case RUN_ARRAY:
+                frame[in->result].i = base + in->target;
+                break;
+            case RUN_LOAD:
+                checkAddress(m, f, a.i + b.i, 1);
+                frame[in->result] = m->memory[a.i + b.i];
+                break;
+            case RUN_STORE:
+                checkAddress(m, f, frame[in->result].i + a.i, 1);
+                m->memory[frame[in->result].i + a.i] = b;
+                break;
+            case RUN_DIST:
+                frame[in->result].i = a.i - b.i;
+                break;
+            case RUN_VLOAD:
+                checkAddress(m, f, a.i + b.i, VECTOR_WIDTH);
+                memcpy(&frame[in->result], &m->memory[a.i + b.i], sizeof(Word) * VECTOR_WIDTH);
+                m->vectorExecuted++;
+                break;
+            case RUN_VSTORE:
+                checkAddress(m, f, frame[in->result].i + a.i, VECTOR_WIDTH);
+                memcpy(&m->memory[frame[in->result].i + a.i], &frame[in->b.slot], sizeof(Word) * VECTOR_WIDTH);
+                m->vectorExecuted++;
+                break;
+            case RUN_VSPLAT:
+                for (int k = 0; k < VECTOR_WIDTH; k++) frame[in->result + k] = a;
+                m->vectorExecuted++;
+                break;
+            case RUN_VSTEP:
+                for (int k = 0; k < VECTOR_WIDTH; k++) frame[in->result + k].i = (int)((unsigned)a.i + k);
+                m->vectorExecuted++;
+                break;
+            case RUN_VADD: case RUN_VSUB: case RUN_VMUL: case RUN_VAND: case RUN_VSHL: case RUN_VSAR:
+                for (int k = 0; k < VECTOR_WIDTH; k++) {
+                    frame[in->result + k].i = intOp(m, in->op, frame[in->a.slot + k].i, frame[in->b.slot + k].i);
+                }
+                m->vectorExecuted++;
+                break;
+            case RUN_VFADD: case RUN_VFSUB: case RUN_VFMUL: case RUN_VFDIV:
+                for (int k = 0; k < VECTOR_WIDTH; k++) {
+                    frame[in->result + k] = floatOp(in->op, frame[in->a.slot + k].f, frame[in->b.slot + k].f);
+                }
+                m->vectorExecuted++;
+                break;
+            case RUN_ARG:
+                if (in->count >= argc) runError(m, "%s expects more arguments", f->name);
+                frame[in->result] = args[in->count];
+                break;
+            case RUN_PARAM:
+                if (m->argCount >= MAX_ARGS) runError(m, "Too many arguments");
+                m->argText[m->argCount] = in->a.kind == OPERAND_STRING ? in->a.text : NULL;
+                m->args[m->argCount++] = a;
+                break;
+            case RUN_CALL: {
+                Word callArgs[MAX_ARGS];
+                const char *texts[MAX_ARGS];
+                int count = m->argCount;
+                memcpy(callArgs, m->args, sizeof(Word) * count);
+                memcpy(texts, m->argText, sizeof(char*) * count);
+                m->argCount = 0;
+                if (in->target >= 0) {
+                    frame[in->result] = callFunction(m, in->target, callArgs, count);
+                } else if (strcmp(in->name, "printf") == 0) {
+                    frame[in->result].i = runPrintf(m, count ? texts[0] : NULL, callArgs, texts, count);
+                } else {
+                    runError(m, "Call to undefined function '%s'", in->name);
+                }
+                break;
+            }
+            case RUN_RET:
+                result = a;
+                pc = f->count;
+                break;
+            case RUN_GOTO:
+                pc = in->target;
+                break;
+            case RUN_IFFALSE:
+                if (a.i == 0) pc = in->target;
+                break;
+        }
+    }
+
+    m->top = base;
+    m->depth--;
+    return result;
+}
+
+// Runs main() with no arguments. Its output goes to the dump stream and
+// a summary to the diagnostics; a run-time error is a compile error.
+void runProgram(Compiler *cc) {
+    Machine m;
+    memset(&m, 0, sizeof(m));
+    m.cc = cc;
+    m.memory = (Word*)xmalloc(sizeof(Word) * RUN_MEMORY_WORDS);
+
+    int failed = setjmp(m.onError);
+    if (!failed) {
+        loadProgram(&m, cc);
+        int main = -1;
+        for (int i = 0; i < m.functionCount; i++) {
+            if (strcmp(m.functions[i].name, "main") == 0) main = i;
+        }
+        if (main < 0) runError(&m, "No main function");
+        Word status = callFunction(&m, main, NULL, 0);
+        outPrintf(&cc->diagnostics, "%s: main returned %d after %ld instructions (%ld vector)\n",
+                  cc->source, status.i, m.executed, m.vectorExecuted);
+    }
+
+    for (int i = 0; i < m.functionCount; i++) free(m.functions[i].code);
+    free(m.functions);
+    free(m.memory);
+    if (failed) compileError(cc, "Run error: %s", m.error);
+}
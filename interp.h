@@ -0,0 +1,55 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "codegen.h"
+
+// TAC interpreter. -run executes main() from the optimized code of every
+// unit once the file is compiled, so a transformation can be checked by
+// running the program with and without it: the return value and the
+// output must match, and the executed instruction count shows what it
+// saved. Vector instructions count once for all their lanes.
+
+#define RUN_MEMORY_WORDS (1 << 24)  // frames and arrays, 64 MB
+#define RUN_MAX_DEPTH 10000
+#define RUN_MAX_OUTPUT 1024         // one printf
+
+typedef union {
+    int i;
+    float f;
+} Word;
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_SLOT,       // a name: a word, or VECTOR_WIDTH words, in the frame
+    OPERAND_CONSTANT,
+    OPERAND_STRING      // a string literal, as written
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int slot;
+    Word value;
+    const char *text;
+} Operand;
+
+typedef struct {
+    int op;             // RunOp
+    int result;         // frame slot, or -1
+    Operand a;
+    Operand b;
+    int target;         // jump: instruction index; call: function, or -1
+                        // when external; ARRAY: slot of element 0
+    int count;          // CALL: arguments; ARG: index
+    const char *name;   // callee
+} Instr;
+
+typedef struct {
+    const char *name;
+    Instr *code;
+    int count;
+    int slotWords;      // the frame, arrays included, as layoutFrames packed it
+} RunFunction;
+
+void runProgram(Compiler *cc);
+
+#endif
@@ -2,10 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include "lexer.h"
-
-Token tokenTable[MAX_TOKENS];
-int tokenCount = 0;
+#include "compiler.h"
 
 char *keywords[] = {
     "auto", "break", "case", "char", "const", "continue", "default", "do",
@@ -14,10 +11,33 @@ char *keywords[] = {
     "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while"
 };
 
+// Keywords are interned once per process in an open-addressed table, so
+// each identifier costs one hash and usually one strcmp
+#define KEYWORD_COUNT 32
+#define KEYWORD_SLOTS 128
+
+static const char *keywordSlots[KEYWORD_SLOTS];
+static pthread_once_t keywordsOnce = PTHREAD_ONCE_INIT;
+
+static unsigned keywordHash(const char *str) {
+    unsigned hash = 0;
+    for (; *str; str++) hash = hash * 31 + (unsigned char)*str;
+    return hash & (KEYWORD_SLOTS - 1);
+}
+
+static void internKeywords(void) {
+    for (int i = 0; i < KEYWORD_COUNT; i++) {
+        unsigned slot = keywordHash(keywords[i]);
+        while (keywordSlots[slot]) slot = (slot + 1) & (KEYWORD_SLOTS - 1);
+        keywordSlots[slot] = keywords[i];
+    }
+}
+
 int isKeyword(char *str) {
-    for (int i = 0; i < 32; i++)
-        if (strcmp(str, keywords[i]) == 0)
-            return 1;
+    pthread_once(&keywordsOnce, internKeywords);
+    for (unsigned slot = keywordHash(str); keywordSlots[slot]; slot = (slot + 1) & (KEYWORD_SLOTS - 1)) {
+        if (strcmp(str, keywordSlots[slot]) == 0) return 1;
+    }
     return 0;
 }
 
@@ -29,203 +49,266 @@ int isPunctuation(char ch) {
     return strchr(";,(){}[]", ch) != NULL;
 }
 
-void addToken(int type, const char *lexeme, int line) {
-    tokenTable[tokenCount].type = type;
-    strncpy(tokenTable[tokenCount].lexeme, lexeme, MAX_LEXEME_LEN);
-    tokenTable[tokenCount].line = line;
-    tokenCount++;
-}
-
-void printTokenTable() {
-    printf("\n%-15s %-20s %-10s\n", "TOKEN TYPE", "LEXEME", "LINE");
-    printf("-----------------------------------------------------\n");
-    for (int i = 0; i < tokenCount; i++) {
-        // You need a helper to print type names as strings:
-        const char *typeName;
-        switch(tokenTable[i].type) {
-            case TOKEN_KEYWORD: typeName = "KEYWORD"; break;
-            case TOKEN_IDENTIFIER: typeName = "IDENTIFIER"; break;
-            case TOKEN_NUMBER: typeName = "NUMBER"; break;
-            case TOKEN_FLOAT: typeName = "FLOAT"; break;
-            case TOKEN_STRING: typeName = "STRING"; break;
-            case TOKEN_CHAR: typeName = "CHAR"; break;
-            case TOKEN_OPERATOR: typeName = "OPERATOR"; break;
-            case TOKEN_PUNCTUATION: typeName = "PUNCTUATION"; break;
-            case TOKEN_COMMENT: typeName = "COMMENT"; break;
-            case TOKEN_PREPROCESSOR: typeName = "PREPROCESSOR"; break;
-            case TOKEN_UNKNOWN: typeName = "UNKNOWN"; break;
-            default: typeName = "INVALID"; break;
-        }
-
-        printf("%-15s %-20s %-10d\n", typeName, tokenTable[i].lexeme, tokenTable[i].line);
+static void addToken(Compiler *cc, const Token *tok) {
+    if (cc->tokenCount == cc->tokenCapacity) {
+        cc->tokenCapacity = cc->tokenCapacity ? cc->tokenCapacity * 2 : INITIAL_TOKENS;
+        cc->tokenTable = (Token*)xrealloc(cc->tokenTable, sizeof(Token) * cc->tokenCapacity);
     }
+    cc->tokenTable[cc->tokenCount++] = *tok;
 }
 
-void exportTokenTable(const char *outFilename) {
-    FILE *out = fopen(outFilename, "w");
-    if (!out) {
-        printf("Failed to write token table.\n");
-        return;
+const char* tokenTypeName(int type) {
+    switch (type) {
+        case TOKEN_KEYWORD: return "KEYWORD";
+        case TOKEN_IDENTIFIER: return "IDENTIFIER";
+        case TOKEN_NUMBER: return "NUMBER";
+        case TOKEN_FLOAT: return "FLOAT";
+        case TOKEN_STRING: return "STRING";
+        case TOKEN_CHAR: return "CHAR";
+        case TOKEN_OPERATOR: return "OPERATOR";
+        case TOKEN_PUNCTUATION: return "PUNCTUATION";
+        case TOKEN_COMMENT: return "COMMENT";
+        case TOKEN_PREPROCESSOR: return "PREPROCESSOR";
+        case TOKEN_UNKNOWN: return "UNKNOWN";
+        default: return "INVALID";
     }
-    fprintf(out, "%-15s %-20s %-10s\n", "TOKEN TYPE", "LEXEME", "LINE");
-    fprintf(out, "-----------------------------------------------------\n");
-    for (int i = 0; i < tokenCount; i++) {
-        const char *typeName;
-        switch(tokenTable[i].type) {
-            case TOKEN_KEYWORD: typeName = "KEYWORD"; break;
-            case TOKEN_IDENTIFIER: typeName = "IDENTIFIER"; break;
-            case TOKEN_NUMBER: typeName = "NUMBER"; break;
-            case TOKEN_FLOAT: typeName = "FLOAT"; break;
-            case TOKEN_STRING: typeName = "STRING"; break;
-            case TOKEN_CHAR: typeName = "CHAR"; break;
-            case TOKEN_OPERATOR: typeName = "OPERATOR"; break;
-            case TOKEN_PUNCTUATION: typeName = "PUNCTUATION"; break;
-            case TOKEN_COMMENT: typeName = "COMMENT"; break;
-            case TOKEN_PREPROCESSOR: typeName = "PREPROCESSOR"; break;
-            case TOKEN_UNKNOWN: typeName = "UNKNOWN"; break;
-            default: typeName = "INVALID"; break;
-        }
-        fprintf(out, "%-15s %-20s %-10d\n", typeName, tokenTable[i].lexeme, tokenTable[i].line);
+}
+
+static void writeTokenTable(Compiler *cc, Output *out) {
+    outPrintf(out, "%-15s %-20s %-10s\n", "TOKEN TYPE", "LEXEME", "LINE");
+    outPrintf(out, "-----------------------------------------------------\n");
+    for (int i = 0; i < cc->tokenCount; i++) {
+        outPrintf(out, "%-15s %-20s %-10d\n", tokenTypeName(cc->tokenTable[i].type),
+                  cc->tokenTable[i].lexeme, cc->tokenTable[i].line);
     }
-    fclose(out);
-    printf("✅ Token table exported to %s\n", outFilename);
 }
 
-void runLexer(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        printf("❌ Cannot open file.\n");
+void printTokenTable(Compiler *cc) {
+    outPrintf(&cc->dumpOutput, "\n");
+    writeTokenTable(cc, &cc->dumpOutput);
+}
+
+void exportTokenTable(Compiler *cc, const char *outFilename) {
+    Output out;
+    if (!openOutput(&out, outFilename)) {
+        compileWarning(cc, "Failed to write token table.");
         return;
     }
+    writeTokenTable(cc, &out);
+    if (!closeOutput(&out)) compileWarning(cc, "Failed to write token table.");
+}
 
-    char ch, buffer[100];
-    int i = 0, line = 1;
-
-    while ((ch = fgetc(fp)) != EOF) {
-        if (isspace(ch)) {
-            if (ch == '\n') line++;
-            continue;
-        }
+// Long literals are truncated to MAX_LEXEME_LEN, not overrun
+#define APPEND(c) do { char c_ = (c); if (i < MAX_LEXEME_LEN - 1) tok->lexeme[i++] = c_; } while (0)
 
-        if (ch == '#') {
-            i = 0;
-            buffer[i++] = ch;
-            while ((ch = fgetc(fp)) != '\n' && ch != EOF)
-                buffer[i++] = ch;
-            buffer[i] = '\0';
-            addToken(TOKEN_PREPROCESSOR, buffer, line++);
-            continue;
-        }
+static void setLexeme(Token *tok, const char *start, const char *end) {
+    size_t length = end - start;
+    if (length > MAX_LEXEME_LEN - 1) length = MAX_LEXEME_LEN - 1;
+    memcpy(tok->lexeme, start, length);
+    tok->lexeme[length] = '\0';
+}
 
-        if (isalpha(ch) || ch == '_') {
-            i = 0;
-            buffer[i++] = ch;
-            while (isalnum(ch = fgetc(fp)) || ch == '_')
-                buffer[i++] = ch;
-            buffer[i] = '\0';
-            ungetc(ch, fp);
-            if (isKeyword(buffer))
-                addToken(TOKEN_KEYWORD, buffer, line);
-            else
-                addToken(TOKEN_IDENTIFIER, buffer, line);
-        }
+void initScanner(Scanner *s, const char *text, size_t length) {
+    memset(s, 0, sizeof(*s));
+    s->p = text;
+    s->end = length ? text + length : text;
+    s->line = 1;
+}
 
-        else if (isdigit(ch)) {
-            i = 0;
-            buffer[i++] = ch;
-            int isFloat = 0;
-            while (isdigit(ch = fgetc(fp)) || ch == '.') {
-                if (ch == '.') isFloat = 1;
-                buffer[i++] = ch;
+// The end of the directive starting at p: its newline, unless escaped by
+// a backslash or inside a block comment, which continue it
+static const char* directiveLineEnd(const char *p, const char *end, int *lines) {
+    *lines = 0;
+    while (p < end && *p != '\n') {
+        if (*p == '\\' && p + 1 < end && p[1] == '\n') {
+            (*lines)++;
+            p += 2;
+        } else if (*p == '/' && p + 1 < end && p[1] == '/') {
+            while (p < end && *p != '\n') p++;
+        } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+            for (p += 2; p < end && !(*p == '*' && p + 1 < end && p[1] == '/'); p++) {
+                if (*p == '\n') (*lines)++;
             }
-            buffer[i] = '\0';
-            ungetc(ch, fp);
-            addToken(isFloat ? TOKEN_FLOAT : TOKEN_NUMBER, buffer, line);
+            p = p < end ? p + 2 : end;
+        } else if (*p == '"' || *p == '\'') {
+            char quote = *p++;
+            while (p < end && *p != quote && *p != '\n') p += *p == '\\' && p + 1 < end ? 2 : 1;
+            if (p < end && *p == quote) p++;
+        } else {
+            p++;
         }
+    }
+    return p;
+}
 
-        else if (ch == '"') {
-            i = 0;
-            buffer[i++] = ch;
-            while ((ch = fgetc(fp)) != '"' && ch != EOF) {
-                if (ch == '\\') buffer[i++] = ch;
-                buffer[i++] = ch;
+// Skips whitespace and comments. Comments are gone after this, as in any
+// C preprocessor; inside a directive a backslash-newline is a space.
+static const char* skipSpace(Scanner *s, const char *p, const char *end) {
+    int inDirective = s->directiveEnd != NULL;
+    for (;;) {
+        while (p < end && (isspace((unsigned char)*p) || (inDirective && *p == '\\' && p + 1 < end && p[1] == '\n'))) {
+            if (*p == '\n' && !inDirective) s->line++;
+            p++;
+        }
+        if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+            while (p < end && *p != '\n') p++;
+        } else if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            for (p += 2; p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/'); p++) {
+                if (*p == '\n' && !inDirective) s->line++;
             }
-            buffer[i++] = '"';
-            buffer[i] = '\0';
-            addToken(TOKEN_STRING, buffer, line);
+            p = p < end ? p + 2 : end;
+        } else {
+            return p;
         }
+    }
+}
 
-        else if (ch == '\'') {
-            i = 0;
-            buffer[i++] = ch;
-            ch = fgetc(fp);
-            if (ch == '\\') buffer[i++] = ch;
-            buffer[i++] = fgetc(fp);
-            buffer[i++] = fgetc(fp); 
-            buffer[i] = '\0';
-            addToken(TOKEN_CHAR, buffer, line);
-        }
+// Next token of the text; 0 at its end
+int scanToken(Scanner *s, Token *tok) {
+    const char *end = s->directiveEnd ? s->directiveEnd : s->end;
+    const char *p = skipSpace(s, s->p, end);
+    const char *start = p;
+    int i = 0;
 
-        else if (ch == '/') {
-            char next = fgetc(fp);
-            if (next == '/') {
-                i = 0;
-                buffer[i++] = '/';
-                buffer[i++] = '/';
-                while ((ch = fgetc(fp)) != '\n' && ch != EOF)
-                    buffer[i++] = ch;
-                buffer[i] = '\0';
-                addToken(TOKEN_COMMENT, buffer, line++);
-            } else if (next == '*') {
-                i = 0;
-                buffer[i++] = '/';
-                buffer[i++] = '*';
-                while ((ch = fgetc(fp)) != EOF) {
-                    buffer[i++] = ch;
-                    if (ch == '*' && (next = fgetc(fp)) == '/') {
-                        buffer[i++] = '/';
-                        break;
-                    } else if (ch == '\n') line++;
-                }
-                buffer[i] = '\0';
-                addToken(TOKEN_COMMENT, buffer, line);
-            } else {
-                buffer[0] = '/'; buffer[1] = '\0';
-                ungetc(next, fp);
-                addToken(TOKEN_OPERATOR, buffer, line);
-            }
-        }
+    s->tokenStart = start;
+    tok->line = s->line;
+    if (p >= end) {
+        s->p = p;
+        if (!s->directiveEnd) return 0;
+        s->directiveEnd = NULL;
+        s->line += s->directiveLines;
+        tok->type = TOKEN_DIRECTIVE_END;
+        tok->lexeme[0] = '\0';
+        return 1;
+    }
 
-        else if (isOperator(ch)) {
-            i = 0;
-            buffer[i++] = ch;
-            char next = fgetc(fp);
-            if ((ch == '=' && next == '=') || (ch == '!' && next == '=') ||
-                (ch == '<' && next == '=') || (ch == '>' && next == '=') ||
-                (ch == '&' && next == '&') || (ch == '|' && next == '|') ||
-                (ch == '+' && next == '+') || (ch == '-' && next == '-')) {
-                buffer[i++] = next;
-            } else {
-                ungetc(next, fp);
-            }
-            buffer[i] = '\0';
-            addToken(TOKEN_OPERATOR, buffer, line);
+    char ch = *p++;
+    if (ch == '#' && !s->directiveEnd) {
+        s->directiveEnd = directiveLineEnd(start, end, &s->directiveLines);
+        tok->type = TOKEN_PREPROCESSOR;
+        setLexeme(tok, start, s->directiveEnd);
+    }
+
+    else if (isalpha((unsigned char)ch) || ch == '_') {
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+        setLexeme(tok, start, p);
+        tok->type = isKeyword(tok->lexeme) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
+    }
+
+    else if (isdigit((unsigned char)ch)) {
+        int isFloat = 0;
+        while (p < end && (isdigit((unsigned char)*p) || *p == '.')) {
+            if (*p == '.') isFloat = 1;
+            p++;
         }
+        setLexeme(tok, start, p);
+        tok->type = isFloat ? TOKEN_FLOAT : TOKEN_NUMBER;
+    }
 
-        else if (isPunctuation(ch)) {
-            buffer[0] = ch; buffer[1] = '\0';
-            addToken(TOKEN_PUNCTUATION, buffer, line);
+    else if (ch == '"') {
+        APPEND(ch);
+        while (p < end && *p != '"') {
+            if (*p == '\\') APPEND(*p);
+            APPEND(*p++);
         }
+        if (p < end) p++;
+        APPEND('"');
+        tok->lexeme[i] = '\0';
+        tok->type = TOKEN_STRING;
+    }
+
+    else if (ch == '\'') {
+        APPEND(ch);
+        if (p < end && *p++ == '\\') APPEND('\\');
+        if (p < end) APPEND(*p++);
+        if (p < end) APPEND(*p++);
+        tok->lexeme[i] = '\0';
+        tok->type = TOKEN_CHAR;
+    }
 
-        else {
-            buffer[0] = ch; buffer[1] = '\0';
-            addToken(TOKEN_UNKNOWN, buffer, line);
+    else if (isOperator(ch)) {
+        APPEND(ch);
+        char next = p < end ? *p : '\0';
+        if ((ch == '=' && next == '=') || (ch == '!' && next == '=') ||
+            (ch == '<' && next == '=') || (ch == '>' && next == '=') ||
+            (ch == '&' && next == '&') || (ch == '|' && next == '|') ||
+            (ch == '+' && next == '+') || (ch == '-' && next == '-')) {
+            APPEND(next);
+            p++;
         }
+        tok->lexeme[i] = '\0';
+        tok->type = TOKEN_OPERATOR;
     }
 
-    fclose(fp);
-    printTokenTable();
-    exportTokenTable("tokens.txt");
+    else {
+        tok->lexeme[0] = ch;
+        tok->lexeme[1] = '\0';
+        tok->type = isPunctuation(ch) ? TOKEN_PUNCTUATION : TOKEN_UNKNOWN;
+    }
+
+    s->p = p;
+    return 1;
+}
+
+static int lexerStopped(Compiler *cc) {
+    return cc->tokenRing && atomic_load_explicit(&cc->tokenRing->stopped, memory_order_relaxed);
+}
+
+void runLexer(Compiler *cc) {
+    Token tok;
+    Preprocessor *pp = openPreprocessor(cc, &cc->stats);
+    if (setjmp(pp->onError)) compileError(cc, "%s", pp->error);
+    while (preprocess(pp, &tok)) addToken(cc, &tok);
+    closePreprocessor(cc);
+}
+
+static void* lexerMain(void *arg) {
+    Compiler *cc = (Compiler*)arg;
+    TokenRing *ring = cc->tokenRing;
+    Preprocessor *pp = cc->preprocessor;
+    Token tok;
+    phaseBegin(&ring->stats, PHASE_LEX);
+    if (!setjmp(pp->onError)) {
+        while (!lexerStopped(cc) && preprocess(pp, &tok) && ringPush(ring, &tok)) cc->tokenCount++;
+    }
+    phaseEnd(&ring->stats, PHASE_LEX);
+    ringFinish(ring);
+    return NULL;
 }
 
+// Scans on a thread of its own into a ring the parser drains, so lexing
+// overlaps parsing and only TOKEN_RING_SIZE tokens are ever held. The
+// file is opened here, where a failure can still unwind to compile().
+// An error on the lexer thread ends the token stream, and the parser
+// reports it when it reaches the end.
+void startLexer(Compiler *cc) {
+    TokenRing *ring = (TokenRing*)xcalloc(1, sizeof(TokenRing));
+    openPreprocessor(cc, &ring->stats);
+    cc->tokenRing = ring;
+    if (pthread_create(&ring->thread, NULL, lexerMain, cc) != 0) {
+        fprintf(stderr, "Error: Cannot start lexer thread\n");
+        exit(1);
+    }
+}
 
+// Joins the lexer thread, early if the parser failed, and folds its
+// timing into the compilation's
+void stopLexer(Compiler *cc) {
+    TokenRing *ring = cc->tokenRing;
+    if (!ring) return;
+    atomic_store_explicit(&ring->stopped, 1, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    closePreprocessor(cc);
+    mergeStats(&cc->stats, &ring->stats);
+    free(ring);
+    cc->tokenRing = NULL;
+}
+
+// Token index of the input, or NULL past its end
+Token* tokenAt(Compiler *cc, int index) {
+    if (!cc->tokenRing) return index < cc->tokenCount ? &cc->tokenTable[index] : NULL;
+    ringRelease(cc->tokenRing, cc->currentTokenIndex - TOKEN_RING_HISTORY);
+    Token *tok = ringAt(cc->tokenRing, index);
+    if (!tok && cc->preprocessor->failed) compileError(cc, "%s", cc->preprocessor->error);
+    return tok;
+}
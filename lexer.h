@@ -1,9 +1,14 @@
 #ifndef LEXER_H
 #define LEXER_H
 
-#define MAX_TOKENS 1000
+#include <stddef.h>
+
+#define INITIAL_TOKENS 1024
 #define MAX_LEXEME_LEN 100
 
+// All state of one compilation; see compiler.h
+typedef struct Compiler Compiler;
+
 // Token type enum or defines
 enum TokenType {
     TOKEN_KEYWORD,
@@ -16,7 +21,8 @@ enum TokenType {
     TOKEN_PUNCTUATION,
     TOKEN_COMMENT,
     TOKEN_PREPROCESSOR,
-    TOKEN_UNKNOWN
+    TOKEN_UNKNOWN,
+    TOKEN_DIRECTIVE_END             // closes a directive's tokens; never reaches the parser
 };
 
 typedef struct {
@@ -25,13 +31,29 @@ typedef struct {
     int line;
 } Token;
 
-extern Token tokenTable[MAX_TOKENS];
-extern int tokenCount;
-
-void runLexer(const char *filename);
-void printTokenTable(void);
-void exportTokenTable(const char *outFilename);
-void syntaxError(const char *message, Token *tok);
+// Scans source text in memory. A directive comes out as its whole line
+// in a TOKEN_PREPROCESSOR, then the line's tokens, then a
+// TOKEN_DIRECTIVE_END; the tokens keep the directive's line number even
+// across continuation lines.
+typedef struct {
+    const char *p, *end;
+    int line;
+    const char *tokenStart;         // where the last token began
+    const char *directiveEnd;       // inside a directive: the end of its line
+    int directiveLines;             // continuation lines of that directive
+} Scanner;
+
+void initScanner(Scanner *s, const char *text, size_t length);
+int scanToken(Scanner *s, Token *tok);
+
+void runLexer(Compiler *cc);
+void startLexer(Compiler *cc);
+void stopLexer(Compiler *cc);
+Token* tokenAt(Compiler *cc, int index);
+const char* tokenTypeName(int type);
+void printTokenTable(Compiler *cc);
+void exportTokenTable(Compiler *cc, const char *outFilename);
+void syntaxError(Compiler *cc, const char *message, Token *tok) __attribute__((noreturn));
 
 
 #endif
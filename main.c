@@ -1,37 +1,284 @@
 #include <stdio.h>
-#include "lexer.h"
-#include "parser.h"
-#include "codegen.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "compiler.h"
+#include "batch.h"
+#include "daemon.h"
 
-void analyzeAST(ASTNode *node);
+// Applies each name in a comma-separated -fpass=/-fno-pass= list
+int setPassList(CompileOptions *options, char *list, int enabled) {
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        if (!setPassEnabled(options, name, enabled)) {
+            fprintf(stderr, "Unknown pass: %s\n", name);
+            return 0;
+        }
+    }
+    return 1;
+}
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <sourcefile>\n", argv[0]);
-        return 1;
+// A batch writes each source's assembly to its own <name>.s: -o must
+// name a directory, and no two sources may share a name
+static int checkBatchOutputs(const char **sources, int count, const char *asmDir) {
+    struct stat info;
+    if (asmDir && (stat(asmDir, &info) != 0 || !S_ISDIR(info.st_mode))) {
+        fprintf(stderr, "-o with several sources names the directory for their .s files: %s\n", asmDir);
+        return 0;
+    }
+    char (*paths)[PATH_MAX] = xmalloc(sizeof(*paths) * count);
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        if (strcmp(sources[i], "-") == 0) {
+            fprintf(stderr, "Standard input has no name for a .s file; compile it on its own\n");
+            ok = 0;
+        } else if (!batchAsmPath(paths[i], PATH_MAX, asmDir, sources[i])) {
+            fprintf(stderr, "Output path too long for %s\n", sources[i]);
+            ok = 0;
+        }
+        for (int j = 0; j < i && ok; j++) {
+            if (strcmp(paths[i], paths[j]) == 0) {
+                fprintf(stderr, "%s and %s would both write %s\n", sources[j], sources[i], paths[i]);
+                ok = 0;
+            }
+        }
+    }
+    free(paths);
+    return ok;
+}
+
+// The whole command line of one run; main() calls it once, the daemon
+// once per request. Everything it allocates is freed before it returns.
+int runCompiler(int argc, char *argv[]) {
+    CompileOptions options;
+    const char **sources = (const char**)xmalloc(sizeof(char*) * (argc > 1 ? argc : 1));
+    const char **includeDirs = (const char**)xmalloc(sizeof(char*) * (argc > 1 ? argc : 1));
+    const char **defines = (const char**)xmalloc(sizeof(char*) * (argc > 1 ? argc : 1));
+    int sourceCount = 0;
+    const char *timeReportJson = NULL;
+    const char *asmPath = NULL;
+    int timeReport = 0;
+    int clearCacheFirst = 0;
+    int status = 1;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(&options, 0, sizeof(options));
+    initPasses();
+    setOptLevel(&options, 1);
+    options.includeDirs = includeDirs;
+    options.defines = defines;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 ||
+            strcmp(argv[i], "-O2") == 0) {
+            setOptLevel(&options, argv[i][2] - '0');
+        } else if (strncmp(argv[i], "-fpass=", 7) == 0) {
+            if (!setPassList(&options, argv[i] + 7, 1)) goto done;
+        } else if (strncmp(argv[i], "-fno-pass=", 10) == 0) {
+            if (!setPassList(&options, argv[i] + 10, 0)) goto done;
+        } else if (strcmp(argv[i], "-ftime-report") == 0) {
+            timeReport = 1;
+        } else if (strncmp(argv[i], "-ftime-report-json=", 19) == 0) {
+            timeReportJson = argv[i] + 19;
+        } else if (strcmp(argv[i], "-fpipeline-lexer") == 0) {
+            options.pipelineLexer = 1;
+        } else if (strcmp(argv[i], "-fstreaming") == 0) {
+            options.streaming = 1;
+        } else if (strcmp(argv[i], "-ffused-frontend") == 0) {
+            options.fusedFrontend = 1;
+        } else if (strcmp(argv[i], "-run") == 0) {
+            options.run = 1;
+        } else if (strncmp(argv[i], "-stop-after=", 12) == 0) {
+            options.stopAfter = parseStage(argv[i] + 12);
+            if (options.stopAfter == STAGE_NONE) {
+                fprintf(stderr, "Unknown stage: %s (lex, parse or optimize)\n", argv[i] + 12);
+                goto done;
+            }
+        } else if (strncmp(argv[i], "-save-artifact=", 15) == 0) {
+            options.artifactPath = argv[i] + 15;
+        } else if (strncmp(argv[i], "-resume=", 8) == 0) {
+            // The artifact takes the place of the source file
+            options.resumePath = argv[i] + 8;
+            sources[sourceCount++] = options.resumePath;
+        } else if (strcmp(argv[i], "-fcache") == 0) {
+            options.cacheDir = DEFAULT_CACHE_DIR;
+        } else if (strncmp(argv[i], "-fcache=", 8) == 0) {
+            options.cacheDir = argv[i] + 8;
+        } else if (strcmp(argv[i], "-fcache-clear") == 0) {
+            clearCacheFirst = 1;
+        } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            includeDirs[options.includeDirCount++] = argv[++i];
+        } else if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2]) {
+            includeDirs[options.includeDirCount++] = argv[i] + 2;
+        } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            defines[options.defineCount++] = argv[++i];
+        } else if (strncmp(argv[i], "-D", 2) == 0 && argv[i][2]) {
+            defines[options.defineCount++] = argv[i] + 2;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            asmPath = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            jobs = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "-dump-tokens") == 0) {
+            options.dumpFlags |= DUMP_TOKENS;
+        } else if (strcmp(argv[i], "-dump-ast") == 0) {
+            options.dumpFlags |= DUMP_AST;
+        } else if (strcmp(argv[i], "-dump-tac") == 0) {
+            options.dumpFlags |= DUMP_TAC;
+        } else if (strcmp(argv[i], "-dump-passes") == 0) {
+            options.dumpFlags |= DUMP_PASSES;
+        } else if (strcmp(argv[i], "-dump-asm") == 0) {
+            options.dumpFlags |= DUMP_ASM;
+        } else if (strcmp(argv[i], "-dump-frame") == 0) {
+            options.dumpFlags |= DUMP_FRAME;
+        } else if (strcmp(argv[i], "-dump-all") == 0) {
+            options.dumpFlags |= DUMP_ALL;
+        } else if (strcmp(argv[i], "-export-tokens") == 0) {
+            options.tokenExport = "tokens.txt";
+        } else if (strncmp(argv[i], "-export-tokens=", 15) == 0) {
+            options.tokenExport = argv[i] + 15;
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            goto done;
+        } else {
+            sources[sourceCount++] = argv[i];
+        }
+    }
+
+    // -fcache-clear empties the cache; alone, that is all it does
+    if (clearCacheFirst) {
+        const char *dir = options.cacheDir ? options.cacheDir : DEFAULT_CACHE_DIR;
+        int removed = clearCache(dir);
+        if (removed < 0 && errno != ENOENT) {
+            fprintf(stderr, "Cannot clear cache directory %s\n", dir);
+            goto done;
+        }
+        if (!sourceCount) {
+            fprintf(stderr, "Removed %d cache entr%s from %s\n", removed > 0 ? removed : 0,
+                    removed == 1 ? "y" : "ies", dir);
+            status = 0;
+            goto done;
+        }
     }
 
-    runLexer(argv[1]);  // Tokenize source file
+    if (!sourceCount) {
+        fprintf(stderr, "Usage: %s [-O0|-O1|-O2] [-fpass=a,b] [-fno-pass=a,b] [-ftime-report]\n"
+                        "       [-ftime-report-json=<file|->] [-o <out.s|dir>] [-export-tokens[=<file>]]\n"
+                        "       [-fcache[=<dir>]] [-fcache-clear] [-I <dir>] [-D <name>[=<value>]]\n"
+                        "       [-dump-tokens] [-dump-ast] [-dump-tac] [-dump-passes] [-dump-asm]\n"
+                        "       [-dump-frame] [-dump-all] [-fpipeline-lexer] [-fstreaming] [-ffused-frontend]\n"
+                        "       [-run] [-j <jobs>] [-stop-after=<lex|parse|optimize>] [-save-artifact=<file>]\n"
+                        "       <sourcefile|->... | -resume=<artifact>\n"
+                        "       %s -daemon[=<socket>]\n", argv[0], argv[0]);
+        goto done;
+    }
+    if (sourceCount > 1 && options.tokenExport) {
+        fprintf(stderr, "-export-tokens takes a single source file\n");
+        goto done;
+    }
+    if (options.run && options.streaming) {
+        fprintf(stderr, "-run needs the whole program; it cannot be used with -fstreaming\n");
+        goto done;
+    }
+    if (sourceCount > 1 && (options.artifactPath || options.stopAfter || options.resumePath)) {
+        fprintf(stderr, "-save-artifact, -stop-after and -resume take a single source file\n");
+        goto done;
+    }
+    if ((options.artifactPath || options.stopAfter || options.resumePath) &&
+        (options.streaming || options.fusedFrontend)) {
+        fprintf(stderr, "Artifacts hold whole stages; they cannot be used with -fstreaming or -ffused-frontend\n");
+        goto done;
+    }
+    if (options.resumePath && options.cacheDir) {
+        fprintf(stderr, "-fcache keys functions by their tokens; it cannot be used with -resume\n");
+        goto done;
+    }
+    if (options.run && options.stopAfter) {
+        fprintf(stderr, "-run needs every stage; it cannot be used with -stop-after\n");
+        goto done;
+    }
+    if (sourceCount > 1 && !checkBatchOutputs(sources, sourceCount, asmPath)) goto done;
+    if (timeReportJson && strcmp(timeReportJson, "-") == 0 &&
+        ((sourceCount == 1 && (!asmPath || strcmp(asmPath, "-") == 0)) || options.dumpFlags || options.run)) {
+        fprintf(stderr, "-ftime-report-json=- needs stdout to itself: write the assembly with -o <file>, "
+                        "without -dump-* or -run\n");
+        goto done;
+    }
+    if (options.cacheDir && mkdir(options.cacheDir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create cache directory %s\n", options.cacheDir);
+        goto done;
+    }
 
-    currentTokenIndex = 0;
-    ASTNode *ast = parseProgram();
+    // Assembly goes to stdout unless -o names a file; a batch writes a
+    // file per source instead
+    Output dumpOutput, asmFile;
+    Output *asmOutput = &dumpOutput;
+    openOutput(&dumpOutput, NULL);
+    if (asmPath && sourceCount == 1) {
+        if (!openOutput(&asmFile, asmPath)) {
+            fprintf(stderr, "Cannot open output file %s\n", asmPath);
+            closeOutput(&dumpOutput);
+            goto done;
+        }
+        asmOutput = &asmFile;
+    }
 
-    printf("\n=== Parsed AST ===\n");
-    printAST(ast, 0);
+    CompileStats stats;
+    int failed;
+    const char *writeFailed = NULL;
+    const char *label = sources[0];
+    char batchLabel[32];
+    memset(&stats, 0, sizeof(stats));
 
-    analyzeAST(ast);         // Run semantic checks
-    printf("Semantic analysis successful.\n");
+    // Jobs go to the files of a batch, or else to the functions of the one file
+    options.functionJobs = sourceCount == 1 ? jobs : 1;
 
-    // Generate TAC from AST
-    generateCode(ast);
-    printIntermediateCode("Initial");
+    if (sourceCount == 1) {
+        // One unit streams straight into the outputs
+        Compiler cc;
+        initCompiler(&cc, &options, sources[0]);
+        cc.dumpOutput = dumpOutput;
+        if (asmOutput != &dumpOutput) {
+            cc.asmFile = asmFile;
+            cc.asmOutput = &cc.asmFile;
+        }
+        openStreamOutput(&cc.diagnostics, stderr);
+        failed = !compile(&cc);
+        stats = cc.stats;
+        // Closed here rather than in freeCompiler, to learn of a failed write
+        if (cc.asmOutput != &cc.dumpOutput && !closeOutput(cc.asmOutput)) writeFailed = asmPath;
+        if (!closeOutput(&cc.dumpOutput)) writeFailed = "stdout";
+        freeCompiler(&cc);
+    } else {
+        failed = compileBatch(&options, sources, sourceCount, jobs, &dumpOutput, asmPath, &stats);
+        // Reports share stdout/stderr with the dumps, so drain those first
+        if (!closeOutput(&dumpOutput)) writeFailed = "stdout";
+        snprintf(batchLabel, sizeof(batchLabel), "%d files", sourceCount);
+        label = batchLabel;
+    }
 
-    // Optimize TAC
-    optimize();
-    printIntermediateCode("Optimized");
+    if (options.cacheDir) {
+        long hits = stats.counters[COUNTER_CACHE_HITS];
+        long total = hits + stats.counters[COUNTER_CACHE_MISSES];
+        fprintf(stderr, "Function cache: %ld of %ld reused (%.1f%% hit rate)\n",
+                hits, total, total ? 100.0 * hits / total : 0.0);
+    }
+    if (timeReport) printTimeReport(&stats);
+    if (writeFailed) fprintf(stderr, "Error: Could not write all of the output to %s\n", writeFailed);
+    status = failed || writeFailed ? 1 : 0;
+    if (timeReportJson && !writeTimeReportJson(&stats, timeReportJson, label)) status = 1;
 
-    // Generate final assembly
-    generateFinalCode();
+done:
+    free(sources);
+    free(includeDirs);
+    free(defines);
+    return status;
+}
 
-    return 0;
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "-daemon") == 0) return runDaemon(NULL);
+    if (argc == 2 && strncmp(argv[1], "-daemon=", 8) == 0) return runDaemon(argv[1] + 8);
+    return runCompiler(argc, argv);
 }
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "output.h"
+#include "stats.h"
+
+void openStreamOutput(Output *out, FILE *file) {
+    out->file = file;
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    out->data = (char*)xmalloc(out->capacity);
+    out->length = 0;
+    out->failed = 0;
+}
+
+// A NULL path or "-" means stdout
+int openOutput(Output *out, const char *path) {
+    FILE *file = stdout;
+    if (path && strcmp(path, "-") != 0) {
+        file = fopen(path, "w");
+        if (!file) return 0;
+    }
+    openStreamOutput(out, file);
+    return 1;
+}
+
+// The buffer is allocated on first write, so unused outputs cost nothing
+void openMemoryOutput(Output *out) {
+    out->file = NULL;
+    out->capacity = 0;
+    out->data = NULL;
+    out->length = 0;
+    out->failed = 0;
+}
+
+int flushOutput(Output *out) {
+    if (!out->file) return !out->failed;
+    if (out->length && fwrite(out->data, 1, out->length, out->file) != out->length) out->failed = 1;
+    out->length = 0;
+    if (fflush(out->file) != 0) out->failed = 1;
+    return !out->failed;
+}
+
+// Makes room for length more bytes; 0 means the text is larger than a
+// file output's whole buffer and must bypass it
+static int reserve(Output *out, size_t length) {
+    if (out->length + length < out->capacity) return 1;
+    if (out->file) {
+        flushOutput(out);
+        return length < out->capacity;
+    }
+    if (!out->capacity) out->capacity = MEMORY_OUTPUT_INITIAL;
+    while (out->length + length >= out->capacity) out->capacity *= 2;
+    out->data = (char*)xrealloc(out->data, out->capacity);
+    return 1;
+}
+
+void outWrite(Output *out, const char *data, size_t length) {
+    if (!length) return;
+    if (!reserve(out, length)) {
+        if (fwrite(data, 1, length, out->file) != length) out->failed = 1;
+        return;
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+void outVprintf(Output *out, const char *fmt, va_list args) {
+    va_list retry;
+    va_copy(retry, args);
+    size_t room = out->capacity - out->length;
+    int n = vsnprintf(room ? out->data + out->length : NULL, room, fmt, args);
+    if (n >= 0 && (size_t)n < room) {
+        out->length += n;
+    } else if (n >= 0) {
+        // Did not fit: make room and format again, straight to the file
+        // if the text is larger than the whole buffer
+        if (reserve(out, n)) {
+            out->length += vsnprintf(out->data + out->length, out->capacity - out->length, fmt, retry);
+        } else if (vfprintf(out->file, fmt, retry) < 0) {
+            out->failed = 1;
+        }
+    }
+    va_end(retry);
+}
+
+void outPrintf(Output *out, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    outVprintf(out, fmt, args);
+    va_end(args);
+}
+
+// Returns 0 if any write to the stream failed, the final one included
+int closeOutput(Output *out) {
+    int ok = flushOutput(out);
+    if (out->file && out->file != stdout && out->file != stderr && fclose(out->file) != 0) ok = 0;
+    free(out->data);
+    out->file = NULL;
+    out->data = NULL;
+    out->length = out->capacity = 0;
+    out->failed = 0;
+    return ok;
+}
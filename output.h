@@ -0,0 +1,40 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define MEMORY_OUTPUT_INITIAL 4096
+
+// Listings selected with -dump-* flags; everything else stays silent
+#define DUMP_TOKENS  1
+#define DUMP_AST     2
+#define DUMP_TAC     4
+#define DUMP_PASSES  8
+#define DUMP_ASM     16
+#define DUMP_FRAME   32
+#define DUMP_ALL     (DUMP_TOKENS | DUMP_AST | DUMP_TAC | DUMP_PASSES | DUMP_ASM | DUMP_FRAME)
+
+// A stream with a large user-space buffer in front of its FILE. Without
+// a FILE the buffer grows instead, so a compilation can be written out
+// later as a whole. A failed write is remembered, for flushOutput and
+// closeOutput to report.
+typedef struct {
+    FILE *file;
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} Output;
+
+int openOutput(Output *out, const char *path);
+void openStreamOutput(Output *out, FILE *file);
+void openMemoryOutput(Output *out);
+void outPrintf(Output *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void outVprintf(Output *out, const char *fmt, va_list args);
+void outWrite(Output *out, const char *data, size_t length);
+int flushOutput(Output *out);       // 0 once any write has failed
+int closeOutput(Output *out);
+
+#endif
@@ -1,233 +1,503 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "lexer.h"
-#include "parser.h"
+#include <ctype.h>
+#include "compiler.h"
 
-int currentTokenIndex = 0;
+Token* getCurrentToken(Compiler *cc) {
+    return tokenAt(cc, cc->currentTokenIndex);
+}
 
-Token* getCurrentToken() {
-    if (currentTokenIndex < tokenCount)
-        return &tokenTable[currentTokenIndex];
-    return NULL;
+// Steps past the current token, folding it into the hash of the function
+// being parsed when the function cache needs one
+void advanceToken(Compiler *cc) {
+    if (cc->options->cacheDir) {
+        Token *tok = tokenAt(cc, cc->currentTokenIndex);
+        if (tok) hashToken(cc, tok);
+    }
+    cc->currentTokenIndex++;
 }
 
-Token* getNextToken() {
-    if (currentTokenIndex < tokenCount)
-        return &tokenTable[currentTokenIndex++];
-    return NULL;
+Token* getNextToken(Compiler *cc) {
+    Token *tok = tokenAt(cc, cc->currentTokenIndex);
+    if (tok) advanceToken(cc);
+    return tok;
 }
 
-void match(const char *expected) {
-    Token *tok = getCurrentToken();
+Token* peekToken(Compiler *cc, int offset) {
+    return tokenAt(cc, cc->currentTokenIndex + offset);
+}
+
+void match(Compiler *cc, const char *expected) {
+    Token *tok = getCurrentToken(cc);
     if (!tok || strcmp(tok->lexeme, expected) != 0) {
-        syntaxError(expected, tok);
+        syntaxError(cc, expected, tok);
     }
-    currentTokenIndex++;
+    advanceToken(cc);
 }
 
-void syntaxError(const char *message, Token *tok) {
+void syntaxError(Compiler *cc, const char *message, Token *tok) {
     if (tok) {
-        fprintf(stderr, "Syntax error: %s but found '%s' at line %d\n", message, tok->lexeme, tok->line);
-    } else {
-        fprintf(stderr, "Syntax error: %s at end of input\n", message);
+        compileError(cc, "Syntax error: %s but found '%s' at line %d", message, tok->lexeme, tok->line);
     }
-    exit(1);
+    compileError(cc, "Syntax error: %s at end of input", message);
 }
 
-ASTNode* createNode(ASTNodeType type) {
-    ASTNode *node = (ASTNode*) malloc(sizeof(ASTNode));
+ASTNode* createNode(Compiler *cc, ASTNodeType type) {
+    ASTNode *node = (ASTNode*) xmalloc(sizeof(ASTNode));
+    addCounter(&cc->stats, COUNTER_AST_NODES, 1);
     node->type = type;
     node->name[0] = '\0';
     node->body = node->condition = node->elseBody = node->next = NULL;
+    node->dataType = TYPE_INT;
+    node->symbol = NULL;
+    node->arraySize = 0;
     return node;
 }
 
-ASTNode* parseBlock();
-ASTNode* parseStatement();
-ASTNode* parseExpression();
-ASTNode* parseProgram();
+ASTNode* parseBlock(Compiler *cc);
+ASTNode* parseStatement(Compiler *cc);
+ASTNode* parseExpression(Compiler *cc);
+ASTNode* parseCall(Compiler *cc);
+ASTNode* parseProgram(Compiler *cc);
+static ASTNode* makeLeaf(Compiler *cc, const char *name);
+
+// Next preprocessor line or function of the file, or NULL at its end
+ASTNode* parseTopLevel(Compiler *cc) {
+    Token *tok = getCurrentToken(cc);
+    if (!tok) return NULL;
+
+    if (tok->type == TOKEN_PREPROCESSOR) {
+        ASTNode *node = createNode(cc, AST_PREPROCESSOR);
+        strcpy(node->name, tok->lexeme);
+        advanceToken(cc);
+        return node;
+    }
+    if (strcmp(tok->lexeme, "int") == 0) {
+        cc->tokenHash = HASH_SEED;
+        ASTNode *node = parseFunction(cc);
+        if (cc->options->cacheDir) recordFunctionHash(cc);
+        return node;
+    }
+    syntaxError(cc, "expected preprocessor directive or function", tok);
+}
+
+ASTNode* parseProgram(Compiler *cc) {
+    ASTNode *head = NULL, *tail = NULL;
+    ASTNode *node;
+
+    while ((node = parseTopLevel(cc))) {
+        if (!head) head = cc->ast = node;   // freed with cc after an error
+        else tail->next = node;
+        tail = node;
+    }
 
-ASTNode* parseProgram() {
+    return head;
+}
+
+// Parameters are kept as a chain of "param" nodes on funcNode->condition,
+// shaped like a declaration without an initializer.
+ASTNode* parseParameters(Compiler *cc) {
     ASTNode *head = NULL, *tail = NULL;
 
-    while (currentTokenIndex < tokenCount) {
-        Token *tok = getCurrentToken();
+    Token *tok = getCurrentToken(cc);
+    if (tok && strcmp(tok->lexeme, ")") == 0) return NULL;
+    if (tok && strcmp(tok->lexeme, "void") == 0 && peekToken(cc, 1) &&
+        strcmp(peekToken(cc, 1)->lexeme, ")") == 0) {
+        advanceToken(cc);
+        return NULL;
+    }
+
+    while (1) {
+        tok = getNextToken(cc);
+        if (!tok || (strcmp(tok->lexeme, "int") != 0 && strcmp(tok->lexeme, "float") != 0)) {
+            syntaxError(cc, "expected parameter type", tok);
+        }
+        DataType type = strcmp(tok->lexeme, "float") == 0 ? TYPE_FLOAT : TYPE_INT;
 
-        ASTNode *node = NULL;
+        Token *id = getNextToken(cc);
+        if (!id || id->type != TOKEN_IDENTIFIER) {
+            syntaxError(cc, "expected parameter name", id);
+        }
 
-        if (tok->type == TOKEN_PREPROCESSOR) {
-            node = createNode(AST_PREPROCESSOR);
-            strcpy(node->name, tok->lexeme);
-            currentTokenIndex++;
-        } else if (strcmp(tok->lexeme, "int") == 0) {
-            node = parseFunction();  
-        } else {
-            syntaxError("expected preprocessor directive or function", tok);
+        ASTNode *param = createNode(cc, AST_EXPRESSION);
+        strcpy(param->name, "param");
+        ASTNode *var = createNode(cc, AST_EXPRESSION);
+        strcpy(var->name, id->lexeme);
+        var->dataType = type;
+        param->condition = var;
+
+        // An array parameter is passed by address; any size is ignored
+        tok = getCurrentToken(cc);
+        if (tok && strcmp(tok->lexeme, "[") == 0) {
+            advanceToken(cc);
+            tok = getCurrentToken(cc);
+            if (tok && tok->type == TOKEN_NUMBER) advanceToken(cc);
+            match(cc, "]");
+            var->arraySize = UNSIZED_ARRAY;
         }
 
-        if (node) {
-            if (!head) head = node;
-            else tail->next = node;
-            tail = node;
+        if (!head) head = param;
+        else tail->next = param;
+        tail = param;
+
+        tok = getCurrentToken(cc);
+        if (tok && strcmp(tok->lexeme, ",") == 0) {
+            advanceToken(cc);
+            continue;
         }
+        break;
     }
 
     return head;
 }
 
-ASTNode* parseFunction() {
-    match("int");
-    Token *name = getNextToken();
+// With -ffused-frontend the parser does the semantic checks itself:
+// blocks open and close scopes, and each statement is resolved and typed
+// as soon as it is parsed, while its scope is current. analyzeAST is
+// then skipped.
+static int fused(Compiler *cc) {
+    return cc->options->fusedFrontend;
+}
+
+ASTNode* parseFunction(Compiler *cc) {
+    match(cc, "int");
+    Token *name = getNextToken(cc);
 
     if (!name || name->type != TOKEN_IDENTIFIER) {
-        syntaxError("expected function name", name);
+        syntaxError(cc, "expected function name", name);
     }
 
-    ASTNode *funcNode = createNode(AST_FUNCTION);
+    ASTNode *funcNode = createNode(cc, AST_FUNCTION);
     strcpy(funcNode->name, name->lexeme);
-    match("(");
-    match(")");
-    funcNode->body = parseBlock();
+    match(cc, "(");
+    funcNode->condition = parseParameters(cc);
+    match(cc, ")");
+    if (fused(cc)) enterFunction(cc, funcNode);
+    funcNode->body = parseBlock(cc);
+    if (fused(cc)) exitScope(cc);
     return funcNode;
 }
 
-ASTNode* parseBlock() {
-    match("{");
-    ASTNode *blockNode = createNode(AST_BLOCK);
+ASTNode* parseBlock(Compiler *cc) {
+    match(cc, "{");
+    ASTNode *blockNode = createNode(cc, AST_BLOCK);
     ASTNode *last = NULL;
+    if (fused(cc)) enterScope(cc);
 
     while (1) {
-        Token *tok = getCurrentToken();
-        if (!tok) syntaxError("unexpected EOF in block", NULL);
+        Token *tok = getCurrentToken(cc);
+        if (!tok) syntaxError(cc, "unexpected EOF in block", NULL);
         if (strcmp(tok->lexeme, "}") == 0) {
-            match("}");
+            match(cc, "}");
+            if (fused(cc)) exitScope(cc);
             break;
         }
 
-        ASTNode *stmt = parseStatement();
+        ASTNode *stmt = parseStatement(cc);
         if (!stmt) continue;
 
+        // A declaration of several names is a chain of statements
         if (!blockNode->body) blockNode->body = stmt;
         else last->next = stmt;
-        last = stmt;
+        for (last = stmt; last->next; last = last->next) {}
     }
 
     return blockNode;
 }
 
-ASTNode* parseStatement() {
-    Token *tok = getCurrentToken();
+// {a, b, ...}: an array's initial elements, chained through next. Sets
+// the size of an array declared without one.
+static ASTNode* parseInitializers(Compiler *cc, ASTNode *var) {
+    ASTNode *head = NULL, *tail = NULL;
+    int count = 0;
+
+    match(cc, "{");
+    Token *tok = getCurrentToken(cc);
+    while (tok && strcmp(tok->lexeme, "}") != 0) {
+        ASTNode *value = parseExpression(cc);
+        if (!head) head = value;
+        else tail->next = value;
+        tail = value;
+        count++;
+
+        tok = getCurrentToken(cc);
+        if (!tok || strcmp(tok->lexeme, ",") != 0) break;
+        advanceToken(cc);
+        tok = getCurrentToken(cc);
+    }
+    match(cc, "}");
+
+    if (var->arraySize == UNSIZED_ARRAY) var->arraySize = count;
+    if (count > var->arraySize) {
+        compileError(cc, "Syntax error: Too many initializers for array '%s'", var->name);
+    }
+    if (!var->arraySize) compileError(cc, "Syntax error: Array '%s' has no elements", var->name);
+    return head;
+}
+
+// One name of a declaration: name, name[N] or name[], with an optional
+// initializer. An array's is a braced list, kept on body.
+static ASTNode* parseDeclarator(Compiler *cc, DataType type) {
+    Token *id = getNextToken(cc);
+    if (!id || id->type != TOKEN_IDENTIFIER) {
+        syntaxError(cc, "expected identifier", id);
+    }
+
+    ASTNode *decl = createNode(cc, AST_DECLARE);
+    strcpy(decl->name, "declare");
+
+    ASTNode *var = createNode(cc, AST_EXPRESSION);
+    strcpy(var->name, id->lexeme);
+    var->dataType = type;
+    decl->condition = var;
+
+    Token *tok = getCurrentToken(cc);
+    if (tok && strcmp(tok->lexeme, "[") == 0) {
+        advanceToken(cc);
+        var->arraySize = UNSIZED_ARRAY;
+        tok = getCurrentToken(cc);
+        if (tok && tok->type == TOKEN_NUMBER) {
+            var->arraySize = atoi(tok->lexeme);
+            if (var->arraySize <= 0) syntaxError(cc, "expected a positive array size", tok);
+            advanceToken(cc);
+        }
+        match(cc, "]");
+    }
+
+    tok = getCurrentToken(cc);
+    if (tok && strcmp(tok->lexeme, "=") == 0) {
+        advanceToken(cc);
+        if (var->arraySize) decl->body = parseInitializers(cc, var);
+        else decl->body = parseExpression(cc);
+    } else if (var->arraySize == UNSIZED_ARRAY) {
+        syntaxError(cc, "expected an initializer for an array without a size", tok);
+    }
+
+    if (fused(cc)) analyzeExpression(cc, &decl);
+    return decl;
+}
+
+// name[index]: the array on condition, the index on body
+static ASTNode* parseIndex(Compiler *cc, ASTNode *array) {
+    ASTNode *index = createNode(cc, AST_EXPRESSION);
+    strcpy(index->name, "[]");
+    index->condition = array;
+    match(cc, "[");
+    index->body = parseExpression(cc);
+    match(cc, "]");
+    return index;
+}
+
+ASTNode* parseStatement(Compiler *cc) {
+    Token *tok = getCurrentToken(cc);
     if (!tok) return NULL;
 
     if (tok->type == TOKEN_KEYWORD &&
         (strcmp(tok->lexeme, "int") == 0 || strcmp(tok->lexeme, "float") == 0)) {
 
-        currentTokenIndex++;
-        Token *id = getNextToken();
-        if (!id || id->type != TOKEN_IDENTIFIER) {
-            syntaxError("expected identifier", id);
-        }
+        DataType type = strcmp(tok->lexeme, "float") == 0 ? TYPE_FLOAT : TYPE_INT;
+        advanceToken(cc);
 
-        ASTNode *decl = createNode(AST_EXPRESSION);
-        strcpy(decl->name, "declare");
-
-        ASTNode *var = createNode(AST_EXPRESSION);
-        strcpy(var->name, id->lexeme);
-        decl->condition = var;
+        // int a, b = 1; declares each name in turn
+        ASTNode *head = NULL, *tail = NULL;
+        while (1) {
+            ASTNode *decl = parseDeclarator(cc, type);
+            if (!head) head = decl;
+            else tail->next = decl;
+            tail = decl;
 
-        tok = getCurrentToken();
-        if (tok && strcmp(tok->lexeme, "=") == 0) {
-            currentTokenIndex++;
-            decl->body = parseExpression();
+            tok = getCurrentToken(cc);
+            if (!tok || strcmp(tok->lexeme, ",") != 0) break;
+            advanceToken(cc);
         }
 
-        match(";");
-        return decl;
+        match(cc, ";");
+        return head;
     }
 
     if (strcmp(tok->lexeme, "if") == 0) {
-        currentTokenIndex++;
-        ASTNode *ifNode = createNode(AST_IF);
-        match("(");
-        ifNode->condition = parseExpression();
-        match(")");
-        ifNode->body = parseBlock();
-
-        tok = getCurrentToken();
+        advanceToken(cc);
+        ASTNode *ifNode = createNode(cc, AST_IF);
+        match(cc, "(");
+        ifNode->condition = parseExpression(cc);
+        match(cc, ")");
+        if (fused(cc)) analyzeExpression(cc, &ifNode->condition);
+        ifNode->body = parseBlock(cc);
+
+        tok = getCurrentToken(cc);
         if (tok && strcmp(tok->lexeme, "else") == 0) {
-            currentTokenIndex++;
-            ifNode->elseBody = parseBlock();
+            advanceToken(cc);
+            ifNode->elseBody = parseBlock(cc);
         }
         return ifNode;
     }
 
     if (strcmp(tok->lexeme, "while") == 0) {
-        currentTokenIndex++;
-        ASTNode *whileNode = createNode(AST_WHILE);
-        match("(");
-        whileNode->condition = parseExpression();
-        match(")");
-        whileNode->body = parseBlock();
+        advanceToken(cc);
+        ASTNode *whileNode = createNode(cc, AST_WHILE);
+        match(cc, "(");
+        whileNode->condition = parseExpression(cc);
+        match(cc, ")");
+        if (fused(cc)) analyzeExpression(cc, &whileNode->condition);
+        whileNode->body = parseBlock(cc);
         return whileNode;
     }
 
     if (strcmp(tok->lexeme, "return") == 0) {
-        currentTokenIndex++;
-        ASTNode *retNode = createNode(AST_EXPRESSION);
+        advanceToken(cc);
+        ASTNode *retNode = createNode(cc, AST_EXPRESSION);
         strcpy(retNode->name, "return");
-        retNode->body = parseExpression();
-        match(";");
+        tok = getCurrentToken(cc);
+        if (!tok || strcmp(tok->lexeme, ";") != 0)
+            retNode->body = parseExpression(cc);
+        match(cc, ";");
+        if (fused(cc)) analyzeExpression(cc, &retNode);
         return retNode;
     }
 
     if (strcmp(tok->lexeme, "{") == 0) {
-        return parseBlock();
+        return parseBlock(cc);
     }
 
-    if (tok->type == TOKEN_IDENTIFIER) {
-        Token *id = tok;
-        currentTokenIndex++;
+    if (tok->type == TOKEN_IDENTIFIER && peekToken(cc, 1) &&
+        strcmp(peekToken(cc, 1)->lexeme, "(") == 0) {
+        // Call used as a statement; its value is discarded
+        ASTNode *stmt = createNode(cc, AST_STATEMENT);
+        stmt->body = parseExpression(cc);
+        match(cc, ";");
+        if (fused(cc)) analyzeExpression(cc, &stmt->body);
+        return stmt;
+    }
 
-        if (strcmp(getCurrentToken()->lexeme, "=") == 0) {
-            currentTokenIndex++;
+    if (tok->type == TOKEN_IDENTIFIER) {
+        // The target: a variable, or an element as name[index]
+        ASTNode *lhs = createNode(cc, AST_EXPRESSION);
+        strcpy(lhs->name, tok->lexeme);
+        advanceToken(cc);
+        tok = getCurrentToken(cc);
+        if (tok && strcmp(tok->lexeme, "[") == 0) lhs = parseIndex(cc, lhs);
+
+        tok = getCurrentToken(cc);
+        if (tok && strcmp(tok->lexeme, "=") == 0) {
+            advanceToken(cc);
 
-            ASTNode *assign = createNode(AST_EXPRESSION);
+            ASTNode *assign = createNode(cc, AST_EXPRESSION);
             strcpy(assign->name, "=");
-
-            ASTNode *lhs = createNode(AST_EXPRESSION);
-            strcpy(lhs->name, id->lexeme);
             assign->condition = lhs;
 
-            assign->body = parseExpression();
-            match(";");
+            assign->body = parseExpression(cc);
+            match(cc, ";");
+            if (fused(cc)) analyzeExpression(cc, &assign);
             return assign;
         } else {
-            syntaxError("expected '=' after identifier", getCurrentToken());
+            freeAST(lhs);
+            syntaxError(cc, "expected '=' after identifier", tok);
         }
     }
 
-    syntaxError("unknown statement", tok);
+    syntaxError(cc, "unknown statement", tok);
     return NULL;
 }
 
-ASTNode* parseExpression() {
-    Token *tok = getCurrentToken();
-    if (!tok) syntaxError("unexpected EOF in expression", NULL);
+// name(arg, ...): callee on condition, arguments chained through next on body
+ASTNode* parseCall(Compiler *cc) {
+    Token *id = getNextToken(cc);
+    ASTNode *call = createNode(cc, AST_CALL);
+    strcpy(call->name, "call");
 
-    ASTNode *left = NULL;
+    ASTNode *callee = createNode(cc, AST_EXPRESSION);
+    strcpy(callee->name, id->lexeme);
+    call->condition = callee;
 
-    if (strcmp(tok->lexeme, "(") == 0) {
-        match("(");
-        left = parseExpression();
-        match(")");
+    match(cc, "(");
+    ASTNode *last = NULL;
+    Token *tok = getCurrentToken(cc);
+    if (tok && strcmp(tok->lexeme, ")") != 0) {
+        while (1) {
+            ASTNode *arg = parseExpression(cc);
+            if (!call->body) call->body = arg;
+            else last->next = arg;
+            last = arg;
+
+            tok = getCurrentToken(cc);
+            if (tok && strcmp(tok->lexeme, ",") == 0) {
+                advanceToken(cc);
+                continue;
+            }
+            break;
+        }
+    }
+    match(cc, ")");
+    return call;
+}
+
+static ASTNode* parsePrimary(Compiler *cc);
+
+// sizeof(type), sizeof(expression) or sizeof name; semantic analysis
+// replaces it with the size once the operand's type is known
+static ASTNode* parseSizeof(Compiler *cc) {
+    match(cc, "sizeof");
+    ASTNode *node = createNode(cc, AST_EXPRESSION);
+    strcpy(node->name, "sizeof");
+
+    Token *tok = getCurrentToken(cc);
+    Token *type = peekToken(cc, 1);
+    if (tok && strcmp(tok->lexeme, "(") == 0 && type &&
+        (strcmp(type->lexeme, "int") == 0 || strcmp(type->lexeme, "float") == 0)) {
+        advanceToken(cc);
+        node->condition = makeLeaf(cc, getCurrentToken(cc)->lexeme);
+        advanceToken(cc);
+        match(cc, ")");
     } else {
-        left = createNode(AST_EXPRESSION);
-        strcpy(left->name, tok->lexeme);
-        currentTokenIndex++;
+        node->condition = parsePrimary(cc);
+    }
+    return node;
+}
+
+// An operand: a parenthesized expression, call, element, sizeof, literal
+// or name, or one of these negated
+static ASTNode* parsePrimary(Compiler *cc) {
+    Token *tok = getCurrentToken(cc);
+    if (!tok) syntaxError(cc, "unexpected EOF in expression", NULL);
+
+    if (strcmp(tok->lexeme, "(") == 0) {
+        match(cc, "(");
+        ASTNode *inner = parseExpression(cc);
+        match(cc, ")");
+        return inner;
+    }
+    if (strcmp(tok->lexeme, "-") == 0) {
+        advanceToken(cc);
+        tok = getCurrentToken(cc);
+        if (tok && (tok->type == TOKEN_NUMBER || tok->type == TOKEN_FLOAT)) {
+            ASTNode *literal = createNode(cc, AST_EXPRESSION);
+            snprintf(literal->name, MAX_NAME_LEN, "-%.98s", tok->lexeme);
+            advanceToken(cc);
+            return literal;
+        }
+        return simplifyBinary(cc, "-", makeLeaf(cc, "0"), parsePrimary(cc));
     }
+    if (strcmp(tok->lexeme, "sizeof") == 0) {
+        return parseSizeof(cc);
+    }
+    if (tok->type == TOKEN_IDENTIFIER && peekToken(cc, 1) &&
+        strcmp(peekToken(cc, 1)->lexeme, "(") == 0) {
+        return parseCall(cc);
+    }
+
+    int isName = tok->type == TOKEN_IDENTIFIER;
+    ASTNode *leaf = makeLeaf(cc, tok->lexeme);
+    advanceToken(cc);
+    tok = getCurrentToken(cc);
+    if (isName && tok && strcmp(tok->lexeme, "[") == 0) return parseIndex(cc, leaf);
+    return leaf;
+}
+
+ASTNode* parseExpression(Compiler *cc) {
+    ASTNode *left = parsePrimary(cc);
 
-    tok = getCurrentToken();
+    Token *tok = getCurrentToken(cc);
     if (tok && (
         strcmp(tok->lexeme, "+") == 0 || strcmp(tok->lexeme, "-") == 0 ||
         strcmp(tok->lexeme, "*") == 0 || strcmp(tok->lexeme, "/") == 0 ||
@@ -235,55 +505,176 @@ ASTNode* parseExpression() {
         strcmp(tok->lexeme, ">=") == 0 || strcmp(tok->lexeme, "<=") == 0 ||
         strcmp(tok->lexeme, "<") == 0 || strcmp(tok->lexeme, ">") == 0)) {
 
-        ASTNode *opNode = createNode(AST_EXPRESSION);
-        strcpy(opNode->name, tok->lexeme);
-        currentTokenIndex++;
+        // Copied: the right operand may run past the token's lifetime
+        // in a pipelined token ring
+        char op[MAX_LEXEME_LEN];
+        strcpy(op, tok->lexeme);
+        advanceToken(cc);
 
-        ASTNode *right = parseExpression();
-
-        opNode->condition = left;
-        opNode->body = right;
-        return opNode;
+        ASTNode *right = parseExpression(cc);
+        return simplifyBinary(cc, op, left, right);
     }
 
     return left;
 }
 
-void printAST(ASTNode *node, int indent) {
+void freeAST(ASTNode *node) {
+    while (node) {
+        ASTNode *next = node->next;
+        freeAST(node->condition);
+        freeAST(node->body);
+        freeAST(node->elseBody);
+        free(node);
+        node = next;
+    }
+}
+
+static int isConstantNode(ASTNode *node) {
+    return !node->condition && !node->body && is_number(node->name);
+}
+
+static int isIdentifierNode(ASTNode *node) {
+    return !node->condition && !node->body &&
+           (isalpha((unsigned char)node->name[0]) || node->name[0] == '_');
+}
+
+static int log2Exact(int v) {
+    if (v <= 0 || (v & (v - 1))) return -1;
+    int k = 0;
+    while (v >>= 1) k++;
+    return k;
+}
+
+static ASTNode* makeLeaf(Compiler *cc, const char *name) {
+    ASTNode *leaf = createNode(cc, AST_EXPRESSION);
+    strcpy(leaf->name, name);
+    return leaf;
+}
+
+static ASTNode* makeBinary(Compiler *cc, const char *op, ASTNode *left, ASTNode *right) {
+    ASTNode *opNode = createNode(cc, AST_EXPRESSION);
+    strcpy(opNode->name, op);
+    opNode->condition = left;
+    opNode->body = right;
+    return opNode;
+}
+
+// Runs as each binary node is built: folds integer constant operands and
+// drops identities, reusing operand nodes so no operator node is
+// allocated when it folds. Both hold for int and float alike; rewrites
+// that only hold for ints wait for the types (reduceStrength). Nothing
+// here discards a name: x * 0 and x - x still need x checked, so they
+// are left to foldConstants.
+ASTNode* simplifyBinary(Compiler *cc, const char *op, ASTNode *left, ASTNode *right) {
+    int leftConst = isConstantNode(left), rightConst = isConstantNode(right);
+    int leftVal = leftConst ? atoi(left->name) : 0;
+    int rightVal = rightConst ? atoi(right->name) : 0;
+    int isAdd = strcmp(op, "+") == 0, isSub = strcmp(op, "-") == 0;
+    int isMul = strcmp(op, "*") == 0, isDiv = strcmp(op, "/") == 0;
+
+    if (leftConst && rightConst && can_fold(leftVal, rightVal, op)) {
+        sprintf(left->name, "%d", eval_const(leftVal, rightVal, (char*)op));
+        freeAST(right);
+        return left;
+    }
+
+    if (rightConst) {
+        if (((isAdd || isSub) && rightVal == 0) || ((isMul || isDiv) && rightVal == 1)) {
+            freeAST(right);
+            return left;
+        }
+    }
+
+    if (leftConst) {
+        if ((isAdd && leftVal == 0) || (isMul && leftVal == 1)) {
+            freeAST(left);
+            return right;
+        }
+    }
+
+    return makeBinary(cc, op, left, right);
+}
+
+// Turns an int multiply or divide by a power of two into shifts, once
+// semantic analysis knows the operands are ints. Returns the node that
+// replaces node, which may be node itself.
+ASTNode* reduceStrength(Compiler *cc, ASTNode *node) {
+    ASTNode *left = node->condition, *right = node->body;
+    int isMul = strcmp(node->name, "*") == 0, isDiv = strcmp(node->name, "/") == 0;
+    int k;
+
+    if (isMul && isConstantNode(left) && !isConstantNode(right) && (k = log2Exact(atoi(left->name))) > 0) {
+        node->condition = right;
+        node->body = left;
+        left = node->condition;
+        right = node->body;
+    }
+    if (!isConstantNode(right) || (k = log2Exact(atoi(right->name))) <= 0) return node;
+
+    if (isMul) {
+        strcpy(node->name, "<<");
+        sprintf(right->name, "%d", k);
+        return node;
+    }
+    if (isDiv && isIdentifierNode(left)) {
+        // Signed division rounds toward zero: bias negative dividends
+        // by 2^k - 1 before the arithmetic shift
+        char mask[MAX_NAME_LEN];
+        sprintf(mask, "%d", atoi(right->name) - 1);
+        ASTNode *sign = makeBinary(cc, ">>", makeLeaf(cc, left->name), makeLeaf(cc, "31"));
+        ASTNode *bias = makeBinary(cc, "&", sign, makeLeaf(cc, mask));
+        ASTNode *sum = makeBinary(cc, "+", left, bias);
+        sprintf(right->name, "%d", k);
+        ASTNode *shift = makeBinary(cc, ">>", sum, right);
+        shift->next = node->next;
+        free(node);
+        return shift;
+    }
+    return node;
+}
+
+void printAST(Compiler *cc, ASTNode *node, int indent) {
     if (!node) return;
 
-    for (int i = 0; i < indent; i++) printf("  ");
+    for (int i = 0; i < indent; i++) outPrintf(&cc->dumpOutput, "  ");
 
     switch (node->type) {
         case AST_FUNCTION:
-            printf("Function: %s\n", node->name);
+            outPrintf(&cc->dumpOutput, "Function: %s\n", node->name);
             break;
         case AST_BLOCK:
-            printf("Block\n");
+            outPrintf(&cc->dumpOutput, "Block\n");
             break;
         case AST_IF:
-            printf("If\n");
+            outPrintf(&cc->dumpOutput, "If\n");
             break;
         case AST_WHILE:
-            printf("While\n");
+            outPrintf(&cc->dumpOutput, "While\n");
             break;
         case AST_EXPRESSION:
-            printf("Expr: %s\n", node->name);
+        case AST_CALL:
+        case AST_DECLARE:
+            if (node->arraySize > 0) outPrintf(&cc->dumpOutput, "Expr: %s[%d]\n", node->name, node->arraySize);
+            else if (node->arraySize) outPrintf(&cc->dumpOutput, "Expr: %s[]\n", node->name);
+            else outPrintf(&cc->dumpOutput, "Expr: %s\n", node->name);
+            break;
+        case AST_STATEMENT:
+            outPrintf(&cc->dumpOutput, "Statement\n");
             break;
         case AST_PREPROCESSOR:
-            printf("Preprocessor: %s\n", node->name);
+            outPrintf(&cc->dumpOutput, "Preprocessor: %s\n", node->name);
             break;
         default:
-            printf("Unknown\n");
+            outPrintf(&cc->dumpOutput, "Unknown\n");
     }
 
-    if (node->condition) printAST(node->condition, indent + 1);
-    if (node->body) printAST(node->body, indent + 1);
+    if (node->condition) printAST(cc, node->condition, indent + 1);
+    if (node->body) printAST(cc, node->body, indent + 1);
     if (node->elseBody) {
-        for (int i = 0; i < indent; i++) printf("  ");
-        printf("Else\n");
-        printAST(node->elseBody, indent + 1);
+        for (int i = 0; i < indent; i++) outPrintf(&cc->dumpOutput, "  ");
+        outPrintf(&cc->dumpOutput, "Else\n");
+        printAST(cc, node->elseBody, indent + 1);
     }
 
-    printAST(node->next, indent);
+    printAST(cc, node->next, indent);
 }
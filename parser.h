@@ -3,8 +3,7 @@
 #include "lexer.h"
 
 #define MAX_NAME_LEN 100
-
-extern int currentTokenIndex; 
+#define UNSIZED_ARRAY -1    // an array parameter, or an array sized by its initializer
 
 typedef enum {
     AST_FUNCTION,
@@ -15,9 +14,18 @@ typedef enum {
     AST_PREPROCESSOR,
     AST_EXPRESSION,
     AST_STATEMENT,
+    AST_CALL,           // named "call" and "declare" for dumps; a variable
+    AST_DECLARE,        // may be called either, so match on the type
 
 } ASTNodeType;
 
+// Value types; semantic analysis sets one on every expression node.
+// Zero-initialized nodes are int.
+typedef enum {
+    TYPE_INT,
+    TYPE_FLOAT
+} DataType;
+
 typedef struct ASTNode {
     ASTNodeType type;
 
@@ -29,12 +37,20 @@ typedef struct ASTNode {
     struct ASTNode *condition;
     struct ASTNode *next;
 
+    DataType dataType;      // declared type of a variable, or an expression's type
+    struct ASTNode *symbol; // a variable use: the node that declared it
+    int arraySize;          // a declared variable: its element count if an array, else 0
+
 } ASTNode;
 
-ASTNode* createNode(ASTNodeType type);
+ASTNode* createNode(Compiler *cc, ASTNodeType type);
+void freeAST(ASTNode *node);
+ASTNode* simplifyBinary(Compiler *cc, const char *op, ASTNode *left, ASTNode *right);
+ASTNode* reduceStrength(Compiler *cc, ASTNode *node);
 
-ASTNode* parseFunction();
-ASTNode* parseProgram();
-void printAST(ASTNode *node, int indent);
+ASTNode* parseFunction(Compiler *cc);
+ASTNode* parseTopLevel(Compiler *cc);
+ASTNode* parseProgram(Compiler *cc);
+void printAST(Compiler *cc, ASTNode *node, int indent);
 
 #endif
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "compiler.h"
+
+// The registry is filled once by initPasses and only read afterwards
+static Pass passes[MAX_PASSES];
+static int passCount = 0;
+
+// ---------- analyses ----------
+
+static unsigned hashName(Compiler *cc, int function, const char *s) {
+    unsigned h = 2166136261u ^ (unsigned)function;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h & (cc->nameBuckets - 1);
+}
+
+int isNameOperand(const char *s) {
+    return isalpha((unsigned char)s[0]) || s[0] == '_';
+}
+
+// Names are local to their function, so entries are keyed by both
+static NameEntry* findName(Compiler *cc, NameEntry **table, int function, const char *name, int create) {
+    unsigned h = hashName(cc, function, name);
+    for (NameEntry *e = table[h]; e; e = e->next) {
+        if (e->function == function && strcmp(e->name, name) == 0) return e;
+    }
+    if (!create) return NULL;
+    NameEntry *e = (NameEntry*)xcalloc(1, sizeof(NameEntry));
+    e->function = function;
+    e->bindBlock = -1;
+    strncpy(e->name, name, MAX_LEN-1);
+    e->next = table[h];
+    table[h] = e;
+    return e;
+}
+
+static void clearNames(Compiler *cc, NameEntry **table) {
+    for (unsigned i = 0; i < cc->nameBuckets; i++) {
+        NameEntry *e = table[i];
+        while (e) {
+            NameEntry *next = e->next;
+            free(e);
+            e = next;
+        }
+        table[i] = NULL;
+    }
+}
+
+// Per-quad arrays track the code array's size
+static void reserveAnalyses(Compiler *cc) {
+    if (cc->codeIndex <= cc->analysisCapacity) return;
+    cc->analysisCapacity = cc->codeCapacity;
+    cc->blockLeader = (int*)xrealloc(cc->blockLeader, sizeof(int) * cc->analysisCapacity);
+    cc->functionOf = (int*)xrealloc(cc->functionOf, sizeof(int) * cc->analysisCapacity);
+    cc->dead = (char*)xrealloc(cc->dead, cc->analysisCapacity);
+}
+
+static void freeNameTables(Compiler *cc) {
+    if (!cc->useTable) return;
+    clearNames(cc, cc->useTable);
+    clearNames(cc, cc->bindTable);
+    clearNames(cc, cc->labelTable);
+    free(cc->useTable);
+    free(cc->bindTable);
+    free(cc->labelTable);
+    cc->useTable = cc->bindTable = cc->labelTable = NULL;
+    cc->nameBuckets = 0;
+}
+
+// Tables are sized to the code so small units do not pay for sweeping
+// tens of thousands of empty buckets
+static void allocNameTables(Compiler *cc) {
+    unsigned buckets = MIN_NAME_BUCKETS;
+    while (buckets < MAX_NAME_BUCKETS && buckets < (unsigned)cc->codeIndex) buckets *= 2;
+    if (buckets <= cc->nameBuckets) return;
+    freeNameTables(cc);
+    cc->nameBuckets = buckets;
+    cc->useTable = (NameEntry**)xcalloc(buckets, sizeof(NameEntry*));
+    cc->bindTable = (NameEntry**)xcalloc(buckets, sizeof(NameEntry*));
+    cc->labelTable = (NameEntry**)xcalloc(buckets, sizeof(NameEntry*));
+}
+
+// Operands that read a value, as opposed to labels, callees and ARG indices
+int readsArg1(const Quadruple *q) {
+    return strcmp(q->op, "CALL") != 0 && strcmp(q->op, "ARG") != 0 &&
+           strcmp(q->op, "goto") != 0;
+}
+
+int readsArg2(const Quadruple *q) {
+    return strcmp(q->op, "CALL") != 0 && strcmp(q->op, "goto") != 0 &&
+           strcmp(q->op, "iffalse") != 0;
+}
+
+// A store reads the array named in its result instead of defining it
+int readsResult(const Quadruple *q) {
+    return strcmp(q->op, "[]=") == 0 || strcmp(q->op, "V[]=") == 0;
+}
+
+int definesResult(const Quadruple *q) {
+    return strlen(q->result) && strcmp(q->result, "RET") != 0 &&
+           strcmp(q->op, "LABEL") != 0 && strcmp(q->op, "FUNC") != 0 &&
+           strcmp(q->op, "ENDFUNC") != 0 && !readsResult(q);
+}
+
+static void computeUses(Compiler *cc) {
+    int function = 0;
+    clearNames(cc, cc->useTable);
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "FUNC") == 0) function++;
+        cc->functionOf[i] = function;
+        if (readsArg1(&cc->code[i]) && isNameOperand(cc->code[i].arg1)) findName(cc, cc->useTable, function, cc->code[i].arg1, 1)->count++;
+        if (readsArg2(&cc->code[i]) && isNameOperand(cc->code[i].arg2)) findName(cc, cc->useTable, function, cc->code[i].arg2, 1)->count++;
+        if (readsResult(&cc->code[i])) findName(cc, cc->useTable, function, cc->code[i].result, 1)->count++;
+    }
+}
+
+int useCount(Compiler *cc, int index, const char *name) {
+    NameEntry *e = findName(cc, cc->useTable, cc->functionOf[index], name, 0);
+    return e ? e->count : 0;
+}
+
+static void computeBlocks(Compiler *cc) {
+    for (int i = 0; i < cc->codeIndex; i++) cc->blockLeader[i] = 0;
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "LABEL") == 0 || strcmp(cc->code[i].op, "FUNC") == 0) {
+            cc->blockLeader[i] = 1;
+        }
+        if ((strcmp(cc->code[i].op, "goto") == 0 || strcmp(cc->code[i].op, "iffalse") == 0 ||
+             strcmp(cc->code[i].result, "RET") == 0) && i + 1 < cc->codeIndex) {
+            cc->blockLeader[i + 1] = 1;
+        }
+    }
+}
+
+static void ensureAnalyses(Compiler *cc, unsigned required) {
+    reserveAnalyses(cc);
+    unsigned missing = required & ~cc->validAnalyses;
+    if (missing & ANALYSIS_BLOCKS) computeBlocks(cc);
+    if (missing & ANALYSIS_USES) computeUses(cc);
+    cc->validAnalyses |= required;
+}
+
+// ---------- passes ----------
+
+// Passes mark quads in cc->dead[] and squeeze them out in one sweep
+static int compactCode(Compiler *cc) {
+    int kept = 0;
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (cc->dead[i]) continue;
+        if (kept != i) cc->code[kept] = cc->code[i];
+        kept++;
+    }
+    int removed = cc->codeIndex - kept;
+    cc->codeIndex = kept;
+    return removed;
+}
+
+static void clearDead(Compiler *cc) {
+    memset(cc->dead, 0, cc->codeIndex);
+}
+
+// Substitutes operand if it still names the value bound to it in this block
+static int substitute(Compiler *cc, char *operand, int block) {
+    NameEntry *e = findName(cc, cc->bindTable, 0, operand, 0);
+    if (!e || e->bindBlock != block || e->bindVersion != e->version) return 0;
+    if (isNameOperand(e->bindTo)) {
+        NameEntry *to = findName(cc, cc->bindTable, 0, e->bindTo, 0);
+        if (to && to->version != e->bindToVersion) return 0;
+    }
+    strcpy(operand, e->bindTo);
+    return 1;
+}
+
+// Replaces reads of names bound by "x = value" within a basic block;
+// constants only, or any operand when copies is set. Redefining either
+// side bumps its version, which retires the binding without a search.
+static int propagate(Compiler *cc, int copies) {
+    int block = 0, changed = 0;
+    clearNames(cc, cc->bindTable);
+
+    for (int i = 0; i < cc->codeIndex; i++) {
+        Quadruple *q = &cc->code[i];
+        if (cc->blockLeader[i]) block++;
+
+        if (readsArg1(q) && isNameOperand(q->arg1)) changed += substitute(cc, q->arg1, block);
+        if (readsArg2(q) && isNameOperand(q->arg2)) changed += substitute(cc, q->arg2, block);
+        if (readsResult(q)) changed += substitute(cc, q->result, block);
+
+        if (!definesResult(q)) continue;
+
+        NameEntry *def = findName(cc, cc->bindTable, 0, q->result, 1);
+        def->version++;
+
+        if (strcmp(q->op, "=") == 0 && strlen(q->arg2) == 0 &&
+            strcmp(q->result, q->arg1) != 0 &&
+            (is_number(q->arg1) || is_float(q->arg1) || (copies && isNameOperand(q->arg1)))) {
+            def->bindBlock = block;
+            def->bindVersion = def->version;
+            strcpy(def->bindTo, q->arg1);
+            if (isNameOperand(q->arg1)) {
+                def->bindToVersion = findName(cc, cc->bindTable, 0, q->arg1, 1)->version;
+            }
+        }
+    }
+    clearNames(cc, cc->bindTable);
+    return changed;
+}
+
+static int runInline(Compiler *cc) {
+    return inlineFunctions(cc);
+}
+
+static int runConstProp(Compiler *cc) {
+    return propagate(cc, 0);
+}
+
+static int runCopyProp(Compiler *cc) {
+    return propagate(cc, 1);
+}
+
+// Deletes side-effect-free definitions whose value is never read
+static int runDeadCode(Compiler *cc) {
+    clearDead(cc);
+    for (int i = cc->codeIndex - 1; i >= 0; i--) {
+        Quadruple *q = &cc->code[i];
+        if (!definesResult(q) || strcmp(q->op, "CALL") == 0 || strcmp(q->op, "ARG") == 0) continue;
+        if (useCount(cc, i, q->result) > 0) continue;
+
+        if (readsArg1(q) && isNameOperand(q->arg1)) findName(cc, cc->useTable, cc->functionOf[i], q->arg1, 1)->count--;
+        if (readsArg2(q) && isNameOperand(q->arg2)) findName(cc, cc->useTable, cc->functionOf[i], q->arg2, 1)->count--;
+        cc->dead[i] = 1;
+    }
+    return compactCode(cc);
+}
+
+static int runBranchFold(Compiler *cc) {
+    int changed = 0;
+    clearDead(cc);
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "iffalse") != 0 || !is_number(cc->code[i].arg1)) continue;
+        if (atoi(cc->code[i].arg1) != 0) {
+            cc->dead[i] = 1;
+        } else {
+            strcpy(cc->code[i].op, "goto");
+            cc->code[i].arg1[0] = '\0';
+        }
+        changed++;
+    }
+    compactCode(cc);
+    return changed;
+}
+
+// Drops code after unconditional jumps, jumps to the next quad and
+// labels nothing branches to
+static int runUnreachable(Compiler *cc) {
+    clearDead(cc);
+    for (int i = 0; i < cc->codeIndex; i++) {
+        Quadruple *q = &cc->code[i];
+        if (strcmp(q->op, "goto") != 0 && strcmp(q->result, "RET") != 0) continue;
+
+        int j = i + 1;
+        while (j < cc->codeIndex && strcmp(cc->code[j].op, "LABEL") != 0 &&
+               strcmp(cc->code[j].op, "ENDFUNC") != 0) {
+            cc->dead[j++] = 1;
+        }
+        if (strcmp(q->op, "goto") == 0 && j < cc->codeIndex &&
+            strcmp(cc->code[j].op, "LABEL") == 0 && strcmp(cc->code[j].result, q->arg2) == 0) {
+            cc->dead[i] = 1;
+        }
+        i = j - 1;
+    }
+
+    clearNames(cc, cc->labelTable);
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (!cc->dead[i] && (strcmp(cc->code[i].op, "goto") == 0 || strcmp(cc->code[i].op, "iffalse") == 0)) {
+            findName(cc, cc->labelTable, 0, cc->code[i].arg2, 1);
+        }
+    }
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (strcmp(cc->code[i].op, "LABEL") == 0 && !findName(cc, cc->labelTable, 0, cc->code[i].result, 0)) {
+            cc->dead[i] = 1;
+        }
+    }
+    clearNames(cc, cc->labelTable);
+    return compactCode(cc);
+}
+
+static int findPass(const char *name);
+
+// Dependencies must already be registered, so registration order is a
+// valid pipeline order
+static void registerPass(Pass pass) {
+    if (passCount >= MAX_PASSES) {
+        fprintf(stderr, "Error: Too many passes\n");
+        exit(1);
+    }
+    for (int d = 0; d < MAX_PASS_DEPS && pass.deps[d]; d++) {
+        if (findPass(pass.deps[d]) < 0) {
+            fprintf(stderr, "Error: Pass '%s' depends on unregistered pass '%s'\n",
+                    pass.name, pass.deps[d]);
+            exit(1);
+        }
+    }
+    passes[passCount++] = pass;
+}
+
+void initPasses() {
+    passCount = 0;
+    registerPass((Pass){"inline", "inline small leaf functions", runInline,
+                        1, 1, 0, 0, {NULL}});
+    registerPass((Pass){"constprop", "propagate constants within blocks", runConstProp,
+                        1, 0, ANALYSIS_BLOCKS, ANALYSIS_BLOCKS, {NULL}});
+    registerPass((Pass){"copyprop", "propagate copies within blocks", runCopyProp,
+                        1, 0, ANALYSIS_BLOCKS, ANALYSIS_BLOCKS, {NULL}});
+    registerPass((Pass){"constfold", "fold constant operands", foldConstants,
+                        1, 0, 0, ANALYSIS_BLOCKS, {"constprop"}});
+    registerPass((Pass){"branchfold", "resolve branches on constants", runBranchFold,
+                        2, 0, 0, ANALYSIS_USES, {"constfold"}});
+    registerPass((Pass){"unreachable", "remove unreachable code and labels", runUnreachable,
+                        2, 0, 0, 0, {NULL}});
+    registerPass((Pass){"dce", "remove unused definitions", runDeadCode,
+                        1, 0, ANALYSIS_USES, 0, {NULL}});
+    registerPass((Pass){"vectorize", "vectorize element-wise array loops", vectorizeLoops,
+                        2, 1, ANALYSIS_USES, 0, {"copyprop"}});
+}
+
+static int findPass(const char *name) {
+    for (int i = 0; i < passCount; i++) {
+        if (strcmp(passes[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void setOptLevel(CompileOptions *options, int level) {
+    options->optLevel = level;
+    for (int i = 0; i < passCount; i++) {
+        options->passEnabled[i] = level > 0 && passes[i].minLevel <= level;
+    }
+}
+
+// Enabling a pass pulls in the passes it depends on
+int setPassEnabled(CompileOptions *options, const char *name, int on) {
+    int index = findPass(name);
+    if (index < 0) return 0;
+    options->passEnabled[index] = on;
+    if (on) {
+        for (int d = 0; d < MAX_PASS_DEPS && passes[index].deps[d]; d++) {
+            setPassEnabled(options, passes[index].deps[d], 1);
+        }
+    }
+    return 1;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int runPass(Compiler *cc, int index) {
+    Pass *p = &passes[index];
+    ensureAnalyses(cc, p->requires);
+
+    int before = cc->codeIndex;
+    double start = now();
+    reserveAnalyses(cc);
+    int changed = p->run(cc);
+    cc->passStats[index].seconds += now() - start;
+    cc->passStats[index].runs++;
+
+    // Passes count deletions among their rewrites; report them apart
+    int removed = before - cc->codeIndex;
+    int rewritten = changed - (removed > 0 ? removed : 0);
+    cc->passStats[index].removed += removed;
+    cc->passStats[index].changed += rewritten > 0 ? rewritten : 0;
+
+    if (changed || removed) cc->validAnalyses &= p->preserves;
+    return changed || removed;
+}
+
+// Runs the enabled passes in registration order, repeating at -O2 until
+// an iteration changes nothing
+void optimize(Compiler *cc) {
+    const CompileOptions *options = cc->options;
+    memset(cc->passStats, 0, sizeof(cc->passStats));
+    cc->validAnalyses = 0;
+    cc->iterations = 0;
+    allocNameTables(cc);
+
+    int maxIterations = options->optLevel >= 2 ? MAX_ITERATIONS : 1;
+    int progress = 1;
+    while (progress && cc->iterations < maxIterations) {
+        progress = 0;
+        for (int i = 0; i < passCount; i++) {
+            if (!options->passEnabled[i] || (passes[i].once && cc->iterations > 0)) continue;
+            progress |= runPass(cc, i);
+        }
+        cc->iterations++;
+    }
+    clearNames(cc, cc->useTable);
+}
+
+void printPassReport(Compiler *cc) {
+    double total = 0;
+    outPrintf(&cc->dumpOutput, "\n=== Pass Report (-O%d, %d iteration%s) ===\n",
+           cc->options->optLevel, cc->iterations, cc->iterations == 1 ? "" : "s");
+    outPrintf(&cc->dumpOutput, "%-12s %-5s %-10s %-8s %-8s\n", "Pass", "Runs", "Time(ms)", "Removed", "Changed");
+    outPrintf(&cc->dumpOutput, "----------------------------------------------\n");
+    for (int i = 0; i < passCount; i++) {
+        if (!cc->passStats[i].runs) continue;
+        outPrintf(&cc->dumpOutput, "%-12s %-5d %-10.3f %-8d %-8d\n", passes[i].name, cc->passStats[i].runs,
+               cc->passStats[i].seconds * 1000, cc->passStats[i].removed, cc->passStats[i].changed);
+        total += cc->passStats[i].seconds;
+    }
+    outPrintf(&cc->dumpOutput, "----------------------------------------------\n");
+    outPrintf(&cc->dumpOutput, "%-12s %-5s %-10.3f\n", "total", "", total * 1000);
+}
+
+void freePassState(Compiler *cc) {
+    freeNameTables(cc);
+    free(cc->blockLeader);
+    free(cc->functionOf);
+    free(cc->dead);
+    cc->blockLeader = cc->functionOf = NULL;
+    cc->dead = NULL;
+    cc->analysisCapacity = 0;
+}
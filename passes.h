@@ -0,0 +1,69 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "codegen.h"
+
+#define MAX_PASSES 16
+#define MAX_PASS_DEPS 4
+#define MAX_ITERATIONS 10
+#define MIN_NAME_BUCKETS 256
+#define MAX_NAME_BUCKETS 65536
+
+// Analyses a pass may read; a pass lists the ones it keeps valid
+#define ANALYSIS_BLOCKS 1   // basic-block leaders
+#define ANALYSIS_USES   2   // operand use counts per function
+#define ANALYSIS_ALL    (ANALYSIS_BLOCKS | ANALYSIS_USES)
+
+typedef struct {
+    const char *name;
+    const char *description;
+    int (*run)(Compiler *cc);           // returns the number of quads rewritten
+    int minLevel;                       // lowest -O level that enables the pass
+    int once;                           // skip on later fixed-point iterations
+    unsigned requires;
+    unsigned preserves;
+    const char *deps[MAX_PASS_DEPS];    // passes that must run before this one
+} Pass;
+
+typedef struct {
+    int runs;
+    double seconds;
+    int removed;
+    int changed;
+} PassStats;
+
+// Per-name record shared by the use counts, the propagation bindings and
+// the label target set; each lives in its own table
+typedef struct NameEntry {
+    int function;
+    char name[MAX_LEN];
+    int count;
+    int version;            // bumped on every definition during propagation
+    int bindBlock;          // block in which "name = bindTo" was seen
+    int bindVersion;
+    int bindToVersion;
+    char bindTo[MAX_LEN];
+    struct NameEntry *next;
+} NameEntry;
+
+typedef struct CompileOptions CompileOptions;
+
+void initPasses();
+void setOptLevel(CompileOptions *options, int level);
+int setPassEnabled(CompileOptions *options, const char *name, int enabled);
+void optimize(Compiler *cc);
+void printPassReport(Compiler *cc);
+void freePassState(Compiler *cc);
+
+// Analysis results live in the Compiler, valid while the matching bit is set
+int useCount(Compiler *cc, int index, const char *name);
+
+// Which operands of a quad read or define a name; use counts, DCE and
+// the frame layout (frame.c) must agree on this
+int isNameOperand(const char *s);
+int readsArg1(const Quadruple *q);
+int readsArg2(const Quadruple *q);
+int readsResult(const Quadruple *q);
+int definesResult(const Quadruple *q);
+
+#endif
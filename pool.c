@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+#include "stats.h"
+
+static int takeOwn(WorkQueue *q) {
+    int item = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) item = q->head++;
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static int steal(WorkQueue *q) {
+    int item = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) item = --q->tail;
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static int nextItem(PoolWorker *w) {
+    Pool *pool = w->pool;
+    int item = takeOwn(&pool->queues[w->index]);
+    for (int i = 1; item < 0 && i < pool->workerCount; i++) {
+        item = steal(&pool->queues[(w->index + i) % pool->workerCount]);
+    }
+    return item;
+}
+
+static void* workerMain(void *arg) {
+    PoolWorker *w = (PoolWorker*)arg;
+    Pool *pool = w->pool;
+    int item;
+    while ((item = nextItem(w)) >= 0) {
+        pool->task(pool->context, item);
+
+        pthread_mutex_lock(&pool->doneLock);
+        pool->done[item] = 1;
+        pthread_cond_broadcast(&pool->doneCond);
+        pthread_mutex_unlock(&pool->doneLock);
+    }
+    return NULL;
+}
+
+void startPool(Pool *pool, int count, int jobs, PoolTask task, void *context) {
+    if (jobs > count) jobs = count;
+    if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+    pool->task = task;
+    pool->context = context;
+    pool->count = count;
+    pool->next = 0;
+    pool->workerCount = jobs > 1 ? jobs : 0;
+    pool->done = NULL;
+    if (!pool->workerCount) return;
+
+    pool->done = (char*)xcalloc(count, 1);
+    pthread_mutex_init(&pool->doneLock, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+    for (int w = 0; w < jobs; w++) {
+        pthread_mutex_init(&pool->queues[w].lock, NULL);
+        pool->queues[w].head = (int)((long)count * w / jobs);
+        pool->queues[w].tail = (int)((long)count * (w + 1) / jobs);
+    }
+    for (int w = 0; w < jobs; w++) {
+        pool->workers[w].pool = pool;
+        pool->workers[w].index = w;
+        if (pthread_create(&pool->threads[w], NULL, workerMain, &pool->workers[w]) != 0) {
+            fprintf(stderr, "Error: Cannot start worker thread\n");
+            exit(1);
+        }
+    }
+}
+
+void waitPoolItem(Pool *pool, int index) {
+    if (!pool->workerCount) {
+        while (pool->next <= index) pool->task(pool->context, pool->next++);
+        return;
+    }
+    pthread_mutex_lock(&pool->doneLock);
+    while (!pool->done[index]) pthread_cond_wait(&pool->doneCond, &pool->doneLock);
+    pthread_mutex_unlock(&pool->doneLock);
+}
+
+void finishPool(Pool *pool) {
+    if (!pool->workerCount) {
+        if (pool->count) waitPoolItem(pool, pool->count - 1);
+        return;
+    }
+    for (int w = 0; w < pool->workerCount; w++) pthread_join(pool->threads[w], NULL);
+    for (int w = 0; w < pool->workerCount; w++) pthread_mutex_destroy(&pool->queues[w].lock);
+    pthread_cond_destroy(&pool->doneCond);
+    pthread_mutex_destroy(&pool->doneLock);
+    free(pool->done);
+    pool->done = NULL;
+}
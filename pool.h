@@ -0,0 +1,46 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+#define MAX_JOBS 256
+
+typedef void (*PoolTask)(void *context, int index);
+
+// Each worker owns a contiguous run of items. It takes them from the
+// front, so results the caller consumes in order finish early, and idle
+// workers steal from the back of someone else's run.
+typedef struct {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} WorkQueue;
+
+typedef struct Pool Pool;
+
+typedef struct {
+    Pool *pool;
+    int index;
+} PoolWorker;
+
+// Runs task(context, i) for every i in [0, count). With one job nothing
+// is started and items run on the caller's thread as they are waited for.
+struct Pool {
+    PoolTask task;
+    void *context;
+    int count;
+    int workerCount;            // 0 when running on the caller's thread
+    int next;                   // next item to run when workerCount is 0
+    WorkQueue queues[MAX_JOBS];
+    PoolWorker workers[MAX_JOBS];
+    pthread_t threads[MAX_JOBS];
+    char *done;
+    pthread_mutex_t doneLock;
+    pthread_cond_t doneCond;
+};
+
+void startPool(Pool *pool, int count, int jobs, PoolTask task, void *context);
+void waitPoolItem(Pool *pool, int index);
+void finishPool(Pool *pool);
+
+#endif
@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include "compiler.h"
+
+#define MAX_INCLUDE_NAME 256
+
+static int nextToken(Preprocessor *pp, Token *tok);
+
+static void appendToken(TokenList *list, const Token *tok) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->tokens = (Token*)xrealloc(list->tokens, sizeof(Token) * list->capacity);
+    }
+    list->tokens[list->count++] = *tok;
+}
+
+static int isPunct(const Token *tok, const char *lexeme) {
+    return (tok->type == TOKEN_PUNCTUATION || tok->type == TOKEN_OPERATOR || tok->type == TOKEN_UNKNOWN) &&
+           strcmp(tok->lexeme, lexeme) == 0;
+}
+
+static int isName(const Token *tok) {
+    return tok->type == TOKEN_IDENTIFIER || tok->type == TOKEN_KEYWORD;
+}
+
+// The innermost file being read: a header, or the source at the bottom
+static const Input* currentFile(Preprocessor *pp) {
+    for (int i = pp->inputCount - 1; i > 0; i--) {
+        if (pp->inputs[i].header) return &pp->inputs[i];
+    }
+    return &pp->inputs[0];
+}
+
+static void ppError(Preprocessor *pp, int line, const char *fmt, ...) __attribute__((noreturn, format(printf, 3, 4)));
+
+static void ppError(Preprocessor *pp, int line, const char *fmt, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    const Input *file = pp->inputCount ? currentFile(pp) : NULL;
+    if (file && file->header) {
+        snprintf(pp->error, sizeof(pp->error), "Preprocessor error: %s at %s:%d", message, file->path, line);
+    } else {
+        snprintf(pp->error, sizeof(pp->error), "Preprocessor error: %s at line %d", message, line);
+    }
+    pp->failed = 1;
+    longjmp(pp->onError, 1);
+}
+
+static Input* pushInput(Preprocessor *pp) {
+    if (pp->inputCount == pp->inputCapacity) {
+        pp->inputCapacity = pp->inputCapacity ? pp->inputCapacity * 2 : 16;
+        pp->inputs = (Input*)xrealloc(pp->inputs, sizeof(Input) * pp->inputCapacity);
+    }
+    Input *in = &pp->inputs[pp->inputCount++];
+    memset(in, 0, sizeof(*in));
+    in->conditionalDepth = pp->conditionalCount;
+    return in;
+}
+
+static void releaseInput(Input *in) {
+    if (in->header) releaseHeader(in->header);
+    if (in->macro) in->macro->disabled = 0;
+    free(in->owned);
+}
+
+// A header must close every #if it opens
+static void popInput(Preprocessor *pp) {
+    Input *in = &pp->inputs[pp->inputCount - 1];
+    if (in->header && pp->conditionalCount > in->conditionalDepth) {
+        ppError(pp, pp->conditionals[pp->conditionalCount - 1].line, "unterminated #if");
+    }
+    pp->inputCount--;
+    releaseInput(in);
+}
+
+// Next token of the innermost input, before directives and macros; 0 at
+// the end of the source or of an argument being expanded on its own.
+// The source at the bottom is scanned as it is read, the rest are lists.
+static int readRaw(Preprocessor *pp, Token *tok) {
+    for (;;) {
+        Input *in = &pp->inputs[pp->inputCount - 1];
+        if (pp->inputCount > 1) {
+            if (in->next < in->count) {
+                *tok = in->tokens[in->next++];
+                return 1;
+            }
+            if (in->barrier) return 0;
+            popInput(pp);
+            continue;
+        }
+        if (in->unread) {
+            in->unread = 0;
+        } else if (!scanToken(&in->scanner, &in->token)) {
+            return 0;
+        }
+        *tok = in->token;
+        return 1;
+    }
+}
+
+// Steps back over the token just read, which came from the current input
+static void unreadRaw(Preprocessor *pp) {
+    Input *in = &pp->inputs[pp->inputCount - 1];
+    if (pp->inputCount > 1) in->next--;
+    else in->unread = 1;
+}
+
+static int isActive(Preprocessor *pp) {
+    return pp->expanding || !pp->conditionalCount || pp->conditionals[pp->conditionalCount - 1].active;
+}
+
+static unsigned macroBucket(const char *name) {
+    unsigned hash = 0;
+    for (; *name; name++) hash = hash * 31 + (unsigned char)*name;
+    return hash & (MACRO_BUCKETS - 1);
+}
+
+static Macro* findMacro(Preprocessor *pp, const char *name) {
+    for (Macro *macro = pp->macros[macroBucket(name)]; macro; macro = macro->next) {
+        if (strcmp(macro->name, name) == 0) return macro;
+    }
+    return NULL;
+}
+
+static void freeMacro(Macro *macro) {
+    free(macro->body);
+    free(macro->param);
+    free(macro);
+}
+
+static void undefine(Preprocessor *pp, const char *name) {
+    for (Macro **link = &pp->macros[macroBucket(name)]; *link; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) {
+            Macro *macro = *link;
+            *link = macro->next;
+            freeMacro(macro);
+            pp->macroCount--;
+            return;
+        }
+    }
+}
+
+// Whether the macro's name is followed directly by "(", which only the
+// directive's text can tell: tokens carry no spacing
+static int isFunctionLike(const char *text, const char *name) {
+    const char *p = text + 1;
+    while (*p == ' ' || *p == '\t') p++;
+    if (strncmp(p, "define", 6) != 0) return 0;
+    for (p += 6; *p == ' ' || *p == '\t'; p++) {}
+    size_t length = strlen(name);
+    return strncmp(p, name, length) == 0 && p[length] == '(';
+}
+
+static void defineMacro(Preprocessor *pp, const Token *hash, const Token *words, int count) {
+    if (count < 2 || !isName(&words[1])) ppError(pp, hash->line, "macro name missing after #define");
+    const char *name = words[1].lexeme;
+    const char *params[MAX_MACRO_PARAMS];
+    int paramCount = -1;
+    int i = 2;
+
+    if (count > 2 && isFunctionLike(hash->lexeme, name)) {
+        paramCount = 0;
+        i = 3;
+        if (i < count && isPunct(&words[i], ")")) {
+            i++;
+        } else {
+            for (;;) {
+                if (i >= count || !isName(&words[i]) || paramCount == MAX_MACRO_PARAMS) {
+                    ppError(pp, hash->line, "bad parameter list for macro %s", name);
+                }
+                params[paramCount++] = words[i++].lexeme;
+                if (i < count && isPunct(&words[i], ")")) break;
+                if (i >= count || !isPunct(&words[i], ",")) {
+                    ppError(pp, hash->line, "bad parameter list for macro %s", name);
+                }
+                i++;
+            }
+            i++;
+        }
+    }
+
+    Macro *macro = (Macro*)xcalloc(1, sizeof(Macro));
+    strcpy(macro->name, name);
+    macro->paramCount = paramCount;
+    macro->bodyCount = count - i;
+    macro->body = (Token*)xmalloc(sizeof(Token) * (macro->bodyCount ? macro->bodyCount : 1));
+    macro->param = (int*)xmalloc(sizeof(int) * (macro->bodyCount ? macro->bodyCount : 1));
+    for (int j = 0; j < macro->bodyCount; j++) {
+        macro->body[j] = words[i + j];
+        macro->param[j] = -1;
+        for (int k = 0; k < paramCount && isName(&words[i + j]); k++) {
+            if (strcmp(words[i + j].lexeme, params[k]) == 0) macro->param[j] = k;
+        }
+    }
+
+    undefine(pp, name);
+    unsigned bucket = macroBucket(name);
+    macro->next = pp->macros[bucket];
+    pp->macros[bucket] = macro;
+    pp->macroCount++;
+}
+
+// Expands tokens on their own, as a macro argument or an #if line is
+static void expandList(Preprocessor *pp, const Token *tokens, int count, TokenList *out) {
+    Input *in = pushInput(pp);
+    in->tokens = tokens;
+    in->count = count;
+    in->barrier = 1;
+
+    Token tok;
+    pp->expanding++;
+    while (nextToken(pp, &tok)) appendToken(out, &tok);
+    pp->expanding--;
+    popInput(pp);
+}
+
+// Pushes the expansion of macro, whose name was just read; a function-like
+// macro whose name is not followed by "(" is left alone, and 0 returned.
+// Arguments are expanded before they are substituted, and the macro stays
+// disabled until its expansion has been read, so it cannot recurse.
+static int expandMacro(Preprocessor *pp, Macro *macro, const Token *name) {
+    TokenList args = {0};
+    TokenList expanded[MAX_MACRO_PARAMS];
+    int starts[MAX_MACRO_PARAMS + 2];
+    int argCount = 0;
+
+    if (macro->paramCount >= 0) {
+        Token tok;
+        if (!readRaw(pp, &tok)) return 0;
+        if (!isPunct(&tok, "(")) {
+            unreadRaw(pp);
+            return 0;
+        }
+
+        int depth = 0;
+        starts[0] = 0;
+        for (;;) {
+            if (!readRaw(pp, &tok) || tok.type == TOKEN_PREPROCESSOR) {
+                free(args.tokens);
+                ppError(pp, name->line, "unterminated call to macro %s", macro->name);
+            }
+            if (isPunct(&tok, ")") && depth == 0) break;
+            if (isPunct(&tok, ",") && depth == 0) {
+                if (++argCount > MAX_MACRO_PARAMS) {
+                    free(args.tokens);
+                    ppError(pp, name->line, "too many arguments to macro %s", macro->name);
+                }
+                starts[argCount] = args.count;
+                continue;
+            }
+            if (isPunct(&tok, "(")) depth++;
+            if (isPunct(&tok, ")")) depth--;
+            appendToken(&args, &tok);
+        }
+        starts[++argCount] = args.count;
+        if (macro->paramCount == 0 && argCount == 1 && args.count == 0) argCount = 0;
+        if (argCount != macro->paramCount) {
+            free(args.tokens);
+            ppError(pp, name->line, "macro %s takes %d arguments, not %d", macro->name, macro->paramCount, argCount);
+        }
+    }
+
+    memset(expanded, 0, sizeof(TokenList) * argCount);
+    for (int a = 0; a < argCount; a++) {
+        expandList(pp, args.tokens + starts[a], starts[a + 1] - starts[a], &expanded[a]);
+    }
+
+    TokenList result = {0};
+    for (int j = 0; j < macro->bodyCount; j++) {
+        int a = macro->param[j];
+        if (a < 0) appendToken(&result, &macro->body[j]);
+        else for (int k = 0; k < expanded[a].count; k++) appendToken(&result, &expanded[a].tokens[k]);
+    }
+    for (int k = 0; k < result.count; k++) result.tokens[k].line = name->line;
+    for (int a = 0; a < argCount; a++) free(expanded[a].tokens);
+    free(args.tokens);
+
+    Input *in = pushInput(pp);
+    in->tokens = in->owned = result.tokens;
+    in->count = result.count;
+    in->macro = macro;
+    macro->disabled = 1;
+    return 1;
+}
+
+// #if expressions: integer constants, macros expanded, defined X, and the
+// C operators in their usual precedence. Names left over are 0.
+typedef struct {
+    const Token *tokens;
+    int count;
+    int pos;
+    const char *error;
+} Evaluator;
+
+// "<<" and ">>" are two tokens to this lexer
+static int acceptOp(Evaluator *e, const char *op) {
+    if (strcmp(op, "<<") == 0 || strcmp(op, ">>") == 0) {
+        char half[2] = { op[0], '\0' };
+        if (e->pos + 1 >= e->count || !isPunct(&e->tokens[e->pos], half) || !isPunct(&e->tokens[e->pos + 1], half)) {
+            return 0;
+        }
+        e->pos += 2;
+        return 1;
+    }
+    if (e->pos >= e->count || !isPunct(&e->tokens[e->pos], op)) return 0;
+    e->pos++;
+    return 1;
+}
+
+static const char *binaryOps[][5] = {
+    { "||" }, { "&&" }, { "|" }, { "^" }, { "&" }, { "==", "!=" },
+    { "<=", ">=", "<", ">" }, { "<<", ">>" }, { "+", "-" }, { "*", "/", "%" }
+};
+#define BINARY_LEVELS ((int)(sizeof(binaryOps) / sizeof(binaryOps[0])))
+
+static long long evalConditional(Evaluator *e);
+
+static long long evalUnary(Evaluator *e) {
+    if (acceptOp(e, "!")) return !evalUnary(e);
+    if (acceptOp(e, "-")) return -evalUnary(e);
+    if (acceptOp(e, "+")) return evalUnary(e);
+    if (acceptOp(e, "~")) return ~evalUnary(e);
+    if (acceptOp(e, "(")) {
+        long long value = evalConditional(e);
+        if (!acceptOp(e, ")")) e->error = "missing ')'";
+        return value;
+    }
+    if (e->pos >= e->count) {
+        e->error = "missing operand";
+        return 0;
+    }
+    const Token *tok = &e->tokens[e->pos++];
+    if (isName(tok)) return 0;
+    if (tok->type == TOKEN_NUMBER) return strtoll(tok->lexeme, NULL, 0);
+    e->error = "bad token";
+    return 0;
+}
+
+static long long evalBinary(Evaluator *e, int level) {
+    if (level == BINARY_LEVELS) return evalUnary(e);
+    long long left = evalBinary(e, level + 1);
+    for (;;) {
+        const char *op = NULL;
+        for (int i = 0; i < 5 && binaryOps[level][i] && !op; i++) {
+            if (acceptOp(e, binaryOps[level][i])) op = binaryOps[level][i];
+        }
+        if (!op) return left;
+        long long right = evalBinary(e, level + 1);
+        if ((op[0] == '/' || op[0] == '%') && right == 0) {
+            e->error = "division by zero";
+            right = 1;
+        }
+        if (strcmp(op, "||") == 0) left = left || right;
+        else if (strcmp(op, "&&") == 0) left = left && right;
+        else if (strcmp(op, "|") == 0) left |= right;
+        else if (strcmp(op, "^") == 0) left ^= right;
+        else if (strcmp(op, "&") == 0) left &= right;
+        else if (strcmp(op, "==") == 0) left = left == right;
+        else if (strcmp(op, "!=") == 0) left = left != right;
+        else if (strcmp(op, "<=") == 0) left = left <= right;
+        else if (strcmp(op, ">=") == 0) left = left >= right;
+        else if (strcmp(op, "<") == 0) left = left < right;
+        else if (strcmp(op, ">") == 0) left = left > right;
+        else if (strcmp(op, "<<") == 0) left = (long long)((unsigned long long)left << (right & 63));
+        else if (strcmp(op, ">>") == 0) left >>= right & 63;
+        else if (strcmp(op, "+") == 0) left = (long long)((unsigned long long)left + (unsigned long long)right);
+        else if (strcmp(op, "-") == 0) left = (long long)((unsigned long long)left - (unsigned long long)right);
+        else if (strcmp(op, "*") == 0) left = (long long)((unsigned long long)left * (unsigned long long)right);
+        else if (strcmp(op, "/") == 0) left /= right;
+        else left %= right;
+    }
+}
+
+static long long evalConditional(Evaluator *e) {
+    long long condition = evalBinary(e, 0);
+    if (!acceptOp(e, "?")) return condition;
+    long long then = evalConditional(e);
+    if (!acceptOp(e, ":")) e->error = "missing ':'";
+    long long otherwise = evalConditional(e);
+    return condition ? then : otherwise;
+}
+
+// "defined X" and "defined(X)" are replaced before macros are expanded
+static int evaluate(Preprocessor *pp, const Token *words, int count, int line) {
+    TokenList expr = {0}, values = {0};
+    for (int i = 1; i < count; i++) {
+        if (strcmp(words[i].lexeme, "defined") != 0) {
+            appendToken(&expr, &words[i]);
+            continue;
+        }
+        int paren = i + 1 < count && isPunct(&words[i + 1], "(");
+        int at = i + 1 + paren;
+        if (at >= count || !isName(&words[at]) || (paren && (at + 1 >= count || !isPunct(&words[at + 1], ")")))) {
+            free(expr.tokens);
+            ppError(pp, line, "macro name missing after defined");
+        }
+        Token value = words[at];
+        value.type = TOKEN_NUMBER;
+        strcpy(value.lexeme, findMacro(pp, words[at].lexeme) ? "1" : "0");
+        appendToken(&expr, &value);
+        i = at + paren;
+    }
+    expandList(pp, expr.tokens, expr.count, &values);
+    free(expr.tokens);
+
+    Evaluator e = { values.tokens, values.count, 0, NULL };
+    long long result = evalConditional(&e);
+    if (!e.error && e.pos < e.count) e.error = "extra tokens";
+    free(values.tokens);
+    if (e.error || !values.count) ppError(pp, line, "bad #%s expression: %s", words[0].lexeme, e.error ? e.error : "empty");
+    return result != 0;
+}
+
+static void pushConditional(Preprocessor *pp, int line, int condition) {
+    if (pp->conditionalCount == pp->conditionalCapacity) {
+        pp->conditionalCapacity = pp->conditionalCapacity ? pp->conditionalCapacity * 2 : 16;
+        pp->conditionals = (Conditional*)xrealloc(pp->conditionals, sizeof(Conditional) * pp->conditionalCapacity);
+    }
+    int parent = isActive(pp);
+    Conditional *c = &pp->conditionals[pp->conditionalCount++];
+    c->active = parent && condition;
+    c->taken = !parent || condition;    // in skipped lines no branch is kept
+    c->sawElse = 0;
+    c->line = line;
+}
+
+// #elif, #else and #endif, which must close an #if of the same file
+static Conditional* currentConditional(Preprocessor *pp, const char *name, int line) {
+    if (pp->conditionalCount <= pp->inputs[pp->inputCount - 1].conditionalDepth) {
+        ppError(pp, line, "#%s without #if", name);
+    }
+    Conditional *c = &pp->conditionals[pp->conditionalCount - 1];
+    if (c->sawElse && strcmp(name, "endif") != 0) ppError(pp, line, "#%s after #else", name);
+    return c;
+}
+
+static int isFile(const char *path, struct stat *st) {
+    return stat(path, st) == 0 && !S_ISDIR(st->st_mode);
+}
+
+// "file" is looked for next to the including file first
+static int findInclude(Preprocessor *pp, const char *name, int angled, char *path, struct stat *st) {
+    const CompileOptions *options = pp->cc->options;
+    if (name[0] == '/') {
+        snprintf(path, PATH_MAX, "%s", name);
+        return isFile(path, st);
+    }
+    if (!angled) {
+        const char *including = currentFile(pp)->path;
+        const char *slash = strrchr(including, '/');
+        if (slash) snprintf(path, PATH_MAX, "%.*s/%s", (int)(slash - including), including, name);
+        else snprintf(path, PATH_MAX, "%s", name);
+        if (isFile(path, st)) return 1;
+    }
+    for (int i = 0; i < options->includeDirCount; i++) {
+        snprintf(path, PATH_MAX, "%s/%s", options->includeDirs[i], name);
+        if (isFile(path, st)) return 1;
+    }
+    return 0;
+}
+
+static int isOnce(Preprocessor *pp, const struct stat *st) {
+    for (int i = 0; i < pp->onceCount; i++) {
+        if (pp->once[i].device == st->st_dev && pp->once[i].inode == st->st_ino) return 1;
+    }
+    return 0;
+}
+
+static void markOnce(Preprocessor *pp) {
+    const Input *file = currentFile(pp);
+    if (!file->header) return;
+    if (pp->onceCount == pp->onceCapacity) {
+        pp->onceCapacity = pp->onceCapacity ? pp->onceCapacity * 2 : 16;
+        pp->once = (FileId*)xrealloc(pp->once, sizeof(FileId) * pp->onceCapacity);
+    }
+    pp->once[pp->onceCount].device = file->header->device;
+    pp->once[pp->onceCount].inode = file->header->inode;
+    pp->onceCount++;
+}
+
+// Returns 1 to leave an unresolved <file> to the parser. A header seen
+// before is not read again when it said #pragma once or its include
+// guard is defined.
+static int includeFile(Preprocessor *pp, const Token *words, int count, int line) {
+    char name[MAX_INCLUDE_NAME], path[PATH_MAX];
+    int angled = count >= 2 && isPunct(&words[1], "<");
+    size_t length = 0;
+
+    if (count >= 2 && words[1].type == TOKEN_STRING && strlen(words[1].lexeme) >= 2) {
+        length = strlen(words[1].lexeme) - 2;
+        memcpy(name, words[1].lexeme + 1, length);
+    } else if (angled) {
+        int i;
+        for (i = 2; i < count && !isPunct(&words[i], ">"); i++) {
+            size_t part = strlen(words[i].lexeme);
+            if (length + part >= sizeof(name)) ppError(pp, line, "include name too long");
+            memcpy(name + length, words[i].lexeme, part);
+            length += part;
+        }
+        if (i == count) ppError(pp, line, "missing '>' after #include <");
+    } else {
+        ppError(pp, line, "expected \"file\" or <file> after #include");
+    }
+    name[length] = '\0';
+
+    struct stat st;
+    if (!findInclude(pp, name, angled, path, &st)) {
+        if (angled) return 1;
+        ppError(pp, line, "cannot find include file %s", name);
+    }
+    if (pp->inputCount > MAX_INCLUDE_DEPTH) ppError(pp, line, "#include nested too deeply");
+    addCounter(pp->stats, COUNTER_INCLUDES, 1);
+    if (isOnce(pp, &st)) {
+        addCounter(pp->stats, COUNTER_INCLUDES_SKIPPED, 1);
+        return 0;
+    }
+
+    int lexed;
+    HeaderEntry *header = acquireHeader(path, &st, &lexed);
+    if (!header) ppError(pp, line, "cannot read include file %s", path);
+    if (lexed) addCounter(pp->stats, COUNTER_HEADERS_LEXED, 1);
+    if (header->guard[0] && findMacro(pp, header->guard)) {
+        releaseHeader(header);
+        addCounter(pp->stats, COUNTER_INCLUDES_SKIPPED, 1);
+        return 0;
+    }
+
+    Input *in = pushInput(pp);
+    in->header = header;
+    in->tokens = header->tokens;
+    in->count = header->count;
+    in->path = header->path;
+    return 0;
+}
+
+// Runs the directive hash introduces; returns 1 to keep it in the token
+// stream for the parser
+static int directive(Preprocessor *pp, const Token *hash) {
+    Token tok;
+    pp->line.count = 0;
+    while (readRaw(pp, &tok) && tok.type != TOKEN_DIRECTIVE_END) appendToken(&pp->line, &tok);
+    const Token *words = pp->line.tokens;
+    int count = pp->line.count;
+    int line = hash->line;
+    if (!count) return 0;
+    const char *name = words[0].lexeme;
+
+    if (strcmp(name, "ifdef") == 0 || strcmp(name, "ifndef") == 0) {
+        int defined = 0;
+        if (isActive(pp)) {
+            if (count < 2 || !isName(&words[1])) ppError(pp, line, "macro name missing after #%s", name);
+            defined = findMacro(pp, words[1].lexeme) != NULL;
+        }
+        pushConditional(pp, line, name[2] == 'd' ? defined : !defined);
+        return 0;
+    }
+    if (strcmp(name, "if") == 0) {
+        pushConditional(pp, line, isActive(pp) && evaluate(pp, words, count, line));
+        return 0;
+    }
+    if (strcmp(name, "elif") == 0) {
+        Conditional *c = currentConditional(pp, name, line);
+        if (c->taken) {
+            c->active = 0;
+        } else {
+            c->active = c->taken = evaluate(pp, words, count, line);
+        }
+        return 0;
+    }
+    if (strcmp(name, "else") == 0) {
+        Conditional *c = currentConditional(pp, name, line);
+        c->sawElse = 1;
+        c->active = !c->taken;
+        c->taken = 1;
+        return 0;
+    }
+    if (strcmp(name, "endif") == 0) {
+        currentConditional(pp, name, line);
+        pp->conditionalCount--;
+        return 0;
+    }
+
+    if (!isActive(pp)) return 0;
+    if (strcmp(name, "define") == 0) {
+        defineMacro(pp, hash, words, count);
+        return 0;
+    }
+    if (strcmp(name, "undef") == 0) {
+        if (count < 2 || !isName(&words[1])) ppError(pp, line, "macro name missing after #undef");
+        undefine(pp, words[1].lexeme);
+        return 0;
+    }
+    if (strcmp(name, "include") == 0) return includeFile(pp, words, count, line);
+    if (strcmp(name, "pragma") == 0 && count == 2 && strcmp(words[1].lexeme, "once") == 0) {
+        markOnce(pp);
+        return 0;
+    }
+    if (strcmp(name, "error") == 0) {
+        const char *text = strstr(hash->lexeme, "error") + 5;
+        while (*text == ' ' || *text == '\t') text++;
+        ppError(pp, line, "#error %s", text);
+    }
+    return 1;
+}
+
+static int nextToken(Preprocessor *pp, Token *tok) {
+    while (readRaw(pp, tok)) {
+        if (tok->type == TOKEN_PREPROCESSOR) {
+            if (directive(pp, tok)) return 1;
+            continue;
+        }
+        if (!isActive(pp)) continue;
+        if (pp->macroCount && isName(tok)) {
+            Macro *macro = findMacro(pp, tok->lexeme);
+            if (macro && !macro->disabled && expandMacro(pp, macro, tok)) continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// -D name or name=value, run as "#define name value"
+static void predefine(Preprocessor *pp, const char *definition) {
+    char text[MAX_PP_ERROR];
+    const char *value = strchr(definition, '=');
+    if (value) snprintf(text, sizeof(text), "#define %.*s %s", (int)(value - definition), definition, value + 1);
+    else snprintf(text, sizeof(text), "#define %s 1", definition);
+
+    Scanner scanner;
+    Token hash, tok;
+    initScanner(&scanner, text, strlen(text));
+    scanToken(&scanner, &hash);
+    pp->line.count = 0;
+    while (scanToken(&scanner, &tok) && tok.type != TOKEN_DIRECTIVE_END) appendToken(&pp->line, &tok);
+    defineMacro(pp, &hash, pp->line.tokens, pp->line.count);
+}
+
+// Opens the source; counters go to stats, which belongs to the thread
+// that will read the tokens
+Preprocessor* openPreprocessor(Compiler *cc, CompileStats *stats) {
+    Preprocessor *pp = (Preprocessor*)xcalloc(1, sizeof(Preprocessor));
+    pp->cc = cc;
+    pp->stats = stats;
+    cc->preprocessor = pp;
+    if (!loadSource(cc->source, &pp->source)) {
+        compileError(cc, "❌ Cannot open file.");
+    }
+    Input *in = pushInput(pp);
+    initScanner(&in->scanner, pp->source.data, pp->source.length);
+    in->path = cc->source;
+    return pp;
+}
+
+// Next token of the preprocessed source; 0 at its end. Errors longjmp
+// to pp->onError.
+int preprocess(Preprocessor *pp, Token *tok) {
+    if (!pp->started) {
+        const CompileOptions *options = pp->cc->options;
+        pp->started = 1;
+        for (int i = 0; i < options->defineCount; i++) predefine(pp, options->defines[i]);
+    }
+    if (nextToken(pp, tok)) return 1;
+    if (pp->conditionalCount) {
+        ppError(pp, pp->conditionals[pp->conditionalCount - 1].line, "unterminated #if");
+    }
+    return 0;
+}
+
+void closePreprocessor(Compiler *cc) {
+    Preprocessor *pp = cc->preprocessor;
+    if (!pp) return;
+    while (pp->inputCount) releaseInput(&pp->inputs[--pp->inputCount]);
+    for (int b = 0; b < MACRO_BUCKETS; b++) {
+        while (pp->macros[b]) {
+            Macro *macro = pp->macros[b];
+            pp->macros[b] = macro->next;
+            freeMacro(macro);
+        }
+    }
+    free(pp->inputs);
+    free(pp->conditionals);
+    free(pp->once);
+    free(pp->line.tokens);
+    unloadSource(&pp->source);
+    free(pp);
+    cc->preprocessor = NULL;
+}
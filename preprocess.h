@@ -0,0 +1,96 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <setjmp.h>
+#include "lexer.h"
+#include "headers.h"
+#include "stats.h"
+
+#define MAX_INCLUDE_DEPTH 200
+#define MAX_MACRO_PARAMS 32
+#define MACRO_BUCKETS 256
+#define MAX_PP_ERROR 512
+
+// Runs directives and expands macros between the scanner and the parser:
+// #include, #define and #undef (object- and function-like macros, without
+// the # and ## operators), #if/#ifdef/#ifndef/#elif/#else/#endif,
+// #pragma once and #error. "file" includes are searched for next to the
+// including file, then in the -I directories; <file> includes only in the
+// -I directories, and one not found there is left in the token stream as
+// before, for the system's own headers. Other directives pass through too.
+
+typedef struct {
+    Token *tokens;
+    int count;
+    int capacity;
+} TokenList;
+
+typedef struct Macro {
+    char name[MAX_LEXEME_LEN];
+    int paramCount;             // -1 when object-like
+    Token *body;
+    int *param;                 // per body token: the parameter it names, or -1
+    int bodyCount;
+    int disabled;               // being expanded, so its name is left alone
+    struct Macro *next;
+} Macro;
+
+// Tokens are read from a stack of inputs: the source file at the bottom,
+// then included headers and macro expansions
+typedef struct {
+    Scanner scanner;            // the source file
+    Token token;                // its last token
+    int unread;                 // token is to be read again
+    const Token *tokens;        // a header's or an expansion's tokens
+    Token *owned;               // expansion tokens, freed when it ends
+    int count;
+    int next;
+    HeaderEntry *header;        // released when the input ends
+    Macro *macro;               // enabled again when the input ends
+    int barrier;                // an argument expanded on its own; reads stop at its end
+    const char *path;           // file, for relative includes and messages
+    int conditionalDepth;       // #if nesting when the input began
+} Input;
+
+typedef struct {
+    int active;                 // its lines are kept
+    int taken;                  // it or an earlier branch was kept
+    int sawElse;
+    int line;                   // of its #if
+} Conditional;
+
+typedef struct {
+    dev_t device;
+    ino_t inode;
+} FileId;
+
+typedef struct Preprocessor {
+    Compiler *cc;
+    SourceText source;
+    int started;
+    Input *inputs;
+    int inputCount;
+    int inputCapacity;
+    Macro *macros[MACRO_BUCKETS];
+    int macroCount;
+    int expanding;              // arguments being expanded; conditionals do not apply
+    Conditional *conditionals;
+    int conditionalCount;
+    int conditionalCapacity;
+    FileId *once;               // headers that said #pragma once
+    int onceCount;
+    int onceCapacity;
+    TokenList line;             // the directive being run
+    CompileStats *stats;
+
+    // Errors unwind to the loop reading tokens, on whichever thread it runs
+    jmp_buf onError;
+    int failed;
+    char error[MAX_PP_ERROR];
+} Preprocessor;
+
+Preprocessor* openPreprocessor(Compiler *cc, CompileStats *stats);
+int preprocess(Preprocessor *pp, Token *tok);
+void closePreprocessor(Compiler *cc);
+
+#endif
@@ -1,136 +1,338 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "parser.h"
-#include "semantic.h"
+#include "compiler.h"
 
-#define MAX_SCOPE_DEPTH 100
-#define MAX_SYMBOLS 1000
-
-typedef struct {
-    char name[100];
-    int scopeDepth;
-} Symbol;
-
-Symbol symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
-int currentScopeDepth = 0;
-
-void enterScope() {
-    currentScopeDepth++;
+void enterScope(Compiler *cc) {
+    cc->currentScopeDepth++;
 }
 
-void exitScope() {
+void exitScope(Compiler *cc) {
     
-    for (int i = symbolCount - 1; i >= 0; i--) {
-        if (symbolTable[i].scopeDepth == currentScopeDepth) {
-            symbolCount--;
+    for (int i = cc->symbolCount - 1; i >= 0; i--) {
+        if (cc->symbolTable[i].scopeDepth == cc->currentScopeDepth) {
+            cc->symbolCount--;
         } else {
             break;
         }
     }
-    currentScopeDepth--;
+    cc->currentScopeDepth--;
 }
 
-int isDeclaredInCurrentScope(const char *name) {
-    for (int i = symbolCount - 1; i >= 0; i--) {
-        if (strcmp(symbolTable[i].name, name) == 0 &&
-            symbolTable[i].scopeDepth == currentScopeDepth) {
+int isDeclaredInCurrentScope(Compiler *cc, const char *name) {
+    for (int i = cc->symbolCount - 1; i >= 0; i--) {
+        if (strcmp(cc->symbolTable[i].name, name) == 0 &&
+            cc->symbolTable[i].scopeDepth == cc->currentScopeDepth) {
             return 1;
         }
     }
     return 0;
 }
 
-int isDeclaredInAnyScope(const char *name) {
-    for (int i = symbolCount - 1; i >= 0; i--) {
-        if (strcmp(symbolTable[i].name, name) == 0) {
-            return 1;
+Symbol* findSymbol(Compiler *cc, const char *name) {
+    for (int i = cc->symbolCount - 1; i >= 0; i--) {
+        if (strcmp(cc->symbolTable[i].name, name) == 0) {
+            return &cc->symbolTable[i];
         }
     }
-    return 0;
+    return NULL;
+}
+
+void declareSymbol(Compiler *cc, ASTNode *var) {
+    if (isDeclaredInCurrentScope(cc, var->name)) {
+        compileError(cc, "Semantic error: Redeclaration of variable '%s'", var->name);
+    }
+    if (cc->symbolCount == cc->symbolCapacity) {
+        cc->symbolCapacity = cc->symbolCapacity ? cc->symbolCapacity * 2 : INITIAL_SYMBOLS;
+        cc->symbolTable = (Symbol*)xrealloc(cc->symbolTable, sizeof(Symbol) * cc->symbolCapacity);
+    }
+    strcpy(cc->symbolTable[cc->symbolCount].name, var->name);
+    cc->symbolTable[cc->symbolCount].scopeDepth = cc->currentScopeDepth;
+    cc->symbolTable[cc->symbolCount].type = var->dataType;
+    cc->symbolTable[cc->symbolCount].decl = var;
+    cc->symbolCount++;
+    addCounter(&cc->stats, COUNTER_SYMBOLS, 1);
 }
 
-void declareSymbol(const char *name) {
-    if (isDeclaredInCurrentScope(name)) {
-        fprintf(stderr, "Semantic error: Redeclaration of variable '%s'\n", name);
-        exit(1);
+// Resolves a use of a variable, leaving its declaration and type on it
+void useSymbol(Compiler *cc, ASTNode *node) {
+    Symbol *sym = findSymbol(cc, node->name);
+    if (!sym) {
+        compileError(cc, "Semantic error: Use of undeclared variable '%s'", node->name);
     }
-    strcpy(symbolTable[symbolCount].name, name);
-    symbolTable[symbolCount].scopeDepth = currentScopeDepth;
-    symbolCount++;
+    node->symbol = sym->decl;
+    node->dataType = sym->type;
+}
+
+unsigned functionBucket(const char *name) {
+    unsigned h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h % FUNCTION_BUCKETS;
 }
 
-void useSymbol(const char *name) {
-    if (!isDeclaredInAnyScope(name)) {
-        fprintf(stderr, "Semantic error: Use of undeclared variable '%s'\n", name);
-        exit(1);
+// Buckets hold index + 1 so the zero-initialized table means empty
+FunctionInfo* findFunction(Compiler *cc, const char *name) {
+    if (!cc->functionBuckets) return NULL;
+    for (int i = cc->functionBuckets[functionBucket(name)] - 1; i >= 0;
+         i = cc->functionTable[i].nextInBucket - 1) {
+        if (strcmp(cc->functionTable[i].name, name) == 0) {
+            return &cc->functionTable[i];
+        }
     }
+    return NULL;
 }
 
-void analyzeAST(ASTNode *node);
+void declareFunction(Compiler *cc, ASTNode *func) {
+    if (findFunction(cc, func->name)) {
+        compileError(cc, "Semantic error: Redefinition of function '%s'", func->name);
+    }
+    if (cc->functionCount == cc->functionCapacity) {
+        cc->functionCapacity = cc->functionCapacity ? cc->functionCapacity * 2 : 64;
+        cc->functionTable = (FunctionInfo*)xrealloc(cc->functionTable, sizeof(FunctionInfo) * cc->functionCapacity);
+    }
+    if (!cc->functionBuckets) cc->functionBuckets = (int*)xcalloc(FUNCTION_BUCKETS, sizeof(int));
+    FunctionInfo *fn = &cc->functionTable[cc->functionCount];
+    int params = 0;
+    for (ASTNode *p = func->condition; p; p = p->next) {
+        if (params < MAX_TYPED_PARAMS) {
+            fn->paramTypes[params] = p->condition->dataType;
+            fn->paramArrays[params] = p->condition->arraySize != 0;
+        }
+        params++;
+    }
+
+    unsigned bucket = functionBucket(func->name);
+    strcpy(fn->name, func->name);
+    fn->paramCount = params;
+    fn->nextInBucket = cc->functionBuckets[bucket];
+    cc->functionBuckets[bucket] = cc->functionCount + 1;
+    cc->functionCount++;
+}
+
+void analyzeAST(Compiler *cc, ASTNode *node);
+
+FunctionInfo* analyzeCall(Compiler *cc, ASTNode *node) {
+    int args = 0;
+    for (ASTNode *arg = node->body; arg; arg = arg->next) args++;
+
+    FunctionInfo *fn = findFunction(cc, node->condition->name);
+    if (!fn) {
+        // No prototypes yet; treat unknown callees (printf, ...) as external
+        compileWarning(cc, "Semantic warning: Implicit declaration of function '%s'",
+                       node->condition->name);
+    } else if (fn->paramCount != args) {
+        compileError(cc, "Semantic error: Function '%s' expects %d argument(s) but got %d",
+                     fn->name, fn->paramCount, args);
+    }
+    return fn;
+}
+
+// Makes the expression in *slot have type to, wrapping it in an "itof" or
+// "ftoi" node. Constants are converted in place instead.
+void convertTo(Compiler *cc, ASTNode **slot, DataType from, DataType to) {
+    ASTNode *node = *slot;
+    if (from == to) return;
+
+    if (is_number(node->name) || is_float(node->name)) {
+        float value = strtof(node->name, NULL);
+        if (to == TYPE_FLOAT) {
+            formatFloat(node->name, value);
+            node->dataType = to;
+            return;
+        }
+        if (floatFitsInt(value)) {
+            sprintf(node->name, "%d", (int)value);
+            node->dataType = to;
+            return;
+        }
+    }
+    ASTNode *conv = createNode(cc, AST_EXPRESSION);
+    strcpy(conv->name, to == TYPE_FLOAT ? "itof" : "ftoi");
+    conv->condition = node;
+    conv->dataType = to;
+    conv->next = node->next;
+    node->next = NULL;
+    *slot = conv;
+}
+
+// The token a leaf was lexed as, by the lexer's own rules; a negated
+// literal the parser folded into one leaf is typed as the literal
+static int leafTokenType(const char *name) {
+    Scanner scanner;
+    Token tok;
+    if (name[0] == '-' && name[1]) name++;
+    initScanner(&scanner, name, strlen(name));
+    return scanToken(&scanner, &tok) ? tok.type : TOKEN_UNKNOWN;
+}
 
-void analyzeExpression(ASTNode *node) {
-    if (!node) return;
+DataType analyzeValue(Compiler *cc, ASTNode **slot, int allowArray);
+
+static int isComparison(const char *op) {
+    return strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 || strcmp(op, "<") == 0 ||
+           strcmp(op, ">") == 0 || strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0;
+}
+
+static int isArrayName(ASTNode *node) {
+    return !node->condition && !node->body && node->symbol && node->symbol->arraySize;
+}
+
+// Passing an array binds it to an array parameter of the same element type
+static void checkArgument(Compiler *cc, FunctionInfo *fn, int index, ASTNode **arg, DataType type) {
+    int isArray = isArrayName(*arg);
+    if (fn->paramArrays[index] != isArray) {
+        compileError(cc, "Semantic error: Argument %d of '%s' must %sbe an array", index + 1, fn->name,
+                     isArray ? "not " : "");
+    }
+    if (!isArray) convertTo(cc, arg, type, fn->paramTypes[index]);
+    else if (type != fn->paramTypes[index]) {
+        compileError(cc, "Semantic error: Argument %d of '%s' has the wrong element type", index + 1, fn->name);
+    }
+}
+
+// The bytes sizeof gives: an array's elements, or one word
+static int sizeOf(Compiler *cc, ASTNode **operand) {
+    ASTNode *node = *operand;
+    if (strcmp(node->name, "int") == 0 || strcmp(node->name, "float") == 0) return WORD_SIZE;
+    analyzeValue(cc, operand, 1);
+    node = *operand;
+    if (isArrayName(node) && node->symbol->arraySize > 0) return node->symbol->arraySize * WORD_SIZE;
+    return WORD_SIZE;
+}
+
+// Checks the expression in *slot and sets the type of every node in it,
+// converting operands where int and float meet. Int multiplies and
+// divides by powers of two become shifts here, once it is known they
+// are not float; the node in *slot may be replaced. An array name is a
+// value only where allowArray is set: as a call argument.
+DataType analyzeValue(Compiler *cc, ASTNode **slot, int allowArray) {
+    ASTNode *node = *slot;
+    if (!node) return TYPE_INT;
 
     if (strcmp(node->name, "=") == 0) {
-        
-        if (node->condition) {
-            useSymbol(node->condition->name); 
+        DataType type = TYPE_INT;
+        if (strcmp(node->condition->name, "[]") == 0) {
+            type = analyzeValue(cc, &node->condition, 0);
+        } else {
+            useSymbol(cc, node->condition);
+            if (node->condition->symbol->arraySize) {
+                compileError(cc, "Semantic error: Cannot assign to array '%s'", node->condition->name);
+            }
+            type = node->condition->dataType;
         }
-        analyzeExpression(node->body);
-    } else if (strcmp(node->name, "declare") == 0) {
-        
-        if (node->condition) {
-            declareSymbol(node->condition->name);
+        convertTo(cc, &node->body, analyzeValue(cc, &node->body, 0), type);
+        node->dataType = type;
+    } else if (node->type == AST_DECLARE) {
+        DataType type = node->condition->dataType;
+        declareSymbol(cc, node->condition);
+        if (node->condition->arraySize) {
+            for (ASTNode **value = &node->body; *value; value = &(*value)->next) {
+                convertTo(cc, value, analyzeValue(cc, value, 0), type);
+            }
+        } else if (node->body) {
+            convertTo(cc, &node->body, analyzeValue(cc, &node->body, 0), type);
         }
+        node->dataType = type;
+    } else if (strcmp(node->name, "return") == 0) {
         if (node->body) {
-            analyzeExpression(node->body);
+            convertTo(cc, &node->body, analyzeValue(cc, &node->body, 0), TYPE_INT);
         }
-    } else if (strcmp(node->name, "return") == 0) {
-        analyzeExpression(node->body);
-    } else {
-        
-        if (!node->condition && !node->body) {
-            
-            if (node->name[0] >= 'a' && node->name[0] <= 'z') {
-                useSymbol(node->name);  
+    } else if (node->type == AST_CALL) {
+        FunctionInfo *fn = analyzeCall(cc, node);
+        int index = 0;
+        for (ASTNode **arg = &node->body; *arg; arg = &(*arg)->next, index++) {
+            DataType type = analyzeValue(cc, arg, 1);
+            if (fn && index < MAX_TYPED_PARAMS) checkArgument(cc, fn, index, arg, type);
+        }
+        node->dataType = TYPE_INT;
+    } else if (strcmp(node->name, "[]") == 0) {
+        useSymbol(cc, node->condition);
+        if (!node->condition->symbol->arraySize) {
+            compileError(cc, "Semantic error: '%s' is not an array", node->condition->name);
+        }
+        if (analyzeValue(cc, &node->body, 0) != TYPE_INT) {
+            compileError(cc, "Semantic error: Index into '%s' is not an int", node->condition->name);
+        }
+        node->dataType = node->condition->dataType;
+    } else if (strcmp(node->name, "sizeof") == 0) {
+        int size = sizeOf(cc, &node->condition);
+        freeAST(node->condition);
+        node->condition = NULL;
+        sprintf(node->name, "%d", size);
+        node->dataType = TYPE_INT;
+    } else if (!node->condition && !node->body) {
+        int type = leafTokenType(node->name);
+        if (type == TOKEN_FLOAT) {
+            node->dataType = TYPE_FLOAT;
+        } else if (type == TOKEN_IDENTIFIER) {
+            useSymbol(cc, node);
+            if (node->symbol->arraySize && !allowArray) {
+                compileError(cc, "Semantic error: Array '%s' used as a value", node->name);
             }
         } else {
-            analyzeExpression(node->condition);
-            analyzeExpression(node->body);
+            node->dataType = TYPE_INT;
         }
+    } else {
+        DataType left = analyzeValue(cc, &node->condition, 0);
+        DataType right = analyzeValue(cc, &node->body, 0);
+        DataType type = left == TYPE_FLOAT || right == TYPE_FLOAT ? TYPE_FLOAT : TYPE_INT;
+        convertTo(cc, &node->condition, left, type);
+        convertTo(cc, &node->body, right, type);
+        // A comparison is int; its operands' type picks the instruction
+        node->dataType = isComparison(node->name) ? TYPE_INT : type;
+        if (type == TYPE_INT) *slot = reduceStrength(cc, node);
     }
+    return (*slot)->dataType;
+}
+
+DataType analyzeExpression(Compiler *cc, ASTNode **slot) {
+    return analyzeValue(cc, slot, 0);
 }
 
-void analyzeAST(ASTNode *node) {
+// Declares func and opens the scope of its parameters
+void enterFunction(Compiler *cc, ASTNode *func) {
+    declareFunction(cc, func);
+    enterScope(cc);
+    for (ASTNode *p = func->condition; p; p = p->next) {
+        declareSymbol(cc, p->condition);
+    }
+}
+
+void analyzeAST(Compiler *cc, ASTNode *node) {
     while (node) {
         switch (node->type) {
             case AST_FUNCTION:
-                enterScope();
-                analyzeAST(node->body);
-                exitScope();
+                enterFunction(cc, node);
+                analyzeAST(cc, node->body);
+                exitScope(cc);
                 break;
 
             case AST_BLOCK:
-                enterScope();
-                analyzeAST(node->body);
-                exitScope();
+                enterScope(cc);
+                analyzeAST(cc, node->body);
+                exitScope(cc);
                 break;
 
             case AST_IF:
-                analyzeExpression(node->condition);
-                analyzeAST(node->body);
-                if (node->elseBody) analyzeAST(node->elseBody);
+                analyzeExpression(cc, &node->condition);
+                analyzeAST(cc, node->body);
+                if (node->elseBody) analyzeAST(cc, node->elseBody);
                 break;
 
             case AST_WHILE:
-                analyzeExpression(node->condition);
-                analyzeAST(node->body);
+                analyzeExpression(cc, &node->condition);
+                analyzeAST(cc, node->body);
                 break;
 
             case AST_EXPRESSION:
-                analyzeExpression(node);
+            case AST_DECLARE:
+                analyzeExpression(cc, &node);
+                break;
+
+            case AST_STATEMENT:
+                analyzeExpression(cc, &node->body);
+                break;
+
+            default:
                 break;
         }
         node = node->next;
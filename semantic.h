@@ -3,7 +3,32 @@
 
 #include "parser.h"
 
-void analyzeAST(ASTNode *node);
+#define MAX_SCOPE_DEPTH 100
+#define INITIAL_SYMBOLS 256
+#define FUNCTION_BUCKETS 1024
+#define MAX_TYPED_PARAMS 16
 
-#endif
+typedef struct {
+    char name[100];
+    int scopeDepth;
+    DataType type;
+    ASTNode *decl;          // the declaration's variable node
+} Symbol;
+
+// Functions return int; arguments past MAX_TYPED_PARAMS are passed as is
+typedef struct {
+    char name[100];
+    int paramCount;
+    DataType paramTypes[MAX_TYPED_PARAMS];      // element type of an array parameter
+    char paramArrays[MAX_TYPED_PARAMS];
+    int nextInBucket;
+} FunctionInfo;
 
+FunctionInfo* findFunction(Compiler *cc, const char *name);
+void enterScope(Compiler *cc);
+void exitScope(Compiler *cc);
+void enterFunction(Compiler *cc, ASTNode *func);
+DataType analyzeExpression(Compiler *cc, ASTNode **slot);
+void analyzeAST(Compiler *cc, ASTNode *node);
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "lex", "parse", "semantic", "codegen", "optimize", "frame", "final", "load", "save"
+};
+
+static const char *counterNames[COUNTER_COUNT] = {
+    "tokens", "ast_nodes", "symbols", "quads_initial", "quads", "temps", "labels",
+    "frame_bytes", "frame_unshared",
+    "cache_hits", "cache_misses", "includes", "include_skips", "headers_lexed"
+};
+
+// Per thread, so concurrent compilations each see only their own
+static __thread long allocCount = 0;
+static __thread long allocBytes = 0;
+
+void* xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    allocCount++;
+    allocBytes += size;
+    return p;
+}
+
+void* xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    allocCount++;
+    allocBytes += count * size;
+    return p;
+}
+
+void* xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    allocCount++;
+    allocBytes += size;
+    return p;
+}
+
+static double clockSeconds(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// A compilation runs on one thread, so its CPU time is that thread's
+void phaseBegin(CompileStats *stats, Phase phase) {
+    (void)phase;
+    stats->wallStart = clockSeconds(CLOCK_MONOTONIC);
+    stats->cpuStart = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+    stats->allocCountStart = allocCount;
+    stats->allocBytesStart = allocBytes;
+}
+
+void phaseEnd(CompileStats *stats, Phase phase) {
+    PhaseStats *s = &stats->phases[phase];
+    s->ran = 1;
+    s->wallSeconds += clockSeconds(CLOCK_MONOTONIC) - stats->wallStart;
+    s->cpuSeconds += clockSeconds(CLOCK_THREAD_CPUTIME_ID) - stats->cpuStart;
+    s->allocs += allocCount - stats->allocCountStart;
+    s->allocBytes += allocBytes - stats->allocBytesStart;
+    s->peakRssKb = peakRssKb();
+}
+
+void setCounter(CompileStats *stats, Counter counter, long value) {
+    stats->counters[counter] = value;
+}
+
+void addCounter(CompileStats *stats, Counter counter, long value) {
+    stats->counters[counter] += value;
+}
+
+void mergeStats(CompileStats *total, const CompileStats *stats) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats *s = &stats->phases[i];
+        PhaseStats *t = &total->phases[i];
+        if (!s->ran) continue;
+        t->ran = 1;
+        t->wallSeconds += s->wallSeconds;
+        t->cpuSeconds += s->cpuSeconds;
+        t->allocs += s->allocs;
+        t->allocBytes += s->allocBytes;
+        if (s->peakRssKb > t->peakRssKb) t->peakRssKb = s->peakRssKb;
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) total->counters[i] += stats->counters[i];
+}
+
+// Adds work a phase did on other threads, which the thread CPU clock and
+// the per-thread allocation counters of phaseEnd do not see
+void addPhaseWork(CompileStats *total, const CompileStats *stats, Phase phase) {
+    const PhaseStats *s = &stats->phases[phase];
+    PhaseStats *t = &total->phases[phase];
+    t->cpuSeconds += s->cpuSeconds;
+    t->allocs += s->allocs;
+    t->allocBytes += s->allocBytes;
+}
+
+void printTimeReport(const CompileStats *stats) {
+    const PhaseStats *phases = stats->phases;
+    double wall = 0, cpu = 0;
+    long allocs = 0, bytes = 0;
+    fprintf(stderr, "\n=== Time Report ===\n");
+    fprintf(stderr, "%-10s %-10s %-10s %-12s %-8s %-10s\n",
+            "Phase", "Wall(ms)", "CPU(ms)", "PeakRSS(KB)", "Allocs", "Bytes");
+    fprintf(stderr, "--------------------------------------------------------------\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (!phases[i].ran) continue;
+        fprintf(stderr, "%-10s %-10.3f %-10.3f %-12ld %-8ld %-10ld\n", phaseNames[i],
+                phases[i].wallSeconds * 1000, phases[i].cpuSeconds * 1000,
+                phases[i].peakRssKb, phases[i].allocs, phases[i].allocBytes);
+        wall += phases[i].wallSeconds;
+        cpu += phases[i].cpuSeconds;
+        allocs += phases[i].allocs;
+        bytes += phases[i].allocBytes;
+    }
+    fprintf(stderr, "--------------------------------------------------------------\n");
+    fprintf(stderr, "%-10s %-10.3f %-10.3f %-12ld %-8ld %-10ld\n", "total",
+            wall * 1000, cpu * 1000, peakRssKb(), allocs, bytes);
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(stderr, "%-14s %ld\n", counterNames[i], stats->counters[i]);
+    }
+}
+
+static void writeJsonString(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// One object per run, stable keys, so the build farm can append and diff.
+// Bump TIME_REPORT_VERSION whenever a phase or counter is added, renamed
+// or removed.
+int writeTimeReportJson(const CompileStats *stats, const char *path, const char *source) {
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to write time report to %s\n", path);
+        return 0;
+    }
+
+    const PhaseStats *phases = stats->phases;
+    double wall = 0, cpu = 0;
+    long allocs = 0, bytes = 0;
+    fprintf(out, "{\n  \"version\": %d,\n  \"source\": ", TIME_REPORT_VERSION);
+    writeJsonString(out, source);
+    fprintf(out, ",\n  \"phases\": [\n");
+    int first = 1;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (!phases[i].ran) continue;
+        fprintf(out, "%s    {\"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+                     "\"peak_rss_kb\": %ld, \"allocs\": %ld, \"alloc_bytes\": %ld}",
+                first ? "" : ",\n", phaseNames[i],
+                phases[i].wallSeconds * 1000, phases[i].cpuSeconds * 1000,
+                phases[i].peakRssKb, phases[i].allocs, phases[i].allocBytes);
+        wall += phases[i].wallSeconds;
+        cpu += phases[i].cpuSeconds;
+        allocs += phases[i].allocs;
+        bytes += phases[i].allocBytes;
+        first = 0;
+    }
+    fprintf(out, "\n  ],\n  \"counters\": {");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %ld", i ? ", " : "", counterNames[i], stats->counters[i]);
+    }
+    fprintf(out, "},\n  \"total\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_rss_kb\": %ld, "
+                 "\"allocs\": %ld, \"alloc_bytes\": %ld}\n}\n",
+            wall * 1000, cpu * 1000, peakRssKb(), allocs, bytes);
+
+    if (out != stdout) fclose(out);
+    return 1;
+}
@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+// Version 2 added the frame, load and save phases and the frame, cache
+// and include counters
+#define TIME_REPORT_VERSION 2
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_SEMANTIC,
+    PHASE_CODEGEN,
+    PHASE_OPTIMIZE,
+    PHASE_FRAME,        // stack frame layout
+    PHASE_FINAL,
+    PHASE_LOAD,         // reading an artifact
+    PHASE_SAVE,         // writing one
+    PHASE_COUNT
+} Phase;
+
+typedef enum {
+    COUNTER_TOKENS,
+    COUNTER_AST_NODES,
+    COUNTER_SYMBOLS,
+    COUNTER_QUADS_INITIAL,
+    COUNTER_QUADS,
+    COUNTER_TEMPS,
+    COUNTER_LABELS,
+    COUNTER_FRAME_BYTES,
+    COUNTER_FRAME_UNSHARED,     // frame bytes with a slot per name
+    COUNTER_CACHE_HITS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_INCLUDES,
+    COUNTER_INCLUDES_SKIPPED,
+    COUNTER_HEADERS_LEXED,
+    COUNTER_COUNT
+} Counter;
+
+typedef struct {
+    int ran;
+    double wallSeconds;
+    double cpuSeconds;
+    long peakRssKb;
+    long allocs;
+    long allocBytes;
+} PhaseStats;
+
+// Statistics of one compilation; a batch merges its units into one
+typedef struct {
+    PhaseStats phases[PHASE_COUNT];
+    long counters[COUNTER_COUNT];
+
+    // Snapshot taken by phaseBegin
+    double wallStart, cpuStart;
+    long allocCountStart, allocBytesStart;
+} CompileStats;
+
+// Counting allocators; every compiler allocation goes through these
+void* xmalloc(size_t size);
+void* xcalloc(size_t count, size_t size);
+void* xrealloc(void *ptr, size_t size);
+
+void phaseBegin(CompileStats *stats, Phase phase);
+void phaseEnd(CompileStats *stats, Phase phase);
+void setCounter(CompileStats *stats, Counter counter, long value);
+void addCounter(CompileStats *stats, Counter counter, long value);
+void mergeStats(CompileStats *total, const CompileStats *stats);
+void addPhaseWork(CompileStats *total, const CompileStats *stats, Phase phase);
+
+void printTimeReport(const CompileStats *stats);
+int writeTimeReportJson(const CompileStats *stats, const char *path, const char *source);
+
+#endif
@@ -0,0 +1,43 @@
+#include <sched.h>
+#include "tokenring.h"
+
+// Each side owns one counter and only reads the other's, so a release
+// store paired with an acquire load is all the synchronization needed.
+// A side with nothing to do yields, which keeps a single CPU busy with
+// whichever thread can make progress.
+
+// Returns 0 once the parser has stopped, so the lexer can quit early
+int ringPush(TokenRing *ring, const Token *tok) {
+    long index = atomic_load_explicit(&ring->published, memory_order_relaxed);
+    while (index - atomic_load_explicit(&ring->released, memory_order_acquire) >= TOKEN_RING_SIZE) {
+        if (atomic_load_explicit(&ring->stopped, memory_order_relaxed)) return 0;
+        sched_yield();
+    }
+
+    ring->slots[index & (TOKEN_RING_SIZE - 1)] = *tok;
+    atomic_store_explicit(&ring->published, index + 1, memory_order_release);
+    return 1;
+}
+
+void ringFinish(TokenRing *ring) {
+    atomic_store_explicit(&ring->finished, 1, memory_order_release);
+}
+
+// Waits for token index; NULL past the end of input
+Token* ringAt(TokenRing *ring, long index) {
+    while (index >= atomic_load_explicit(&ring->published, memory_order_acquire)) {
+        if (atomic_load_explicit(&ring->finished, memory_order_acquire) &&
+            index >= atomic_load_explicit(&ring->published, memory_order_acquire)) {
+            return NULL;
+        }
+        sched_yield();
+    }
+    return &ring->slots[index & (TOKEN_RING_SIZE - 1)];
+}
+
+// Hands every token before count back to the lexer
+void ringRelease(TokenRing *ring, long count) {
+    if (count > atomic_load_explicit(&ring->released, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->released, count, memory_order_release);
+    }
+}
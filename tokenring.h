@@ -0,0 +1,31 @@
+#ifndef TOKENRING_H
+#define TOKENRING_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "lexer.h"
+#include "stats.h"
+
+#define TOKEN_RING_SIZE 1024        // a power of two
+#define TOKEN_RING_HISTORY 16       // tokens kept behind the parser's position
+
+// Bounded single-producer/single-consumer queue between a lexer thread and
+// the parser. Token i lives in slots[i % TOKEN_RING_SIZE] until the parser
+// moves TOKEN_RING_HISTORY tokens past it, so a token it has just read
+// (for an error message, say) stays valid while it looks ahead.
+typedef struct {
+    Token slots[TOKEN_RING_SIZE];
+    atomic_long published;          // tokens written by the lexer
+    atomic_long released;           // tokens the parser is done with
+    atomic_int finished;            // the lexer reached end of input
+    atomic_int stopped;             // the parser gave up; the lexer quits
+    pthread_t thread;
+    CompileStats stats;             // lexing, timed on the lexer thread
+} TokenRing;
+
+int ringPush(TokenRing *ring, const Token *tok);
+void ringFinish(TokenRing *ring);
+Token* ringAt(TokenRing *ring, long index);
+void ringRelease(TokenRing *ring, long count);
+
+#endif
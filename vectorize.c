@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+
+// A loop has the shape while (i < bound) generates after copyprop:
+//
+//   Lh:  LABEL                        Lv:  LABEL
+//        t = i < bound                     tv = i + (VECTOR_WIDTH-1)
+//        iffalse t Lx                      tc = tv < bound
+//        ...body...               =>       iffalse tc Lh
+//        tk = i + 1                        ...body, VECTOR_WIDTH lanes...
+//        i = tk                            tn = i + VECTOR_WIDTH
+//        goto Lh                           i = tn
+//   Lx:  LABEL                             goto Lv
+//                                     Lh:  ...the loop as it was...
+//
+// Every value the body computes is classified: invariant (not computed in
+// the loop), affine (i plus a constant, kept scalar and used as an index)
+// or vector (loaded, or combined from other values lane by lane).
+// Invariants become VSPLATs ahead of Lv; an affine value used as data
+// becomes a VSTEP.
+
+typedef enum {
+    VALUE_INVARIANT,
+    VALUE_AFFINE,
+    VALUE_VECTOR,
+    VALUE_NONE          // a store
+} ValueKind;
+
+typedef struct {
+    const char *name;
+    ValueKind kind;
+    int offset;         // affine: i + offset
+    const char *vector; // vector: its name in the vector loop
+} LoopValue;
+
+typedef struct {
+    const char *array;
+    int offset;         // element i + offset
+    int isStore;
+} Access;
+
+// The vector loop is skipped when a DIST b falls in [low, high]
+typedef struct {
+    const char *a;
+    const char *b;
+    int low;
+    int high;
+} AliasCheck;
+
+typedef struct {
+    const char *text;
+    const char *vector;
+} Splat;
+
+typedef struct {
+    int head;               // LABEL Lh
+    int bodyStart;
+    int bodyEnd;            // first quad of the update
+    int exit;               // LABEL Lx
+    const char *var;
+    const char *compare;    // < or <=
+    const char *bound;
+    LoopValue values[VECTORIZE_MAX_BODY];   // one per body quad
+    Access accesses[VECTORIZE_MAX_BODY];
+    int accessCount;
+    AliasCheck checks[VECTORIZE_MAX_CHECKS];
+    int checkCount;
+    Splat splats[VECTORIZE_MAX_BODY * 2];
+    int splatCount;
+    Splat steps[VECTORIZE_MAX_BODY * 2];
+    int stepCount;
+} Loop;
+
+static const char *elementOps[] = {"+", "-", "*", "&", "<<", ">>", "f+", "f-", "f*", "f/"};
+
+static void put(Compiler* cc, const char* result, const char* arg1, const char* op, const char* arg2) {
+    if (cc->vectorOutIndex == cc->vectorOutCapacity) {
+        cc->vectorOutCapacity = cc->vectorOutCapacity ? cc->vectorOutCapacity * 2 : INITIAL_CODE;
+        cc->vectorOut = (Quadruple*)xrealloc(cc->vectorOut, sizeof(Quadruple) * cc->vectorOutCapacity);
+    }
+    setQuad(&cc->vectorOut[cc->vectorOutIndex++], result, arg1, op, arg2);
+}
+
+static int isOp(const Quadruple *q, const char *op) {
+    return strcmp(q->op, op) == 0;
+}
+
+static int isConstant(char *text) {
+    return is_number(text) || is_float(text);
+}
+
+static int isElementOp(const char *op) {
+    for (size_t i = 0; i < sizeof(elementOps) / sizeof(elementOps[0]); i++) {
+        if (strcmp(elementOps[i], op) == 0) return 1;
+    }
+    return 0;
+}
+
+// ---------- matching ----------
+
+// Fills in the loop's frame if code[head] starts one of the right shape
+static int matchLoop(Compiler *cc, int head, Loop *loop) {
+    Quadruple *code = cc->code;
+    if (head + 3 >= cc->codeIndex) return 0;
+    Quadruple *test = &code[head + 1], *branch = &code[head + 2];
+    if ((!isOp(test, "<") && !isOp(test, "<=")) || isConstant(test->arg1) || !isOp(branch, "iffalse") ||
+        strcmp(branch->arg1, test->result) != 0) {
+        return 0;
+    }
+
+    int back = head + 3;
+    while (back < cc->codeIndex && back - head <= VECTORIZE_MAX_BODY + 4) {
+        Quadruple *q = &code[back];
+        if (isOp(q, "goto") || isOp(q, "iffalse") || isOp(q, "LABEL") || isOp(q, "ENDFUNC")) break;
+        back++;
+    }
+    if (back + 1 >= cc->codeIndex || !isOp(&code[back], "goto") ||
+        strcmp(code[back].arg2, code[head].result) != 0 || !isOp(&code[back + 1], "LABEL") ||
+        strcmp(code[back + 1].result, branch->arg2) != 0) {
+        return 0;
+    }
+
+    // i = i + 1, or tk = i + 1; i = tk
+    const char *var = test->arg1;
+    Quadruple *last = &code[back - 1];
+    int bodyEnd;
+    if (back - 1 > head + 2 && isOp(last, "+") && strcmp(last->result, var) == 0 &&
+        strcmp(last->arg1, var) == 0 && strcmp(last->arg2, "1") == 0) {
+        bodyEnd = back - 1;
+    } else if (back - 2 > head + 2 && isOp(last, "=") && strcmp(last->result, var) == 0 &&
+               isOp(&code[back - 2], "+") && strcmp(code[back - 2].result, last->arg1) == 0 &&
+               strcmp(code[back - 2].arg1, var) == 0 && strcmp(code[back - 2].arg2, "1") == 0) {
+        bodyEnd = back - 2;
+    } else {
+        return 0;
+    }
+    if (bodyEnd - (head + 3) > VECTORIZE_MAX_BODY) return 0;
+
+    loop->head = head;
+    loop->bodyStart = head + 3;
+    loop->bodyEnd = bodyEnd;
+    loop->exit = back + 1;
+    loop->var = var;
+    loop->compare = test->op;
+    loop->bound = test->arg2;
+    loop->accessCount = loop->checkCount = 0;
+    loop->splatCount = loop->stepCount = 0;
+    return 1;
+}
+
+// ---------- classification ----------
+
+static int isStore(const Quadruple *q) {
+    return isOp(q, "[]=");
+}
+
+static int definedInBody(Compiler *cc, Loop *loop, const char *name) {
+    for (int j = loop->bodyStart; j < loop->bodyEnd; j++) {
+        if (!isStore(&cc->code[j]) && strcmp(cc->code[j].result, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Reads of name between the loop's head and exit, counted the way the
+// use table counts them
+static int readsInLoop(Compiler *cc, Loop *loop, const char *name) {
+    int reads = 0;
+    for (int j = loop->head + 1; j < loop->exit; j++) {
+        Quadruple *q = &cc->code[j];
+        if (!isOp(q, "goto") && strcmp(q->arg1, name) == 0) reads++;
+        if (!isOp(q, "goto") && !isOp(q, "iffalse") && strcmp(q->arg2, name) == 0) reads++;
+        if (isStore(q) && strcmp(q->result, name) == 0) reads++;
+    }
+    return reads;
+}
+
+// The value text has at body quad index, or NULL when it is read before
+// the body computes it, i.e. carried over from the previous iteration
+static const LoopValue* classify(Compiler *cc, Loop *loop, int index, char *text, LoopValue *scratch) {
+    scratch->name = text;
+    scratch->offset = 0;
+    scratch->vector = NULL;
+    if (strcmp(text, loop->var) == 0) {
+        scratch->kind = VALUE_AFFINE;
+        return scratch;
+    }
+    if (!isConstant(text)) {
+        for (int k = 0; k < index; k++) {
+            if (loop->values[k].kind != VALUE_NONE && strcmp(loop->values[k].name, text) == 0) return &loop->values[k];
+        }
+        if (definedInBody(cc, loop, text)) return NULL;
+    }
+    scratch->kind = VALUE_INVARIANT;
+    return scratch;
+}
+
+static int addAccess(Loop *loop, const char *array, const LoopValue *index, int store) {
+    if (index->kind != VALUE_AFFINE) return 0;
+    Access *a = &loop->accesses[loop->accessCount++];
+    a->array = array;
+    a->offset = index->offset;
+    a->isStore = store;
+    return 1;
+}
+
+// Classifies every body quad; 0 when one of them cannot run lane by lane
+static int analyzeBody(Compiler *cc, Loop *loop) {
+    int stores = 0;
+    for (int j = loop->bodyStart; j < loop->bodyEnd; j++) {
+        Quadruple *q = &cc->code[j];
+        if (isStore(q)) continue;
+        if (!q->result[0] || strcmp(q->result, loop->var) == 0 || strcmp(q->result, loop->bound) == 0) return 0;
+        for (int k = loop->bodyStart; k < j; k++) {
+            if (!isStore(&cc->code[k]) && strcmp(cc->code[k].result, q->result) == 0) return 0;
+        }
+        // Lanes other than the last would leave nothing behind
+        if (useCount(cc, loop->head, q->result) != readsInLoop(cc, loop, q->result)) return 0;
+    }
+
+    for (int j = loop->bodyStart; j < loop->bodyEnd; j++) {
+        Quadruple *q = &cc->code[j];
+        int index = j - loop->bodyStart;
+        LoopValue *value = &loop->values[index];
+        LoopValue scratch1, scratch2;
+        const LoopValue *a = classify(cc, loop, index, q->arg1, &scratch1);
+        const LoopValue *b = q->arg2[0] ? classify(cc, loop, index, q->arg2, &scratch2) : NULL;
+        if (!a || (q->arg2[0] && !b)) return 0;
+
+        value->name = q->result;
+        value->vector = NULL;
+        value->offset = 0;
+        if (isStore(q)) {
+            LoopValue scratch3;
+            const LoopValue *array = classify(cc, loop, index, q->result, &scratch3);
+            if (!array || array->kind != VALUE_INVARIANT || isConstant(q->result)) return 0;
+            if (!addAccess(loop, q->result, a, 1)) return 0;
+            value->kind = VALUE_NONE;
+            stores++;
+        } else if (isOp(q, "[]")) {
+            if (a->kind != VALUE_INVARIANT || isConstant(q->arg1) || !addAccess(loop, q->arg1, b, 0)) return 0;
+            value->kind = VALUE_VECTOR;
+        } else if (isOp(q, "=") && !q->arg2[0]) {
+            if (a->kind == VALUE_INVARIANT) return 0;
+            *value = *a;
+            value->name = q->result;
+        } else if ((isOp(q, "+") || isOp(q, "-")) && a->kind == VALUE_AFFINE && is_number(q->arg2)) {
+            value->kind = VALUE_AFFINE;
+            value->offset = a->offset + (isOp(q, "+") ? atoi(q->arg2) : -atoi(q->arg2));
+        } else if (isOp(q, "+") && b && b->kind == VALUE_AFFINE && is_number(q->arg1)) {
+            value->kind = VALUE_AFFINE;
+            value->offset = b->offset + atoi(q->arg1);
+        } else if (isElementOp(q->op) && b) {
+            // The induction variable is an int
+            if (q->op[0] == 'f' && (a->kind == VALUE_AFFINE || b->kind == VALUE_AFFINE)) return 0;
+            value->kind = VALUE_VECTOR;
+        } else {
+            return 0;
+        }
+        if (value->offset <= -VECTORIZE_MAX_OFFSET || value->offset >= VECTORIZE_MAX_OFFSET) return 0;
+    }
+    return stores > 0;
+}
+
+// ---------- dependences ----------
+
+// Local arrays are disjoint from each other and from anything passed in;
+// other array names may point anywhere
+static int isLocalArray(Compiler *cc, int index, const char *name) {
+    int start = index, end = index, local = 0;
+    while (start > 0 && !isOp(&cc->code[start], "FUNC")) start--;
+    while (end < cc->codeIndex && !isOp(&cc->code[end], "ENDFUNC")) end++;
+    for (int j = start; j < end; j++) {
+        Quadruple *q = &cc->code[j];
+        if (strcmp(q->result, name) != 0 || isStore(q)) continue;
+        if (!isOp(q, "ARRAY")) return 0;
+        local = 1;
+    }
+    return local;
+}
+
+static int addCheck(Loop *loop, const char *a, const char *b, int low, int high) {
+    for (int k = 0; k < loop->checkCount; k++) {
+        AliasCheck *c = &loop->checks[k];
+        if (strcmp(c->a, a) == 0 && strcmp(c->b, b) == 0 && c->low == low && c->high == high) return 1;
+    }
+    if (loop->checkCount == VECTORIZE_MAX_CHECKS) return 0;
+    loop->checks[loop->checkCount++] = (AliasCheck){a, b, low, high};
+    return 1;
+}
+
+// A store at element s + j (iteration j) and another access at element
+// x + k meet when k - j = s - x = d. Running VECTOR_WIDTH iterations at a
+// time only reorders accesses whose d is within VECTOR_WIDTH - 1 of zero:
+// a load ahead of the store must not see a store from an earlier lane
+// (d > 0), one after it not a store from a later lane (d < 0), and two
+// stores must keep the later lane's value. With unknown bases the test
+// becomes a run-time check on the distance between them.
+static int checkDependences(Compiler *cc, Loop *loop) {
+    const int last = VECTOR_WIDTH - 1;
+    for (int s = 0; s < loop->accessCount; s++) {
+        Access *store = &loop->accesses[s];
+        if (!store->isStore) continue;
+        for (int x = 0; x < loop->accessCount; x++) {
+            Access *other = &loop->accesses[x];
+            if (x == s) continue;
+            int low, high;
+            if (other->isStore) low = -last, high = last;
+            else if (x < s) low = 1, high = last;
+            else low = -last, high = -1;
+
+            int d = store->offset - other->offset;
+            if (strcmp(store->array, other->array) == 0) {
+                if (other->isStore && d == 0) continue;
+                if (d >= low && d <= high) return 0;
+            } else if (!isLocalArray(cc, loop->head, store->array) || !isLocalArray(cc, loop->head, other->array)) {
+                if (!addCheck(loop, store->array, other->array, low - d, high - d)) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// ---------- rewriting ----------
+
+static const char* findSplat(const Splat *list, int count, const char *text) {
+    for (int k = 0; k < count; k++) {
+        if (strcmp(list[k].text, text) == 0) return list[k].vector;
+    }
+    return NULL;
+}
+
+// The vector for operand text of body quad index, emitting the VSPLAT or
+// VSTEP that makes it the first time it is needed
+static const char* vectorOperand(Compiler *cc, Loop *loop, int index, char *text) {
+    LoopValue scratch;
+    const LoopValue *value = classify(cc, loop, index, text, &scratch);
+    if (value->kind == VALUE_VECTOR) return value->vector;
+
+    Splat *list = value->kind == VALUE_INVARIANT ? loop->splats : loop->steps;
+    int *count = value->kind == VALUE_INVARIANT ? &loop->splatCount : &loop->stepCount;
+    const char *vector = findSplat(list, *count, text);
+    if (!vector) {
+        vector = newTemp(cc);
+        put(cc, vector, text, value->kind == VALUE_INVARIANT ? "VSPLAT" : "VSTEP", "");
+        list[(*count)++] = (Splat){text, vector};
+    }
+    return vector;
+}
+
+static void emitChecks(Compiler *cc, Loop *loop) {
+    const char *scalarLoop = cc->code[loop->head].result;
+    for (int k = 0; k < loop->checkCount; k++) {
+        AliasCheck *check = &loop->checks[k];
+        char *distance = newTemp(cc), *low = newTemp(cc), *high = newTemp(cc);
+        char *safe = newLabel(cc);
+        char bound[MAX_LEN];
+        put(cc, distance, check->a, "DIST", check->b);
+        sprintf(bound, "%d", check->low);
+        put(cc, low, distance, ">=", bound);
+        put(cc, "", low, "iffalse", safe);
+        sprintf(bound, "%d", check->high);
+        put(cc, high, distance, "<=", bound);
+        put(cc, "", high, "iffalse", safe);
+        put(cc, "", "", "goto", scalarLoop);
+        put(cc, safe, "", "LABEL", "");
+    }
+}
+
+static void emitVectorLoop(Compiler *cc, Loop *loop) {
+    Quadruple *code = cc->code;
+    const char *scalarLoop = code[loop->head].result;
+    char step[MAX_LEN];
+
+    emitChecks(cc, loop);
+
+    // Invariant operands are splatted once, ahead of the loop
+    for (int j = loop->bodyStart; j < loop->bodyEnd; j++) {
+        Quadruple *q = &code[j];
+        int index = j - loop->bodyStart;
+        LoopValue scratch;
+        if (isOp(q, "[]") || isOp(q, "=") || loop->values[index].kind == VALUE_AFFINE) continue;
+        if (!isStore(q) && classify(cc, loop, index, q->arg1, &scratch)->kind == VALUE_INVARIANT) {
+            vectorOperand(cc, loop, index, q->arg1);
+        }
+        if (classify(cc, loop, index, q->arg2, &scratch)->kind == VALUE_INVARIANT) {
+            vectorOperand(cc, loop, index, q->arg2);
+        }
+    }
+
+    char *top = newLabel(cc), *lastLane = newTemp(cc), *test = newTemp(cc);
+    put(cc, top, "", "LABEL", "");
+    sprintf(step, "%d", VECTOR_WIDTH - 1);
+    put(cc, lastLane, loop->var, "+", step);
+    put(cc, test, lastLane, loop->compare, loop->bound);
+    put(cc, "", test, "iffalse", scalarLoop);
+
+    for (int j = loop->bodyStart; j < loop->bodyEnd; j++) {
+        Quadruple *q = &code[j];
+        int index = j - loop->bodyStart;
+        LoopValue *value = &loop->values[index];
+        char op[MAX_LEN];
+
+        if (value->kind == VALUE_AFFINE) {
+            put(cc, q->result, q->arg1, q->op, q->arg2);
+        } else if (isStore(q)) {
+            put(cc, q->result, q->arg1, "V[]=", vectorOperand(cc, loop, index, q->arg2));
+        } else if (isOp(q, "[]")) {
+            value->vector = newTemp(cc);
+            put(cc, value->vector, q->arg1, "V[]", q->arg2);
+        } else if (isOp(q, "=")) {
+            value->vector = vectorOperand(cc, loop, index, q->arg1);
+        } else {
+            const char *a = vectorOperand(cc, loop, index, q->arg1);
+            const char *b = vectorOperand(cc, loop, index, q->arg2);
+            value->vector = newTemp(cc);
+            snprintf(op, sizeof(op), "V%.*s", MAX_LEN - 2, q->op);
+            put(cc, value->vector, a, op, b);
+        }
+    }
+
+    char *next = newTemp(cc);
+    sprintf(step, "%d", VECTOR_WIDTH);
+    put(cc, next, loop->var, "+", step);
+    put(cc, loop->var, next, "=", "");
+    put(cc, "", "", "goto", top);
+}
+
+// Puts a vector copy in front of every loop that allows one; returns
+// the number of loops vectorized
+int vectorizeLoops(Compiler *cc) {
+    Loop *loop = (Loop*)xmalloc(sizeof(Loop));
+    int vectorized = 0;
+    cc->vectorOutIndex = 0;
+
+    for (int i = 0; i < cc->codeIndex; i++) {
+        if (isOp(&cc->code[i], "LABEL") && matchLoop(cc, i, loop) && analyzeBody(cc, loop) &&
+            checkDependences(cc, loop)) {
+            emitVectorLoop(cc, loop);
+            if (cc->options->dumpFlags & DUMP_PASSES) {
+                outPrintf(&cc->dumpOutput, "Vectorized loop at line %d (%d quads, %d alias check%s)\n",
+                          i, loop->bodyEnd - loop->bodyStart, loop->checkCount, loop->checkCount == 1 ? "" : "s");
+            }
+            vectorized++;
+        }
+        Quadruple *q = &cc->code[i];
+        put(cc, q->result, q->arg1, q->op, q->arg2);
+    }
+    free(loop);
+    if (!vectorized) return 0;
+
+    Quadruple *old = cc->code;
+    int oldCapacity = cc->codeCapacity;
+    cc->code = cc->vectorOut;
+    cc->codeCapacity = cc->vectorOutCapacity;
+    cc->codeIndex = cc->vectorOutIndex;
+    cc->vectorOut = old;
+    cc->vectorOutCapacity = oldCapacity;
+    return vectorized;
+}
@@ -0,0 +1,16 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include "codegen.h"
+
+// Loop vectorizer. A counted while loop whose body only loads, stores and
+// combines array elements at the induction variable (plus a constant) is
+// given a copy that handles VECTOR_WIDTH iterations at a time; the
+// original loop stays behind it for the iterations that are left over.
+#define VECTORIZE_MAX_BODY 64       // quads between the branch and the update
+#define VECTORIZE_MAX_CHECKS 8      // run-time overlap tests per loop
+#define VECTORIZE_MAX_OFFSET 65536
+
+int vectorizeLoops(Compiler *cc);
+
+#endif